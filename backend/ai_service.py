@@ -49,7 +49,23 @@ class AIService:
         try:
             # Explicitly request ESP32Servo.h to avoid standard Servo.h errors on ESP32
             result = await self.runner.run(
-                input=f"Generate firmware code for: {spec}. Use Arduino.h. If using a servo, USE <ESP32Servo.h>. NO STATICS/CONST in global scope. always detach at the start of setup and reattach.",
+                input=f"Generate firmware code for: {spec}. Use Arduino.h. If using a servo, USE <ESP32Servo.h>. NO STATICS/CONST in global scope. always detach at the start of setup and reattach. "
+                "Never block: do not call delay() or busy-wait. Include \"coop.h\" and write each behavior as "
+                "void step(CoopTask &t) { CO_BEGIN(t); ... CO_DELAY(t, ms); ... CO_RESTART(t); } "
+                "(CO_END(t) instead of CO_RESTART for one-shot behaviors). Locals do not survive CO_DELAY, "
+                "keep loop counters in globals and mark each with a trailing // novar comment (int i = 0; // novar) so it is not exposed as a tunable. setup() calls coopReset() and then coopSpawn(step) "
+                "once per behavior, and coopEvery(fn, ms) for plain periodic work such as sampling a sensor; "
+                "loop() only calls coopTick(), which runs at a fixed 1 kHz. "
+                "Move servos with #include \"servo_motion.h\": attach with motionAttach(servo, pin, 500, 2400) "
+                "instead of servo.attach, then motionMove(servo, angle, ms, MOTION_SCURVE) "
+                "(or MOTION_LINEAR, MOTION_TRAPEZOID), then CO_WAIT_UNTIL(t, !motionBusy(servo)); "
+                "never step a servo a degree at a time. "
+                "Blink LEDs with #include \"led_pattern.h\": ledPatternMorse(pin, text, unitMs, loop) or "
+                "ledPatternPlay(pin, durationsUs, count, loop) with alternating on/off microseconds; "
+                "the RMT hardware plays them, so never toggle an LED with digitalWrite in a timed loop. "
+                "Sample analog sensors with #include \"adc_stream.h\": adcStreamStart(pin, 20000, 20, ADC_REDUCE_MEAN) "
+                "in setup (ADC1 pins 32-39 only), then adcStreamRead(buf, n) or adcStreamLatest() from a step; "
+                "never call analogRead in a loop.",
                 model="openai/gpt-5.2",
                 response_format=CodeResponse,
             )
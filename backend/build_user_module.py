@@ -0,0 +1,238 @@
+"""Builds firmware/src/ai.cpp as a user module (see firmware/include/user_module.h).
+
+The sketch is compiled against the shims in firmware/module/, linked with
+firmware/module/module.ld and packed as
+
+    UserModuleHeader | text | data | u32 relocs[]
+
+Relocations are the absolute 32-bit words (R_XTENSA_32) the loader has to
+rebase; everything else in Xtensa code is PC-relative. Anything that needs
+a symbol from outside the module fails here, not on the device.
+"""
+
+import os
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import zlib
+from pathlib import Path
+
+PROJECT_ROOT = Path(__file__).parent.parent
+FIRMWARE_DIR = PROJECT_ROOT / "firmware"
+MODULE_DIR = FIRMWARE_DIR / "module"
+INCLUDE_DIR = FIRMWARE_DIR / "include"
+
+
+def header_define(name: str) -> int:
+    """A numeric #define from firmware/include/user_module.h, the values
+    the loader checks, so the packer cannot drift from the core."""
+    text = (INCLUDE_DIR / "user_module.h").read_text()
+    m = re.search(r"(?m)^#define " + name + r"\s+(0x[0-9A-Fa-f]+|\d+)u?\b", text)
+    if not m:
+        raise RuntimeError(f"{name} not found in user_module.h")
+    return int(m.group(1), 0)
+
+
+ABI_VERSION = header_define("USER_MODULE_ABI_VERSION")
+MAGIC = header_define("USER_MODULE_MAGIC")
+DATA_VADDR = header_define("USER_MODULE_DATA_VADDR")
+RELOC_IN_DATA = header_define("USER_MODULE_RELOC_IN_DATA")
+HEADER_FMT = "<IHHIIIIIIII"
+
+R_XTENSA_32 = 1
+SHT_SYMTAB = 2
+SHT_RELA = 4
+SHT_REL = 9
+SHN_UNDEF = 0
+
+CFLAGS = [
+    "-std=gnu++17",
+    "-Os",
+    "-mlongcalls",
+    "-ffreestanding",
+    "-fno-exceptions",
+    "-fno-rtti",
+    "-fno-threadsafe-statics",
+    "-fno-use-cxa-atexit",
+    "-ffunction-sections",
+    "-fdata-sections",
+]
+
+
+class ModuleBuildError(Exception):
+    pass
+
+
+def find_compiler() -> str:
+    env = os.environ.get("XTENSA_GXX")
+    if env:
+        return env
+    found = shutil.which("xtensa-esp32-elf-g++")
+    if found:
+        return found
+    pio = (
+        Path.home()
+        / ".platformio/packages/toolchain-xtensa-esp32/bin/xtensa-esp32-elf-g++"
+    )
+    if pio.exists():
+        return str(pio)
+    raise ModuleBuildError("xtensa-esp32-elf-g++ not found (set XTENSA_GXX)")
+
+
+class Elf:
+    def __init__(self, data: bytes):
+        if data[:4] != b"\x7fELF" or data[4] != 1:
+            raise ModuleBuildError("not a 32-bit ELF")
+        self.data = data
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            fields = struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize)
+            self.sections.append(fields)
+        strtab = self.sections[shstrndx]
+        self.names = [self._str(strtab, s[0]) for s in self.sections]
+
+    def _str(self, strtab, off):
+        start = strtab[4] + off
+        return self.data[start : self.data.index(b"\0", start)].decode()
+
+    def section(self, name):
+        for i, n in enumerate(self.names):
+            if n == name:
+                return i, self.sections[i]
+        return None, None
+
+    def contents(self, sec):
+        return self.data[sec[4] : sec[4] + sec[5]]
+
+    def symbols(self):
+        for sec in self.sections:
+            if sec[1] != SHT_SYMTAB:
+                continue
+            strtab = self.sections[sec[6]]
+            for off in range(0, sec[5], 16):
+                name, value, size, info, other, shndx = struct.unpack_from(
+                    "<IIIBBH", self.data, sec[4] + off
+                )
+                yield self._str(strtab, name), value, shndx
+
+    def relocations(self, target_index):
+        symbols = list(self.symbols())
+        for sec in self.sections:
+            if sec[1] not in (SHT_RELA, SHT_REL) or sec[7] != target_index:
+                continue
+            for off in range(0, sec[5], sec[9]):
+                r_offset, r_info = struct.unpack_from("<II", self.data, sec[4] + off)
+                sym = symbols[r_info >> 8] if r_info >> 8 < len(symbols) else None
+                yield r_offset, r_info & 0xFF, sym
+
+
+def pack(elf: Elf) -> bytes:
+    text_i, text = elf.section(".text")
+    data_i, data = elf.section(".data")
+    _, bss = elf.section(".bss")
+    if text is None or text[3] != 0:
+        raise ModuleBuildError("module text is not linked at 0")
+    text_bytes = elf.contents(text)
+    text_bytes += b"\0" * (-len(text_bytes) % 4)
+    data_bytes = elf.contents(data) if data else b""
+    data_bytes += b"\0" * (-len(data_bytes) % 4)
+    # bss may be aligned past the end of data, the loader zeroes the gap too
+    data_end = DATA_VADDR + len(data_bytes)
+    bss_size = bss[3] + bss[5] - data_end if bss else 0
+    if bss_size < 0:
+        raise ModuleBuildError("bss overlaps data")
+
+    syms = {name: value for name, value, _ in elf.symbols() if name}
+    for name, _, shndx in elf.symbols():
+        if name and shndx == SHN_UNDEF:
+            raise ModuleBuildError(f"module needs '{name}' which the core does not export")
+    if "user_module_init" not in syms:
+        raise ModuleBuildError("user_module_init missing")
+
+    relocs = []
+    for index, base, seg, flag in (
+        (text_i, 0, text_bytes, 0),
+        (data_i, DATA_VADDR, data_bytes, RELOC_IN_DATA),
+    ):
+        if index is None:
+            continue
+        for r_offset, r_type, sym in elf.relocations(index):
+            if r_type != R_XTENSA_32:
+                continue
+            off = r_offset - base
+            value, = struct.unpack_from("<I", seg, off)
+            inside = value < len(text_bytes) or (
+                DATA_VADDR <= value < DATA_VADDR + len(data_bytes) + bss_size
+            )
+            if not inside:
+                name = sym[0] if sym else "?"
+                raise ModuleBuildError(f"absolute reference outside the module: {name}")
+            relocs.append(off | flag)
+
+    init_start = syms.get("__init_array_start", DATA_VADDR) - DATA_VADDR
+    init_count = (syms.get("__init_array_end", DATA_VADDR) - DATA_VADDR - init_start) // 4
+
+    body = text_bytes + data_bytes + b"".join(struct.pack("<I", r) for r in relocs)
+    header = struct.pack(
+        HEADER_FMT,
+        MAGIC,
+        ABI_VERSION,
+        struct.calcsize(HEADER_FMT),
+        len(text_bytes),
+        len(data_bytes),
+        bss_size,
+        len(relocs),
+        syms["user_module_init"],
+        init_start,
+        init_count,
+        zlib.crc32(body) & 0xFFFFFFFF,
+    )
+    return header + body
+
+
+def build_user_module(sketch: Path, out: Path) -> bytes:
+    gxx = find_compiler()
+    # the apply hooks generate_variable_glue.py wrote next to the sketch
+    hooks = sketch.parent / "ai_hooks_gen.cpp"
+    with tempfile.TemporaryDirectory() as tmp:
+        elf_path = Path(tmp) / "module.elf"
+        cmd = [
+            gxx,
+            *CFLAGS,
+            f"-I{MODULE_DIR}",
+            f"-I{INCLUDE_DIR}",
+            str(MODULE_DIR / "module_main.cpp"),
+            str(sketch),
+            *([str(hooks)] if hooks.exists() else []),
+            "-nostdlib",
+            "-Wl,-q",
+            "-Wl,--build-id=none",
+            "-Wl,--gc-sections",
+            f"-Wl,-T,{MODULE_DIR / 'module.ld'}",
+            "-lgcc",
+            "-o",
+            str(elf_path),
+        ]
+        result = subprocess.run(cmd, capture_output=True, text=True)
+        if result.returncode != 0:
+            raise ModuleBuildError(result.stderr or result.stdout)
+        image = pack(Elf(elf_path.read_bytes()))
+    out.write_bytes(image)
+    return image
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("usage: build_user_module.py SKETCH.cpp OUT.bin")
+        sys.exit(1)
+    try:
+        img = build_user_module(Path(sys.argv[1]), Path(sys.argv[2]))
+    except ModuleBuildError as e:
+        print(e)
+        sys.exit(1)
+    print(f"module: {len(img)} bytes")
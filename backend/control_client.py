@@ -0,0 +1,180 @@
+"""Client for the UDP control channel (firmware/include/control_channel.h).
+
+    python control_client.py 192.168.1.50 servoPin=90 ledPin=2
+    python control_client.py 192.168.1.50 --watch [interval_ms] [pin ...]
+"""
+
+import socket
+import struct
+import sys
+import time
+import urllib.request
+
+PORT = 4210
+VERSION = 1
+HEADER = struct.Struct("<BBHH")
+
+# AiVarType in firmware/include/ai_vars.h
+TEXT_TYPES = {3, 4, 5, 6}
+FLOAT_TYPE = 7
+
+STATUS = {0: "ok", 1: "stale table", 2: "bad entry", 3: "batch full"}
+
+
+class ControlClient:
+    def __init__(self, host: str, port: int = PORT, timeout: float = 0.5):
+        self.addr = (host, port)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(timeout)
+        self.seq = 0
+        self.generation = 0
+        self.vars = {}  # name -> (id, type)
+        self.samples = []  # CTRL_SAMPLES batches, oldest first
+
+    def hello(self):
+        self.sock.sendto(HEADER.pack(ord("H"), VERSION, 0, 0), self.addr)
+        data, _ = self.sock.recvfrom(2048)
+        kind, _, _, self.generation = HEADER.unpack_from(data)
+        if kind != ord("L"):
+            raise RuntimeError("unexpected reply to hello")
+        pos = HEADER.size + 1
+        self.vars = {}
+        for var_id in range(data[HEADER.size]):
+            var_type, name_len = data[pos], data[pos + 1]
+            name = data[pos + 2 : pos + 2 + name_len].decode()
+            self.vars[name] = (var_id, var_type)
+            pos += 2 + name_len
+        return self.vars
+
+    def set(self, **values):
+        """Sends one update frame; returns the ack status string."""
+        if not self.vars:
+            self.hello()
+        self.seq = (self.seq + 1) & 0xFFFF
+        body = bytearray()
+        for name, value in values.items():
+            var_id, var_type = self.vars[name]
+            if var_type in TEXT_TYPES:
+                raw = str(value).encode()
+            elif var_type == FLOAT_TYPE:
+                raw = struct.pack("<f", float(value))
+            else:
+                raw = struct.pack("<i", int(value))
+            body += bytes([var_id, len(raw)]) + raw
+        header = HEADER.pack(ord("S"), VERSION, self.seq, self.generation)
+        self.sock.sendto(header + body, self.addr)
+        data, _ = self.sock.recvfrom(64)
+        status = STATUS.get(data[HEADER.size], "unknown")
+        if status == "stale table":
+            self.vars = {}
+        return status
+
+    def watch(
+        self, interval_ms: int = 100, pins=(), deadband: int = 0, snapshot=True, samples=False
+    ):
+        """Subscribes to value pushes; renew at least every 10 s
+        (CTRL_WATCH_TTL_MS). interval_ms=0 unsubscribes. With samples the
+        adc stream batches land in self.samples."""
+        if not self.vars:
+            self.hello()
+        flags = (1 if snapshot else 0) | (2 if samples else 0)
+        body = struct.pack("<HHBB", interval_ms, deadband, flags, len(pins))
+        header = HEADER.pack(ord("W"), VERSION, 0, self.generation)
+        self.sock.sendto(header + body + bytes(pins), self.addr)
+
+    def values(self):
+        """Waits for one CTRL_VALUES push; returns ({name: value}, {pin: raw}),
+        or None on timeout. Refreshes the table if the generation moved."""
+        try:
+            data, _ = self.sock.recvfrom(2048)
+        except socket.timeout:
+            return None
+        kind, _, _, generation = HEADER.unpack_from(data)
+        if kind == ord("Q"):
+            first, dropped, rate, decimate, pin, _, count = struct.unpack_from(
+                "<IIIHBBH", data, HEADER.size
+            )
+            at = HEADER.size + 18
+            self.samples.append(
+                {
+                    "first": first,
+                    "dropped": dropped,
+                    "rate": rate / decimate,
+                    "pin": pin,
+                    "values": list(struct.unpack_from(f"<{count}H", data, at)),
+                }
+            )
+            return {}, {}
+        if kind != ord("V"):
+            return None
+        if generation != self.generation:
+            self.hello()
+        by_id = {var_id: (name, t) for name, (var_id, t) in self.vars.items()}
+        changed = {}
+        pos = HEADER.size + 1
+        for _ in range(data[HEADER.size]):
+            var_id, n = data[pos], data[pos + 1]
+            raw = data[pos + 2 : pos + 2 + n]
+            pos += 2 + n
+            if var_id not in by_id:
+                continue
+            name, var_type = by_id[var_id]
+            if var_type in TEXT_TYPES:
+                changed[name] = raw.decode(errors="replace")
+            elif var_type == FLOAT_TYPE:
+                changed[name] = struct.unpack("<f", raw)[0]
+            else:
+                changed[name] = struct.unpack("<i", raw)[0]
+        sensors = {}
+        for _ in range(data[pos]):
+            pin, value = struct.unpack_from("<BH", data, pos + 1)
+            sensors[pin] = value
+            pos += 3
+        return changed, sensors
+
+
+def fetch_schema(host: str, timeout: float = 2.0):
+    """Reads /vars (layout at AI_VAR_SCHEMA_VERSION in ai_vars.h); returns
+    the table generation and a list of dicts in control channel id order."""
+    with urllib.request.urlopen(f"http://{host}/vars", timeout=timeout) as r:
+        data = r.read()
+    generation, version, count = struct.unpack_from("<HBB", data)
+    if version != 1:
+        raise RuntimeError(f"unknown schema version {version}")
+    entry = struct.Struct("<BBHfffB")
+    pos = 4
+    out = []
+    for _ in range(count):
+        var_type, flags, size, lo, hi, step, name_len = entry.unpack_from(data, pos)
+        pos += entry.size
+        var = {"name": data[pos : pos + name_len].decode(), "type": var_type}
+        pos += name_len
+        if size:
+            var["size"] = size
+        for key, bit, value in (("min", 1, lo), ("max", 2, hi), ("step", 4, step)):
+            if flags & bit:
+                var[key] = value
+        out.append(var)
+    return generation, out
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        print("usage: control_client.py HOST name=value [name=value ...]")
+        print("       control_client.py HOST --watch [interval_ms] [pin ...]")
+        sys.exit(1)
+    client = ControlClient(sys.argv[1])
+    if sys.argv[2] == "--watch":
+        interval = int(sys.argv[3]) if len(sys.argv) > 3 else 100
+        pins = [int(p) for p in sys.argv[4:]]
+        client.watch(interval, pins, snapshot=True)
+        renewed = time.monotonic()
+        while True:
+            if time.monotonic() - renewed > 5:
+                client.watch(interval, pins, snapshot=False)
+                renewed = time.monotonic()
+            pushed = client.values()
+            if pushed and (pushed[0] or pushed[1]):
+                print(*pushed)
+    pairs = dict(arg.split("=", 1) for arg in sys.argv[2:])
+    print(client.set(**pairs))
@@ -0,0 +1,159 @@
+"""Delta patches between two firmware images.
+
+The format matches PatchSink in firmware/include/ota_patch.h:
+
+    header:  b"FDP1" | u32 new size | app_image_hash(old)
+    records: u8 op, then
+      ADD     u32 len | u32 old offset | len diff bytes (new = old + diff)
+      INSERT  u32 len | len literal bytes
+      END
+
+Like bsdiff, matched regions are emitted as byte-wise differences against
+the old image instead of exact copies. Code that only moved a little
+produces diffs that are mostly zero, which gzip then squeezes down to a
+few KB.
+"""
+
+import hashlib
+import struct
+import sys
+
+MAGIC = b"FDP1"
+OP_END = 0x00
+OP_ADD = 0x01
+OP_INSERT = 0x02
+
+BLOCK = 32  # seed match length
+STEP = 4  # old image is indexed on word boundaries
+GIVE_UP = 64  # stop extending once the score falls this far below its best
+
+
+def app_image_hash(image: bytes) -> bytes:
+    """The hash ESP-IDF reports for an app image (esp_partition_get_sha256).
+
+    Images built with an appended digest (header byte 23) report that digest,
+    which covers everything but the last 32 bytes.
+    """
+    if len(image) > 64 and image[0] == 0xE9 and image[23] == 1:
+        return image[-32:]
+    return hashlib.sha256(image).digest()
+
+
+def app_build_hash(image: bytes) -> str:
+    """The elf sha256 the device reports as its build (/ota/build).
+
+    esptool writes it into the app description at 0xb0; empty if the image
+    does not carry one.
+    """
+    if len(image) < 0xD0 or image[0] != 0xE9:
+        return ""
+    digest = image[0xB0:0xD0]
+    return "" if digest == bytes(32) else digest.hex()
+
+
+def _index(old: bytes):
+    index = {}
+    for i in range(0, len(old) - BLOCK + 1, STEP):
+        index.setdefault(old[i : i + BLOCK], i)
+    return index
+
+
+def _extend(old: bytes, new: bytes, i: int, j: int) -> int:
+    """Length of the approximate match starting at new[i] / old[j]."""
+    best_len = 0
+    best_score = 0
+    score = 0
+    k = 0
+    limit = min(len(new) - i, len(old) - j)
+    while k < limit:
+        score += 1 if new[i + k] == old[j + k] else -2
+        k += 1
+        if score > best_score:
+            best_score = score
+            best_len = k
+        elif best_score - score > GIVE_UP:
+            break
+    return best_len
+
+
+def make_patch(old: bytes, new: bytes) -> bytes:
+    out = [MAGIC, struct.pack("<I", len(new)), app_image_hash(old)]
+    index = _index(old)
+
+    def insert(start, end):
+        if end > start:
+            out.append(struct.pack("<BI", OP_INSERT, end - start))
+            out.append(new[start:end])
+
+    i = 0
+    literal_start = 0
+    while i <= len(new) - BLOCK:
+        j = index.get(new[i : i + BLOCK])
+        if j is None:
+            i += 1
+            continue
+
+        # pull the match back over literal bytes that also agree
+        while i > literal_start and j > 0 and new[i - 1] == old[j - 1]:
+            i -= 1
+            j -= 1
+
+        length = _extend(old, new, i, j)
+        insert(literal_start, i)
+        diff = bytes((new[i + k] - old[j + k]) & 0xFF for k in range(length))
+        out.append(struct.pack("<BII", OP_ADD, length, j))
+        out.append(diff)
+        i += length
+        literal_start = i
+
+    insert(literal_start, len(new))
+    out.append(bytes([OP_END]))
+    return b"".join(out)
+
+
+def apply_patch(old: bytes, patch: bytes) -> bytes:
+    """Reference decoder, used to check a patch before it is served."""
+    if patch[:4] != MAGIC:
+        raise ValueError("not a delta patch")
+    (new_size,) = struct.unpack_from("<I", patch, 4)
+    if patch[8:40] != app_image_hash(old):
+        raise ValueError("patch was made for a different base image")
+
+    pos = 40
+    out = bytearray()
+    while True:
+        op = patch[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        if op == OP_ADD:
+            length, j = struct.unpack_from("<II", patch, pos)
+            pos += 8
+            diff = patch[pos : pos + length]
+            out += bytes((old[j + k] + diff[k]) & 0xFF for k in range(length))
+        elif op == OP_INSERT:
+            (length,) = struct.unpack_from("<I", patch, pos)
+            pos += 4
+            out += patch[pos : pos + length]
+        else:
+            raise ValueError(f"unknown op {op}")
+        pos += length
+
+    if len(out) != new_size:
+        raise ValueError("patch produced the wrong size")
+    return bytes(out)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 4:
+        print("usage: delta_patch.py OLD.bin NEW.bin OUT.patch")
+        sys.exit(1)
+    with open(sys.argv[1], "rb") as f:
+        old_image = f.read()
+    with open(sys.argv[2], "rb") as f:
+        new_image = f.read()
+    patch_bytes = make_patch(old_image, new_image)
+    assert apply_patch(old_image, patch_bytes) == new_image
+    with open(sys.argv[3], "wb") as f:
+        f.write(patch_bytes)
+    print(f"{len(new_image)} -> {len(patch_bytes)} bytes")
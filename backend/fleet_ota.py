@@ -0,0 +1,132 @@
+"""Multicasts one firmware image to every board on the LAN at once.
+
+    python fleet_ota.py static/firmware.bin [--rate 400] [--iface 192.168.1.10]
+
+The wire format is documented in firmware/include/fleet_ota.h. One pass
+sends every chunk, then each round asks the boards what they miss and
+resends only the union of that, so the time to flash is about the same
+for two boards as for fifty.
+"""
+
+import argparse
+import hashlib
+import os
+import socket
+import struct
+import time
+
+from delta_patch import app_build_hash
+
+GROUP = "239.255.42.99"  # FLEET_GROUP
+PORT = 4211  # FLEET_PORT
+VERSION = 1
+CHUNK = 1024  # fits one 802.11 frame with room to spare
+
+OFFER, DATA, END, NACK, DONE = b"O", b"D", b"E", b"N", b"F"
+STATUS = {0: "ok", 1: "already current", 2: "failed"}
+
+OFFER_SECONDS = 6.0  # boards erase the ota partition meanwhile
+ROUND_WAIT = 0.5  # > FLEET_NACK_JITTER_MS, for the replies to come in
+MAX_ROUNDS = 30
+
+
+def _header(kind: bytes, session: int) -> bytes:
+    return struct.pack("<cBHI", kind, VERSION, 0, session)
+
+
+class FleetSender:
+    def __init__(self, image: bytes, rate: int, iface: str = ""):
+        self.image = image
+        self.session = struct.unpack("<I", os.urandom(4))[0] or 1
+        self.chunks = (len(image) + CHUNK - 1) // CHUNK
+        # multicast goes out at the AP's basic rate, so keep it paced
+        self.gap = 1.0 / rate
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+        if iface:
+            self.sock.setsockopt(
+                socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(iface)
+            )
+        self.sock.bind(("", 0))
+        build = bytes.fromhex(app_build_hash(image) or "00" * 32)
+        self.offer = (
+            _header(OFFER, self.session)
+            + struct.pack("<IHH", len(image), CHUNK, 0)
+            + hashlib.sha256(image).digest()
+            + build
+        )
+        self.done = {}  # address -> status
+
+    def _send(self, packet: bytes):
+        self.sock.sendto(packet, (GROUP, PORT))
+        time.sleep(self.gap)
+
+    def _chunk(self, index: int):
+        data = self.image[index * CHUNK : (index + 1) * CHUNK]
+        self._send(_header(DATA, self.session) + struct.pack("<I", index) + data)
+
+    def _collect(self) -> set:
+        """Sends FLEET_END and gathers the chunks anyone still misses."""
+        missing = set()
+        self.sock.sendto(_header(END, self.session), (GROUP, PORT))
+        deadline = time.monotonic() + ROUND_WAIT
+        while (left := deadline - time.monotonic()) > 0:
+            self.sock.settimeout(left)
+            try:
+                packet, addr = self.sock.recvfrom(2048)
+            except socket.timeout:
+                break
+            kind, _, _, session = struct.unpack_from("<cBHI", packet)
+            if session != self.session:
+                continue
+            if kind == DONE and len(packet) > 8:
+                if addr[0] not in self.done:
+                    print(f"{addr[0]}: {STATUS.get(packet[8], packet[8])}")
+                self.done[addr[0]] = packet[8]
+            elif kind == NACK:
+                (count,) = struct.unpack_from("<H", packet, 8)
+                for i in range(count):
+                    first, n = struct.unpack_from("<IH", packet, 10 + 6 * i)
+                    missing.update(range(first, min(first + n, self.chunks)))
+        return missing
+
+    def run(self) -> dict:
+        print(f"session {self.session:08x}: {len(self.image)} bytes, {self.chunks} chunks")
+        until = time.monotonic() + OFFER_SECONDS
+        while time.monotonic() < until:
+            self.sock.sendto(self.offer, (GROUP, PORT))
+            time.sleep(0.2)
+
+        todo = range(self.chunks)
+        quiet = 0
+        for round_ in range(MAX_ROUNDS):
+            for i in todo:
+                # late joiners pick the session up from any offer
+                if i % 256 == 0:
+                    self._send(self.offer)
+                self._chunk(i)
+            missing = self._collect()
+            print(f"round {round_}: {len(todo)} sent, {len(missing)} missing")
+            # two silent rounds in a row: nobody is left in the session
+            quiet = quiet + 1 if not missing else 0
+            if quiet == 2:
+                break
+            todo = sorted(missing)
+        return self.done
+
+
+def fleet_flash(image: bytes, rate: int = 400, iface: str = "") -> dict:
+    """Flashes every listening board, returns {ip: status} for those heard."""
+    return FleetSender(image, rate, iface).run()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("image")
+    parser.add_argument("--rate", type=int, default=400, help="chunks per second")
+    parser.add_argument("--iface", default="", help="local address to send from")
+    args = parser.parse_args()
+    with open(args.image, "rb") as f:
+        result = fleet_flash(f.read(), args.rate, args.iface)
+    ok = sum(1 for s in result.values() if s == 0)
+    print(f"{ok} flashed, {len(result) - ok} current or failed")
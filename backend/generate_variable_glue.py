@@ -1,14 +1,269 @@
 import re
+import struct
 import sys
 import os
 
 
-def generate_glue(ai_cpp_path, output_header_path):
+# must match aiVarHash() in firmware/include/ai_vars.h
+def var_hash(name: str, seed: int) -> int:
+    h = 2166136261 ^ ((seed * 2654435761) & 0xFFFFFFFF)
+    for c in name.encode():
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return h ^ (h >> 15)
+
+
+def perfect_hash(names):
+    """Smallest power-of-two table (at least 2x the names) and a seed that
+    puts every name in its own slot."""
+    size = 1
+    while size < 2 * len(names):
+        size *= 2
+    while True:
+        for seed in range(4096):
+            if len({var_hash(n, seed) & (size - 1) for n in names}) == len(names):
+                return seed, size
+        size *= 2
+
+
+def var_kind(var_type: str, var_name: str) -> str:
+    if "[" in var_name:
+        return "AI_VAR_CHAR_ARRAY"
+    if "*" in var_type:
+        return "AI_VAR_CHAR_PTR"
+    return {
+        "int": "AI_VAR_INT",
+        "uint16_t": "AI_VAR_UINT16",
+        "uint32_t": "AI_VAR_UINT32",
+        "String": "AI_VAR_STRING",
+        "char": "AI_VAR_CHAR",
+        "float": "AI_VAR_FLOAT",
+        "bool": "AI_VAR_BOOL",
+        "uint8_t": "AI_VAR_UINT8",
+    }[var_type]
+
+
+# AiVarType values, append only like the enum in firmware/include/ai_vars.h
+VAR_TYPES = [
+    "AI_VAR_INT",
+    "AI_VAR_UINT16",
+    "AI_VAR_UINT32",
+    "AI_VAR_CHAR",
+    "AI_VAR_STRING",
+    "AI_VAR_CHAR_PTR",
+    "AI_VAR_CHAR_ARRAY",
+    "AI_VAR_FLOAT",
+    "AI_VAR_BOOL",
+    "AI_VAR_UINT8",
+]
+
+SCHEMA_VERSION = 1  # AI_VAR_SCHEMA_VERSION
+SCHEMA_MAX_VARS = 255
+RANGE_FLAGS = {"min": 0x01, "max": 0x02, "step": 0x04}
+
+
+def declaration_comment(content: str, var_type: str, name: str) -> str:
+    """The // comment on the line that declares a global, or ""."""
+    m = re.search(
+        r"(?m)^\s*" + re.escape(var_type) + r"\s*" + re.escape(name) + r"\b[^\n]*?//([^\n]*)",
+        content,
+    )
+    return m.group(1) if m else ""
+
+
+def annotations(content: str, var_type: str, name: str) -> dict:
+    """@min/@max/@step from the comment after a global's declaration,
+    e.g. `int sweepMs = 2700; // @min 500 @max 5000 @step 100`."""
+    comment = declaration_comment(content, var_type, name)
+    found = re.findall(r"@(min|max|step)\s+([-+]?[0-9]*\.?[0-9]+(?:[eE][-+]?[0-9]+)?)", comment)
+    return {key: float(value) for key, value in found}
+
+
+def opted_out(content: str, var_type: str, name: str) -> bool:
+    """`int step = 0; // novar` keeps a global out of the table, for loop
+    counters and other state that is not a setting."""
+    return "novar" in re.findall(r"\w+", declaration_comment(content, var_type, name))
+
+
+def schema_bytes(variables, sizes) -> bytes:
+    """The /vars table, layout documented at AI_VAR_SCHEMA_VERSION."""
+    # the count is a byte, and so are control channel ids
+    variables = variables[:SCHEMA_MAX_VARS]
+    out = struct.pack("<BB", SCHEMA_VERSION, len(variables))
+    for (_, _, name_only, kind, notes), size in zip(variables, sizes):
+        flags = 0
+        for key, bit in RANGE_FLAGS.items():
+            if key in notes:
+                flags |= bit
+        name = name_only.encode()
+        out += struct.pack(
+            "<BBHfffB",
+            VAR_TYPES.index(kind),
+            flags,
+            size,
+            notes.get("min", 0.0),
+            notes.get("max", 0.0),
+            notes.get("step", 0.0),
+            len(name),
+        )
+        out += name
+    return out
+
+
+def array_size(var_name: str) -> int:
+    m = re.search(r"\[\s*(\d+)\s*\]", var_name)
+    return int(m.group(1)) if m else 0
+
+
+def function_body(content: str, name: str) -> str:
+    m = re.search(r"\b" + name + r"\s*\(\s*\)\s*\{", content)
+    if not m:
+        return ""
+    depth = 1
+    i = m.end()
+    while i < len(content) and depth:
+        depth += {"{": 1, "}": -1}.get(content[i], 0)
+        i += 1
+    return content[m.end() : i - 1]
+
+
+def split_statements(body: str):
+    """Top-level statements of a function body, blocks kept whole."""
+    out = []
+    cur = ""
+    braces = parens = 0
+    for c in body:
+        cur += c
+        if c == "(":
+            parens += 1
+        elif c == ")":
+            parens -= 1
+        elif c == "{":
+            braces += 1
+        elif c == "}":
+            braces -= 1
+            if braces == 0 and parens == 0:
+                out.append(cur.strip())
+                cur = ""
+        elif c == ";" and braces == 0 and parens == 0:
+            out.append(cur.strip())
+            cur = ""
+    return [st for st in out if st and st != ";"]
+
+
+def apply_hooks(content: str, names):
+    """Groups the ai_test_setup() statements that depend on each variable.
+
+    Statements are linked when they mention the same variable or the same
+    object, by method call or as an argument (motionStop(sg90) and
+    sg90.detach() belong with motionAttach(sg90, servoPin, ...)). A variable's hook replays, in order, the
+    group its statements ended up in; variables setup never touches get
+    no hook and apply by value alone.
+    """
+    statements = split_statements(function_body(content, "ai_test_setup"))
+    parent = list(range(len(statements)))
+
+    def find(i):
+        while parent[i] != i:
+            parent[i] = parent[parent[i]]
+            i = parent[i]
+        return i
+
+    objects = {o for st in statements for o in re.findall(r"\b([A-Za-z_]\w*)\s*(?:\.|->)", st)}
+    owner = {}
+    uses = []
+    for i, st in enumerate(statements):
+        words = set(re.findall(r"\b[A-Za-z_]\w*\b", st))
+        keys = {("var", n) for n in names if n in words}
+        keys |= {("obj", o) for o in objects if o in words}
+        uses.append(words)
+        for key in keys:
+            if key in owner:
+                parent[find(i)] = find(owner[key])
+            else:
+                owner[key] = i
+
+    hooks = {}  # group root -> (hook name, statements)
+    var_hook = {}
+    for name in names:
+        members = [i for i, words in enumerate(uses) if name in words]
+        if not members:
+            continue
+        root = find(members[0])
+        if root not in hooks:
+            body = [st for j, st in enumerate(statements) if find(j) == root]
+            hooks[root] = (f"ai_apply_{name}", body)
+        var_hook[name] = hooks[root][0]
+    return var_hook, list(hooks.values())
+
+
+BODY = "\x00"
+
+
+def top_level(content: str) -> str:
+    """content with the blocks of function and type definitions replaced by
+    BODY; brace initializers are kept."""
+    out = ""
+    depth = 0
+    init = False
+    for char in content:
+        if char == "{":
+            if depth == 0:
+                init = bool(re.search(r"=\s*$", out))
+            depth += 1
+        elif char == "}":
+            depth -= 1
+            if depth == 0 and not init:
+                out += BODY
+                continue
+        if depth == 0 or init:
+            out += char
+    return out
+
+
+def hook_preamble(content: str, hooks, tunables) -> str:
+    """What the hook bodies need from the sketch, so they compile on their
+    own: its #include and #define lines, extern declarations of the globals
+    they touch and prototypes of the sketch functions they call. const
+    globals have internal linkage and are copied instead."""
+    used = set()
+    for _, body in hooks:
+        for st in body:
+            used |= set(re.findall(r"\b[A-Za-z_]\w*\b", st))
+    used -= set(tunables)
+
+    lines = re.findall(r"(?m)^\s*#\s*(?:include|define)\b.*$", content)
+    out = [line.strip() for line in lines] + ["#include \"ai_vars_gen.h\"", ""]
+    text = re.sub(r"(?m)^\s*#.*$", "", top_level(content))
+    pieces = re.split(r"([;" + BODY + "])", text)
+    for st, end in zip(pieces[::2], pieces[1::2]):
+        st = " ".join(st.split())
+        func = end == BODY
+        if not st or re.match(r"(struct|class|enum|union|namespace|typedef|using)\b", st):
+            continue
+        if func:
+            m = re.match(r"(.+?)\b([A-Za-z_]\w*)\s*\((.*)\)$", st)
+            if m and m.group(2) in used:
+                out.append(f"{m.group(1).strip()} {m.group(2)}({m.group(3)});")
+            continue
+        m = re.match(r"(.*?[\w>*&\s])\b([A-Za-z_]\w*)\s*((?:\[[^\]]*\])*)\s*(=.*|\(.*\))?$", st)
+        if not m or not m.group(1).strip() or m.group(2) not in used:
+            continue
+        if re.search(r"\b(const|constexpr)\b", m.group(1)):
+            out.append(st + ";")
+        else:
+            out.append(f"extern {m.group(1).strip()} {m.group(2)}{m.group(3)};")
+    return "\n".join(out) + "\n"
+
+
+def generate_glue(ai_cpp_path, output_header_path, hooks_path=None):
     if not os.path.exists(ai_cpp_path):
         return
+    if hooks_path is None:
+        hooks_path = os.path.join(os.path.dirname(ai_cpp_path), "ai_hooks_gen.cpp")
 
     with open(ai_cpp_path, "r") as f:
         content = f.read()
+    raw_content = content
 
     # Remove comments
     content = re.sub(r"/\*.*?\*/", "", content, flags=re.DOTALL)
@@ -25,55 +280,102 @@ def generate_glue(ai_cpp_path, output_header_path):
         elif brace_level == 0:
             global_scope_content += char
 
-    # Regex to find variables
-    pattern = r"(?m)^(?!.*(?:static|const))\s*\b(int\b|uint16_t\b|uint32_t\b|String\b|char\s*\*|char\b)\s*([a-zA-Z_][a-zA-Z0-9_]*(?:\s*\[\s*\d*\s*\])?)"
+    # Regex to find variables; a name followed by ( is a function
+    pattern = r"(?m)^(?!.*(?:static|const))\s*\b(int\b|uint8_t\b|uint16_t\b|uint32_t\b|float\b|bool\b|String\b|char\s*\*|char\b)\s*([a-zA-Z_][a-zA-Z0-9_]*(?:\s*\[\s*\d*\s*\])?)(?!\w|\s*\()"
     matches = re.findall(pattern, global_scope_content)
 
+    variables = []
+    for var_type, var_name in matches:
+        name_only = var_name.split("[")[0].strip()
+        if opted_out(raw_content, var_type, name_only):
+            continue
+        notes = annotations(raw_content, var_type, name_only)
+        variables.append(
+            (var_type, var_name, name_only, var_kind(var_type, var_name), notes)
+        )
+        print(f"{var_name},{var_type}")
+
+    var_hook, hooks = apply_hooks(content, [v[2] for v in variables])
+
+    seed, size = perfect_hash([v[2] for v in variables])
+    slots = [0] * size
+    for i, (_, _, name_only, _, _) in enumerate(variables):
+        slots[var_hash(name_only, seed) & (size - 1)] = i + 1
+
     header_content = """#ifndef AI_VARS_GEN_H
 #define AI_VARS_GEN_H
 
-#include <Arduino.h>
+#include "ai_vars.h"
 
 // Externs
 """
-    for var_type, var_name in matches:
-        # Handle arrays vs pointers
-        if "[" in var_name:
-            # For extern char arr[], we need to preserve the array part
-            # but usually it's easier to just match the name
-            name_only = var_name.split("[")[0].strip()
-            # We don't support dynamic modification of fixed-size char arrays easily via generic pointers
-            # in this hackathon, but we'll declare them.
-            header_content += f"extern {var_type} {var_name};\n"
-        else:
-            header_content += f"extern {var_type} {var_name};\n"
+    for var_type, var_name, _, _, _ in variables:
+        header_content += f"extern {var_type} {var_name};\n"
 
-    header_content += """
-inline bool updateVariableGeneric(String name, String value) {
+    header_content += "\n// apply hooks, defined in ai_hooks_gen.cpp\n"
+    for hook_name, _ in hooks:
+        header_content += f"void {hook_name}();\n"
+
+    header_content += f"""
+#define AI_VAR_COUNT {len(variables)}
+#define AI_VAR_SEED {seed}u
+#define AI_VAR_MASK {size - 1}u
+
+static constexpr AiVar AI_VARS[] = {{
 """
-    for var_type, var_name in matches:
-        print(f"{var_name},{var_type}")
-        name_only = var_name.split("[")[0].strip()
-        header_content += f'  if (name == "{name_only}") {{\n'
-
-        if "int" in var_type or "uint" in var_type:
-            header_content += f"    {name_only} = ({var_type})value.toInt();\n"
-            if "LED_PIN" in name_only:
-                header_content += "    pinMode(LED_PIN, OUTPUT);\n"
-        elif "String" in var_type:
-            header_content += f"    {name_only} = value;\n"
-        elif "char" in var_type and "*" in var_type:
-            header_content += f"    if ({name_only}) free((void*){name_only});\n"
-            header_content += f"    {name_only} = strdup(value.c_str());\n"
-        elif "char" in var_type and "[" in var_name:
-            header_content += (
-                f"    strncpy({name_only}, value.c_str(), sizeof({name_only})-1);\n"
-            )
-            header_content += f"    {name_only}[sizeof({name_only})-1] = '\\0';\n"
-
-        header_content += "    return true;\n  }\n"
-
-    header_content += """  return false;
+    for var_type, _, name_only, kind, _ in variables:
+        size_expr = f"sizeof({name_only})" if kind == "AI_VAR_CHAR_ARRAY" else "0"
+        hook = var_hook.get(name_only, "nullptr")
+        header_content += (
+            f'    {{"{name_only}", {kind}, {size_expr}, (void *)&{name_only}, {hook}}},\n'
+        )
+    if not variables:
+        header_content += "    {nullptr, AI_VAR_INT, 0, nullptr, nullptr},\n"
+    header_content += "};\n\n"
+
+    header_content += "// AI_VARS index + 1 by hash slot, 0 = empty\n"
+    slot_type = "uint8_t" if len(variables) < 256 else "uint16_t"
+    header_content += f"static constexpr {slot_type} AI_VAR_SLOTS[] = {{"
+    header_content += ", ".join(str(x) for x in slots) + "};\n\n"
+
+    for i, (_, _, name_only, _, _) in enumerate(variables):
+        slot = var_hash(name_only, seed) & (size - 1)
+        header_content += (
+            f'static_assert((aiVarHash("{name_only}", AI_VAR_SEED) & AI_VAR_MASK) == {slot},\n'
+            f'              "generator and ai_vars.h disagree on the hash");\n'
+        )
+
+    # char array sizes come from the declaration; an unsized one reports 0
+    schema = schema_bytes(
+        variables,
+        [array_size(v[1]) if v[3] == "AI_VAR_CHAR_ARRAY" else 0 for v in variables],
+    )
+    header_content += "\n// served by /vars, see AI_VAR_SCHEMA_VERSION in ai_vars.h\n"
+    header_content += "static constexpr uint8_t AI_VAR_SCHEMA[] = {"
+    for i in range(0, len(schema), 12):
+        header_content += "\n    " + ", ".join(f"0x{b:02x}" for b in schema[i : i + 12]) + ","
+    header_content += "\n};\n"
+
+    header_content += """
+inline bool *aiVarPending() {
+  static bool pending[AI_VAR_COUNT + 1];
+  return pending;
+}
+
+// sets a variable and queues its apply hook; call applyVariableHooks()
+// once the whole batch is in so a shared hook only runs once
+inline bool updateVariableGeneric(const char *name, const char *value) {
+  const AiVar *var =
+      aiVarLookup(AI_VARS, AI_VAR_SLOTS, AI_VAR_MASK, AI_VAR_SEED, name);
+  if (!var || !aiVarSet(*var, value)) {
+    return false;
+  }
+  aiVarPending()[var - AI_VARS] = true;
+  return true;
+}
+
+inline void applyVariableHooks() {
+  aiVarApplyPending(AI_VARS, aiVarPending(), AI_VAR_COUNT);
 }
 
 #endif
@@ -81,6 +383,19 @@ inline bool updateVariableGeneric(String name, String value) {
 
     with open(output_header_path, "w") as f:
         f.write(header_content)
+
+    hooks_content = """// generated from the sketch by backend/generate_variable_glue.py, with
+// the ai_test_setup() statements each variable depends on, replayed when
+// only that variable changes
+"""
+    hooks_content += hook_preamble(content, hooks, [v[2] for v in variables])
+    for hook_name, body in hooks:
+        hooks_content += f"\nvoid {hook_name}() {{\n"
+        for st in body:
+            hooks_content += f"  {st}\n"
+        hooks_content += "}\n"
+    with open(hooks_path, "w") as f:
+        f.write(hooks_content)
     # print(f"Generated {output_header_path}")
 
 
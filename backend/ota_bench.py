@@ -0,0 +1,96 @@
+"""Runs the board's /bench update benchmark and prints the report.
+
+    python ota_bench.py HOST [--url URL] [--bytes N] [--sizes 4096,8192]
+
+See firmware/include/ota_bench.h for the phases. Without --url only flash
+is measured. While the board runs its sweep this also times /changeVar
+round trips from here, HTTP included, next to the board's own numbers for
+the ai loop alone.
+"""
+
+import argparse
+import json
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
+
+POLL_SECONDS = 0.2
+PROBE = "/changeVar?%7Ebench="  # no such variable, nothing changes
+
+
+def _get(host: str, path: str, method: str = "GET", timeout: float = 5.0):
+    req = urllib.request.Request(f"http://{host}{path}", method=method)
+    with urllib.request.urlopen(req, timeout=timeout) as resp:
+        return resp.status, resp.read().decode()
+
+
+def _percentile(samples: list, pct: int) -> float:
+    if not samples:
+        return 0.0
+    s = sorted(samples)
+    return s[(len(s) - 1) * pct // 100]
+
+
+def run(host: str, url: str = "", size: int = 0, sizes: str = "") -> dict:
+    """Starts a run, probes until it is done, returns the board's report
+    with the host side timings under "host_changevar_ms"."""
+    query = {"start": "1"}
+    if url:
+        query["url"] = url
+    if size:
+        query["bytes"] = str(size)
+    if sizes:
+        query["sizes"] = sizes
+    try:
+        _get(host, "/bench?" + urllib.parse.urlencode(query), "POST")
+    except urllib.error.HTTPError as e:
+        raise SystemExit(f"{e.code}: {e.read().decode()}")
+
+    host_ms = {}  # phase -> round trips in ms
+    phase = "idle"
+    while True:
+        start = time.monotonic()
+        try:
+            _get(host, PROBE)
+            host_ms.setdefault(phase, []).append((time.monotonic() - start) * 1000)
+        except (urllib.error.URLError, OSError):
+            host_ms.setdefault(phase, []).append(float("inf"))
+        report = json.loads(_get(host, "/bench")[1])
+        if report["state"] != "running":
+            break
+        phase = report["phase"] or phase
+        time.sleep(POLL_SECONDS)
+
+    report["host_changevar_ms"] = host_ms
+    return report
+
+
+def _print(report: dict):
+    print(f"rssi {report['rssi']} dBm, image {report['image']} bytes, "
+          f"{report['bytes']} bytes per run")
+    print(f"{'phase':<6} {'buf':>6} {'bytes':>8} {'setup ms':>9} "
+          f"{'ms':>7} {'KiB/s':>6}")
+    for r in report["runs"]:
+        print(f"{r['phase']:<6} {r['buf']:>6} {r['bytes']:>8} "
+              f"{r['setup_ms']:>9} {r['ms']:>7} {r['kib_s']:>6} {r['error']}")
+
+    print()
+    print(f"{'changeVar':<10} {'board p50/p95/max us':>22} {'host p50/p95 ms':>17}")
+    for phase, s in report["changevar_us"].items():
+        h = report["host_changevar_ms"].get(phase, [])
+        lost = s["timeouts"] + sum(1 for ms in h if ms == float("inf"))
+        h = [ms for ms in h if ms != float("inf")]
+        print(f"{phase:<10} {s['p50']:>8}/{s['p95']}/{s['max']:<8} "
+              f"{_percentile(h, 50):>8.1f}/{_percentile(h, 95):.1f}"
+              + (f"  {lost} timed out" if lost else ""))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("--url", default="", help="image to download, none for flash only")
+    parser.add_argument("--bytes", type=int, default=0, help="bytes per run")
+    parser.add_argument("--sizes", default="", help="buffer sizes, comma separated")
+    args = parser.parse_args()
+    _print(run(args.host, args.url, args.bytes, args.sizes))
@@ -1,12 +1,19 @@
 from typing import Tuple, List
+import hashlib
 import shutil
+import struct
 import subprocess
+import time
+import zlib
 import requests
 from fastapi import FastAPI, HTTPException
 from fastapi.staticfiles import StaticFiles
 from pydantic import BaseModel
 from pathlib import Path
 from ai_service import AIService
+from build_user_module import ModuleBuildError, build_user_module
+from delta_patch import app_build_hash, app_image_hash, apply_patch, make_patch
+from fleet_ota import STATUS as FLEET_STATUS, fleet_flash
 
 app = FastAPI()
 ai_service = AIService()
@@ -20,14 +27,144 @@ BUILD_DIR = FIRMWARE_DIR / ".pio" / "build" / "esp32dev"
 FIRMWARE_BIN = BUILD_DIR / "firmware.bin"
 STATIC_DIR = Path(__file__).parent / "static"
 STATIC_FIRMWARE_BIN = STATIC_DIR / "firmware.bin"
+STATIC_FIRMWARE_GZ = STATIC_DIR / "firmware.bin.gz"
+STATIC_PATCH_GZ = STATIC_DIR / "firmware.patch.gz"
+STATIC_MODULE_BIN = STATIC_DIR / "module.bin"
+STATIC_MODULE_GZ = STATIC_DIR / "module.bin.gz"
+# every image we served, by sha256, so a later build can be sent as a delta
+IMAGE_ARCHIVE_DIR = STATIC_DIR / "images"
+
+# must not exceed OTA_GZIP_WINDOW_BITS in firmware/include/ota_inflate.h
+GZIP_WINDOW_BITS = 13
+
+OTA_POLL_SECONDS = 0.5
+MODULE_TIMEOUT = 60  # a module is small, this covers a retried download
 
 # ensure static dir exists
 STATIC_DIR.mkdir(exist_ok=True)
+IMAGE_ARCHIVE_DIR.mkdir(exist_ok=True)
 
 # mount static files
 app.mount("/static", StaticFiles(directory=str(STATIC_DIR)), name="static")
 
 
+def gzip_bytes(data: bytes, window_bits: int = GZIP_WINDOW_BITS) -> bytes:
+    """Builds a gzip member with a small deflate window the device can keep."""
+    comp = zlib.compressobj(9, zlib.DEFLATED, -window_bits, 9)
+    body = comp.compress(data) + comp.flush()
+    header = b"\x1f\x8b\x08\x00" + struct.pack("<I", 0) + b"\x02\xff"
+    trailer = struct.pack("<II", zlib.crc32(data) & 0xFFFFFFFF, len(data) & 0xFFFFFFFF)
+    return header + body + trailer
+
+
+def gzip_image(src: Path, dst: Path, window_bits: int = GZIP_WINDOW_BITS):
+    dst.write_bytes(gzip_bytes(src.read_bytes(), window_bits))
+
+
+def write_delta_for_device(esp_ip: str, new_image: bytes) -> bool:
+    """Writes STATIC_PATCH_GZ if the device runs an image we still have."""
+    try:
+        info = requests.get(f"http://{esp_ip}/ota/image", timeout=5).json()
+    except Exception as e:
+        print(f"Could not read running image from ESP32: {e}")
+        return False
+
+    base = IMAGE_ARCHIVE_DIR / f"{info.get('sha256', '')}.bin"
+    if not base.exists():
+        return False
+
+    old_image = base.read_bytes()
+    raw_patch = make_patch(old_image, new_image)
+    if apply_patch(old_image, raw_patch) != new_image:
+        print("delta OTA: patch failed self-check, sending full image")
+        return False
+
+    patch = gzip_bytes(raw_patch)
+    if len(patch) >= STATIC_FIRMWARE_GZ.stat().st_size:
+        return False
+    STATIC_PATCH_GZ.write_bytes(patch)
+    print(f"delta OTA: {len(patch)} bytes instead of {STATIC_FIRMWARE_GZ.stat().st_size}")
+    return True
+
+
+def local_ip() -> str:
+    import socket
+
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        s.connect(("10.255.255.255", 1))
+        return s.getsockname()[0]
+    except Exception:
+        return "127.0.0.1"
+    finally:
+        s.close()
+
+
+def start_static_server():
+    # Range-capable so the device can resume an interrupted download
+    try:
+        subprocess.Popen(
+            ["python", "static_server.py", "8000"],
+            cwd=str(BACKEND_DIR),
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+    except Exception:
+        pass
+
+
+def wait_for_ota(esp_ip: str, timeout: float = MODULE_TIMEOUT) -> dict:
+    """Polls /ota/status until the job succeeded or failed, {} on timeout."""
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            status = requests.get(f"http://{esp_ip}/ota/status", timeout=5).json()
+        except Exception as e:
+            print(f"Could not read OTA status from ESP32: {e}")
+            status = {}
+        if status.get("state") in ("success", "failed"):
+            return status
+        time.sleep(OTA_POLL_SECONDS)
+    return {}
+
+
+def try_module_update(esp_ip: str) -> bool:
+    """Ships the sketch as a user module instead of a full firmware image.
+
+    False if the module cannot be built (toolchain missing, or the sketch
+    uses something outside firmware/module/user_api.h) or the device has no
+    usermod partition; the caller then falls back to a full build.
+    """
+    try:
+        image = build_user_module(FIRMWARE_SRC, STATIC_MODULE_BIN)
+    except ModuleBuildError as e:
+        print(f"user module build skipped: {e}")
+        return False
+
+    STATIC_MODULE_GZ.write_bytes(gzip_bytes(image))
+    start_static_server()
+    module_url = f"http://{local_ip()}:8000/static/module.bin.gz"
+    sha256 = hashlib.sha256(image).hexdigest()
+    try:
+        response = requests.get(
+            f"http://{esp_ip}/module/update?url={module_url}&sha256={sha256}",
+            timeout=30,
+        )
+    except Exception as e:
+        print(f"Failed to contact ESP32: {str(e)}")
+        return False
+    if response.status_code != 202:
+        print(f"Module update refused: {response.text}")
+        return False
+    # the 202 only means the job started, the device links the module later
+    status = wait_for_ota(esp_ip)
+    if status.get("state") != "success":
+        print(f"Module update failed: {status.get('error') or status.get('state')}")
+        return False
+    print(f"user module: {len(image)} bytes, no reflash needed")
+    return True
+
+
 class GenerateRequest(BaseModel):
     prompt: str
     esp_ip: str
@@ -72,6 +209,13 @@ async def generate_firmware(request: GenerateRequest):
             if varsRaw.stdout.strip():
                 variables = [a.split(",") for a in varsRaw.stdout.split()]
             print(variables)
+
+            # only the user logic changed, so try swapping just that first
+            if try_module_update(request.esp_ip):
+                return GenerateResponse(
+                    variables=variables, code=final_code, feedback=feedback
+                )
+
             _result = subprocess.run(
                 ["pio", "run"],
                 cwd=str(FIRMWARE_DIR),
@@ -82,15 +226,7 @@ async def generate_firmware(request: GenerateRequest):
             print("compilation success")
 
             # Start static server on port 8000
-            try:
-                subprocess.Popen(
-                    ["python", "-m", "http.server", "8000"],
-                    cwd=str(BACKEND_DIR),
-                    stdout=subprocess.DEVNULL,
-                    stderr=subprocess.DEVNULL,
-                )
-            except Exception:
-                pass
+            start_static_server()
         except subprocess.CalledProcessError as e:
             error_msg = e.stderr if e.stderr else e.stdout
             raise HTTPException(
@@ -105,26 +241,40 @@ async def generate_firmware(request: GenerateRequest):
             )
 
         shutil.copy(FIRMWARE_BIN, STATIC_FIRMWARE_BIN)
+        gzip_image(STATIC_FIRMWARE_BIN, STATIC_FIRMWARE_GZ)
+        new_image = STATIC_FIRMWARE_BIN.read_bytes()
+        image_sha256 = hashlib.sha256(new_image).hexdigest()
+        # archived under the hash the device reports on /ota/image
+        archived = IMAGE_ARCHIVE_DIR / f"{app_image_hash(new_image).hex()}.bin"
+        shutil.copy(STATIC_FIRMWARE_BIN, archived)
 
         # get local ip
-        import socket
-
-        s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-        try:
-            s.connect(("10.255.255.255", 1))
-            IP = s.getsockname()[0]
-        except Exception:
-            IP = "127.0.0.1"
-        finally:
-            s.close()
+        IP = local_ip()
 
-        firmware_url = f"http://{IP}:8000/static/firmware.bin"
-        ota_url = f"http://{request.esp_ip}/ota/update?url={firmware_url}"
+        # the device sniffs the gzip and patch magics, so a delta against its
+        # running image and the full image use the same endpoint
+        if write_delta_for_device(request.esp_ip, new_image):
+            firmware_url = f"http://{IP}:8000/static/firmware.patch.gz"
+        else:
+            firmware_url = f"http://{IP}:8000/static/firmware.bin.gz"
+        # device checks the rebuilt image against this before booting it
+        ota_url = (
+            f"http://{request.esp_ip}/ota/update"
+            f"?url={firmware_url}&sha256={image_sha256}"
+        )
+        # and skips the download if it already runs this build
+        build_hash = app_build_hash(new_image)
+        if build_hash:
+            ota_url += f"&build={build_hash}"
 
         print("flashing")
         try:
+            # device answers 202 right away and flashes in the background;
+            # progress is available at http://<esp_ip>/ota/status
             response = requests.get(ota_url, timeout=30)
-            if response.status_code != 200:
+            if response.status_code == 200:
+                print("device already runs this build, nothing flashed")
+            elif response.status_code != 202:
                 print(f"OTA Trigger Failed: {response.text}")
                 # We can still return the code even if OTA fails?
                 # Let's just log and continue for now or raise if strict.
@@ -142,6 +292,19 @@ async def generate_firmware(request: GenerateRequest):
         )
 
 
+class FleetRequest(BaseModel):
+    rate: int = 400  # chunks per second
+
+
+@app.post("/fleet/flash")
+def flash_fleet(request: FleetRequest):
+    """Multicasts the last built firmware to every board at once."""
+    if not STATIC_FIRMWARE_BIN.exists():
+        raise HTTPException(status_code=404, detail="No firmware built yet.")
+    result = fleet_flash(STATIC_FIRMWARE_BIN.read_bytes(), request.rate)
+    return {"devices": {ip: FLEET_STATUS.get(s, str(s)) for ip, s in result.items()}}
+
+
 if __name__ == "__main__":
     import uvicorn
 
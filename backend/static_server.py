@@ -0,0 +1,83 @@
+"""Static file server for OTA images with HTTP Range support.
+
+`python -m http.server` ignores Range headers, so a device that lost its
+connection mid-flash would have to start over. This serves the same
+directory but answers `Range: bytes=N-` with 206 so the firmware can resume.
+"""
+
+import os
+import sys
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+
+class RangeRequestHandler(SimpleHTTPRequestHandler):
+    def send_head(self):
+        range_header = self.headers.get("Range")
+        if not range_header or not range_header.startswith("bytes="):
+            return super().send_head()
+
+        path = self.translate_path(self.path)
+        if os.path.isdir(path):
+            return super().send_head()
+        try:
+            f = open(path, "rb")
+        except OSError:
+            self.send_error(404, "File not found")
+            return None
+
+        fs = os.fstat(f.fileno())
+        size = fs.st_size
+        last_modified = self.date_time_string(fs.st_mtime)
+
+        # If-Range: only honour the range if the file is unchanged
+        if_range = self.headers.get("If-Range")
+        if if_range and if_range != last_modified:
+            f.close()
+            return super().send_head()
+
+        try:
+            start_s, _, end_s = range_header[len("bytes=") :].partition("-")
+            start = int(start_s)
+            end = int(end_s) if end_s else size - 1
+        except ValueError:
+            f.close()
+            self.send_error(400, "Bad Range header")
+            return None
+        if start >= size or end < start:
+            f.close()
+            self.send_response(416)
+            self.send_header("Content-Range", f"bytes */{size}")
+            self.end_headers()
+            return None
+        end = min(end, size - 1)
+
+        f.seek(start)
+        self.range_left = end - start + 1
+        self.send_response(206)
+        self.send_header("Content-Type", self.guess_type(path))
+        self.send_header("Content-Range", f"bytes {start}-{end}/{size}")
+        self.send_header("Content-Length", str(self.range_left))
+        self.send_header("Last-Modified", last_modified)
+        self.end_headers()
+        return f
+
+    def copyfile(self, source, outputfile):
+        left = getattr(self, "range_left", None)
+        if left is None:
+            return super().copyfile(source, outputfile)
+        while left > 0:
+            chunk = source.read(min(64 * 1024, left))
+            if not chunk:
+                break
+            outputfile.write(chunk)
+            left -= len(chunk)
+        self.range_left = None
+
+    def end_headers(self):
+        self.send_header("Accept-Ranges", "bytes")
+        super().end_headers()
+
+
+if __name__ == "__main__":
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 8000
+    ThreadingHTTPServer(("", port), RangeRequestHandler).serve_forever()
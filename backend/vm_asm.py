@@ -0,0 +1,220 @@
+"""Assembler for the on-device vm (firmware/include/vm.h).
+
+    python vm_asm.py vm_programs/sweep.vmasm sweep.vm
+    python vm_asm.py vm_programs/sweep.vmasm --push 192.168.1.50 [--persist]
+
+Source is one instruction per line, ';' starts a comment:
+
+    .var sweepMs            ; bind a tunable variable by name
+    loop:                   ; labels end in ':'
+        li   r0, 0          ; pseudo op, any 32-bit constant
+        sys  servo_move     ; builtins take r0..r3, return in r0
+        jnz  r0, loop
+
+Registers are r0..r15. Immediates may be decimal, hex, a label, a .var
+name, or one of the named constants below.
+"""
+
+import re
+import struct
+import sys
+import zlib
+
+import requests
+
+MAGIC = 0x314D5646  # "FVM1"
+VERSION = 1
+HEADER_FMT = "<IHHHHI"
+MAX_IMAGE = 4096  # VM_MAX_IMAGE
+MAX_VARS = 16  # VM_MAX_VARS
+
+# VmOp, in order
+OPS = [
+    "halt", "ldi", "lui", "mov", "add", "sub", "mul", "div", "mod", "and",
+    "or", "xor", "shl", "shr", "addi", "slt", "sle", "seq", "sne", "jmp",
+    "jz", "jnz", "sys", "yield", "sleep", "ldv", "stv",
+]
+OPCODES = {name: i for i, name in enumerate(OPS)}
+
+# VmSys, in order
+BUILTINS = [
+    "millis", "pin_mode", "dwrite", "dread", "aread", "servo_attach",
+    "servo_write", "servo_move", "servo_busy", "led_blink", "led_stop", "log",
+]
+
+CONSTANTS = {
+    "LOW": 0, "HIGH": 1,
+    "INPUT": 0x01, "OUTPUT": 0x03, "INPUT_PULLUP": 0x05, "INPUT_PULLDOWN": 0x09,
+    "LINEAR": 0, "TRAPEZOID": 1, "SCURVE": 2,  # MotionProfile
+}
+
+# operand shapes: r = register, i = immediate
+SHAPES = {
+    "halt": "", "yield": "",
+    "ldi": "ri", "lui": "ri", "mov": "rr",
+    "addi": "rri",
+    "jmp": "i", "jz": "ri", "jnz": "ri",
+    "sys": "i", "sleep": "r",
+    "ldv": "ri", "stv": "ri",
+}
+for _op in ("add", "sub", "mul", "div", "mod", "and", "or", "xor", "shl",
+            "shr", "slt", "sle", "seq", "sne"):
+    SHAPES[_op] = "rrr"
+
+
+class AsmError(Exception):
+    pass
+
+
+def _register(tok: str, line: int) -> int:
+    m = re.fullmatch(r"r(\d+)", tok.lower())
+    if not m or int(m.group(1)) > 15:
+        raise AsmError(f"line {line}: expected a register, got '{tok}'")
+    return int(m.group(1))
+
+
+def _number(tok: str):
+    try:
+        return int(tok, 0)
+    except ValueError:
+        return None
+
+
+def _encode(op: int, a: int = 0, b: int = 0, imm: int = 0) -> int:
+    return op | a << 8 | b << 12 | (imm & 0xFFFF) << 16
+
+
+def _li_words(value: int):
+    """ldi, plus lui when the constant does not fit a signed 16 bits."""
+    if -0x8000 <= value <= 0x7FFF:
+        return [("ldi", value)]
+    value &= 0xFFFFFFFF
+    low = value & 0xFFFF
+    return [("ldi", low - 0x10000 if low & 0x8000 else low), ("lui", value >> 16)]
+
+
+def _parse(source: str):
+    """Lines of (line number, mnemonic, operand tokens)."""
+    out = []
+    for num, raw in enumerate(source.splitlines(), 1):
+        text = raw.split(";", 1)[0].strip()
+        while text:
+            m = re.match(r"([A-Za-z_.][\w.]*):\s*", text)
+            if not m:
+                break
+            out.append((num, "label", [m.group(1)]))
+            text = text[m.end():]
+        if not text:
+            continue
+        parts = text.split(None, 1)
+        args = [t.strip() for t in parts[1].split(",")] if len(parts) > 1 else []
+        out.append((num, parts[0].lower(), args))
+    return out
+
+
+def assemble(source: str) -> bytes:
+    lines = _parse(source)
+
+    # pass 1: variables, label addresses and instruction sizes
+    var_names, labels, pc = [], {}, 0
+    for num, op, args in lines:
+        if op == "label":
+            labels[args[0]] = pc
+        elif op == ".var":
+            if len(args) != 1 or args[0] in var_names:
+                raise AsmError(f"line {num}: bad .var")
+            var_names.append(args[0])
+        elif op == "li":
+            value = _number(args[1]) if len(args) == 2 else None
+            if value is None:
+                value = CONSTANTS.get(args[1]) if len(args) == 2 else None
+            if value is None:
+                raise AsmError(f"line {num}: li takes a register and a constant")
+            pc += len(_li_words(value))
+        elif op in OPCODES:
+            pc += 1
+        else:
+            raise AsmError(f"line {num}: unknown instruction '{op}'")
+    if len(var_names) > MAX_VARS:
+        raise AsmError(f"at most {MAX_VARS} variables")
+
+    def immediate(tok: str, num: int, op: str) -> int:
+        value = _number(tok)
+        if value is not None:
+            return value
+        if op == "sys" and tok in BUILTINS:
+            return BUILTINS.index(tok)
+        if op in ("ldv", "stv") and tok in var_names:
+            return var_names.index(tok)
+        if tok in labels:
+            return labels[tok]
+        if tok in CONSTANTS:
+            return CONSTANTS[tok]
+        raise AsmError(f"line {num}: unknown name '{tok}'")
+
+    # pass 2: encode
+    words = []
+    for num, op, args in lines:
+        if op in ("label", ".var"):
+            continue
+        if op == "li":
+            reg = _register(args[0], num)
+            value = _number(args[1])
+            if value is None:
+                value = CONSTANTS[args[1]]
+            for sub, imm in _li_words(value):
+                words.append(_encode(OPCODES[sub], reg, 0, imm))
+            continue
+
+        shape = SHAPES[op]
+        if len(args) != len(shape):
+            raise AsmError(f"line {num}: {op} takes {len(shape)} operands")
+        regs, imm = [], 0
+        for kind, tok in zip(shape, args):
+            if kind == "r":
+                regs.append(_register(tok, num))
+            else:
+                imm = immediate(tok, num, op)
+        if shape == "rrr":
+            imm = regs.pop()
+        elif op in ("ldi", "addi") and not -0x8000 <= imm <= 0x7FFF:
+            raise AsmError(f"line {num}: {imm} does not fit 16 bits, use li")
+        a = regs[0] if regs else 0
+        b = regs[1] if len(regs) > 1 else 0
+        words.append(_encode(OPCODES[op], a, b, imm))
+
+    names = b"".join(n.encode() + b"\0" for n in var_names)
+    names += b"\0" * (-len(names) % 4)
+    body = names + struct.pack(f"<{len(words)}I", *words)
+    header = struct.pack(
+        HEADER_FMT, MAGIC, VERSION, len(words), len(var_names), len(names),
+        zlib.crc32(body) & 0xFFFFFFFF,
+    )
+    image = header + body
+    if len(image) > MAX_IMAGE:
+        raise AsmError(f"program is {len(image)} bytes, the device takes {MAX_IMAGE}")
+    return image
+
+
+def push(esp_ip: str, image: bytes, persist: bool = False) -> str:
+    """Loads a program onto the device; it starts on the next control tick."""
+    url = f"http://{esp_ip}/vm/load" + ("?persist=1" if persist else "")
+    response = requests.post(url, data=image, timeout=5)
+    if response.status_code != 200:
+        raise RuntimeError(response.text)
+    return response.text
+
+
+if __name__ == "__main__":
+    argv = sys.argv[1:]
+    if len(argv) < 2:
+        print("usage: vm_asm.py SOURCE OUT.vm | SOURCE --push ESP_IP [--persist]")
+        sys.exit(1)
+    with open(argv[0]) as f:
+        program = assemble(f.read())
+    if argv[1] == "--push":
+        print(push(argv[2], program, "--persist" in argv))
+    else:
+        with open(argv[1], "wb") as f:
+            f.write(program)
+        print(f"{len(program)} bytes")
@@ -0,0 +1,74 @@
+#ifndef ADC_STREAM_H
+#define ADC_STREAM_H
+#include <stddef.h>
+#include <stdint.h>
+
+// continuous sampling of one ADC1 pin (32..39) by the I2S0 DMA engine, so
+// a sensor can run at kHz rates without analogRead() in a loop:
+//
+//   adcStreamStart(34, 20000, 20, ADC_REDUCE_MEAN); // 1 kHz of 20x means
+//   ...
+//   uint16_t v[32];
+//   size_t n = adcStreamRead(v, 32); // never blocks
+//
+// A low priority task reduces every `decimate` raw samples into one (their
+// mean, or just the first) and pushes the result into two SPSC rings: one
+// read by user logic through adcStreamRead(), one drained in batches to
+// control channel clients that watch with CTRL_WATCH_SAMPLES
+// (control_channel.h). A ring nobody drains fills up and drops the newest
+// samples, adcStreamLatest() always has the current value.
+
+#ifndef ADC_STREAM_RING
+#define ADC_STREAM_RING 1024 // reduced samples per ring, power of two
+#endif
+#ifndef ADC_STREAM_DMA_BUFS
+#define ADC_STREAM_DMA_BUFS 4
+#endif
+#ifndef ADC_STREAM_DMA_LEN
+#define ADC_STREAM_DMA_LEN 512 // samples per dma buffer
+#endif
+// how often the export task sends what queued up
+#ifndef ADC_STREAM_BATCH_MS
+#define ADC_STREAM_BATCH_MS 50
+#endif
+#define ADC_STREAM_BATCH_MAX 480 // samples per CTRL_SAMPLES packet
+
+#define ADC_STREAM_MIN_RATE 20000 // slower rates are unreliable in i2s mode
+#define ADC_STREAM_MAX_RATE 200000
+
+#define ADC_STREAM_TASK_STACK 3072
+#define ADC_STREAM_TASK_PRIORITY 4
+#define ADC_STREAM_TASK_CORE 0
+#define ADC_EXPORT_TASK_PRIORITY 1
+
+enum AdcReduce : uint8_t {
+  ADC_REDUCE_MEAN, // average of each block of decimate samples
+  ADC_REDUCE_PICK, // first sample of each block
+};
+
+// (re)starts sampling at rateHz raw samples per second; false if the pin is
+// not on ADC1, the rate is out of range or the driver refused
+bool adcStreamStart(uint8_t pin, uint32_t rateHz, uint16_t decimate,
+                    AdcReduce reduce);
+void adcStreamStop();
+bool adcStreamRunning();
+
+// user logic, one consumer: up to max reduced samples (raw 12-bit counts),
+// oldest first
+size_t adcStreamRead(uint16_t *out, size_t max);
+size_t adcStreamAvailable();
+// the newest reduced sample, 0 before the first
+uint16_t adcStreamLatest();
+
+struct AdcStreamStats {
+  bool running;
+  uint8_t pin;
+  uint32_t rateHz;
+  uint16_t decimate;
+  uint32_t samples;     // reduced samples produced since start
+  uint32_t readDropped; // lost because adcStreamRead() fell behind
+  uint32_t sentDropped; // lost because the export fell behind
+};
+void adcStreamGetStats(AdcStreamStats &out);
+
+#endif
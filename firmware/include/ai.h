@@ -2,6 +2,8 @@
 #define AI_H
 #include <Arduino.h>
 
+// true while something wants the ai loop parked (see ai_gate.h); long
+// steps may poll it and return early
 extern volatile bool shouldStop;
 
 void ai_test_loop();
@@ -0,0 +1,33 @@
+#ifndef AI_GATE_H
+#define AI_GATE_H
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+
+// pause/resume handshake between the ai loop and whoever needs it parked
+// (OTA, module swaps, variable updates), built on one event group:
+//   AI_GATE_RUN     set while the ai loop may run a step
+//   AI_GATE_PARKED  set while the ai loop is outside a step
+// shouldStop mirrors !RUN for user code that polls inside long steps.
+
+#ifndef AI_GATE_PAUSE_TIMEOUT_MS
+#define AI_GATE_PAUSE_TIMEOUT_MS 10000
+#endif
+
+// call once from setup() before any task can pause the loop
+void aiGateInit();
+
+// ai loop side: aiGateEnter() blocks until running is allowed, the step
+// runs, then aiGateLeave() marks the loop parked again. Returns true when
+// it had to wait out a pause.
+bool aiGateEnter();
+void aiGateLeave();
+
+// controller side: stops the ai loop and blocks until it is parked or the
+// timeout runs out. Pauses nest; every aiGatePause() needs an
+// aiGateResume(), whether it returned true or not.
+bool aiGatePause(TickType_t timeout = pdMS_TO_TICKS(AI_GATE_PAUSE_TIMEOUT_MS));
+void aiGateResume();
+
+bool aiGatePaused();
+
+#endif
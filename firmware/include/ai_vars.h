@@ -0,0 +1,230 @@
+#ifndef AI_VARS_H
+#define AI_VARS_H
+#include <Arduino.h>
+
+// runtime side of the tunable variable table that
+// backend/generate_variable_glue.py writes into ai_vars_gen.h
+//
+// The generator picks a seed that makes aiVarHash() collision free over
+// the sketch's variable names, so a lookup is one hash, one table read and
+// one strcmp, with no heap traffic.
+
+enum AiVarType : uint8_t {
+  AI_VAR_INT,
+  AI_VAR_UINT16,
+  AI_VAR_UINT32,
+  AI_VAR_CHAR,
+  AI_VAR_STRING,
+  AI_VAR_CHAR_PTR,
+  AI_VAR_CHAR_ARRAY,
+  AI_VAR_FLOAT,
+  AI_VAR_BOOL,
+  AI_VAR_UINT8,
+};
+
+// binary schema of a variable table, what /vars serves so a client can
+// build its GUI from the device itself. The generator writes it next to
+// AI_VARS as AI_VAR_SCHEMA; as constexpr data it stays in flash.
+//   u8 version | u8 count, then per variable in table (and CTRL_LIST id)
+//   order: u8 type | u8 flags | u16 size | f32 min | f32 max | f32 step |
+//   u8 name length | name                               (little endian)
+// min/max/step come from "// @min 0 @max 180 @step 5" after the variable's
+// declaration and are 0 unless the matching flag is set. Like control
+// channel ids the schema covers at most the first 255 variables.
+#define AI_VAR_SCHEMA_VERSION 1
+#define AI_VAR_HAS_MIN 0x01
+#define AI_VAR_HAS_MAX 0x02
+#define AI_VAR_HAS_STEP 0x04
+
+struct AiVar {
+  const char *name;
+  AiVarType type;
+  uint16_t size; // capacity for AI_VAR_CHAR_ARRAY
+  void *addr;
+  void (*apply)(); // re-inits what depends on the variable, may be null
+};
+
+// fnv-1a with a final fold, must match var_hash() in the generator. The
+// fold matters because the table index is the low bits, which plain fnv
+// only mixes with the low bits of the input.
+constexpr uint32_t aiVarFnv(const char *s, uint32_t h) {
+  return *s ? aiVarFnv(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+constexpr uint32_t aiVarFold(uint32_t h) { return h ^ (h >> 15); }
+
+constexpr uint32_t aiVarHash(const char *s, uint32_t seed) {
+  return aiVarFold(aiVarFnv(s, 2166136261u ^ (seed * 2654435761u)));
+}
+
+// slots are uint8_t, or uint16_t for tables of more than 255 variables
+template <typename Slot>
+inline const AiVar *aiVarLookup(const AiVar *vars, const Slot *slots,
+                                uint32_t mask, uint32_t seed,
+                                const char *name) {
+  Slot slot = slots[aiVarHash(name, seed) & mask];
+  if (slot == 0 || strcmp(vars[slot - 1].name, name) != 0) {
+    return nullptr;
+  }
+  return &vars[slot - 1];
+}
+
+inline const char *aiVarSkipBlanks(const char *s) {
+  while (*s == ' ' || *s == '\t') {
+    s++;
+  }
+  return s;
+}
+
+// strtof without libc (modules have none): [-+]digits[.digits][e[-+]digits]
+// with nothing else around it but blanks
+inline bool aiVarParseFloat(const char *s, float &out) {
+  s = aiVarSkipBlanks(s);
+  bool neg = *s == '-';
+  if (*s == '-' || *s == '+') {
+    s++;
+  }
+  bool digits = false;
+  float v = 0;
+  for (; *s >= '0' && *s <= '9'; s++, digits = true) {
+    v = v * 10 + (*s - '0');
+  }
+  if (*s == '.') {
+    float scale = 0.1f;
+    for (s++; *s >= '0' && *s <= '9'; s++, scale *= 0.1f, digits = true) {
+      v += (*s - '0') * scale;
+    }
+  }
+  if (digits && (*s == 'e' || *s == 'E')) {
+    s++;
+    bool negExp = *s == '-';
+    if (*s == '-' || *s == '+') {
+      s++;
+    }
+    if (*s < '0' || *s > '9') {
+      return false;
+    }
+    int e = 0;
+    for (; *s >= '0' && *s <= '9'; s++) {
+      e = e < 64 ? e * 10 + (*s - '0') : e;
+    }
+    for (; e > 0; e--) {
+      v = negExp ? v / 10 : v * 10;
+    }
+  }
+  if (!digits || *aiVarSkipBlanks(s) != '\0') {
+    return false;
+  }
+  out = neg ? -v : v;
+  return true;
+}
+
+// [-+]digits within [min, max], nothing else around it but blanks
+inline bool aiVarParseInt(const char *s, int64_t min, int64_t max,
+                          int64_t &out) {
+  s = aiVarSkipBlanks(s);
+  bool neg = *s == '-';
+  if (*s == '-' || *s == '+') {
+    s++;
+  }
+  if (*s < '0' || *s > '9') {
+    return false;
+  }
+  int64_t v = 0;
+  for (; *s >= '0' && *s <= '9'; s++) {
+    v = v < ((int64_t)1 << 40) ? v * 10 + (*s - '0') : v;
+  }
+  v = neg ? -v : v;
+  if (*aiVarSkipBlanks(s) != '\0' || v < min || v > max) {
+    return false;
+  }
+  out = v;
+  return true;
+}
+
+// false, with the variable untouched, when the value does not parse as
+// the variable's type or is out of its range
+inline bool aiVarSet(const AiVar &var, const char *value) {
+  int64_t i;
+  float f;
+  switch (var.type) {
+  case AI_VAR_INT:
+    if (!aiVarParseInt(value, INT32_MIN, INT32_MAX, i)) {
+      return false;
+    }
+    *(int *)var.addr = (int)i;
+    return true;
+  case AI_VAR_UINT16:
+    if (!aiVarParseInt(value, 0, UINT16_MAX, i)) {
+      return false;
+    }
+    *(uint16_t *)var.addr = (uint16_t)i;
+    return true;
+  case AI_VAR_UINT32:
+    if (!aiVarParseInt(value, 0, UINT32_MAX, i)) {
+      return false;
+    }
+    *(uint32_t *)var.addr = (uint32_t)i;
+    return true;
+  case AI_VAR_CHAR:
+    *(char *)var.addr = value[0];
+    return true;
+  case AI_VAR_STRING:
+    *(String *)var.addr = value;
+    return true;
+  case AI_VAR_CHAR_PTR: {
+    char **p = (char **)var.addr;
+    free(*p);
+    *p = strdup(value);
+    return true;
+  }
+  case AI_VAR_CHAR_ARRAY:
+    strncpy((char *)var.addr, value, var.size - 1);
+    ((char *)var.addr)[var.size - 1] = '\0';
+    return true;
+  case AI_VAR_FLOAT:
+    if (!aiVarParseFloat(value, f)) {
+      return false;
+    }
+    *(float *)var.addr = f;
+    return true;
+  case AI_VAR_BOOL:
+    if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0) {
+      *(bool *)var.addr = value[0] == 't';
+      return true;
+    }
+    if (!aiVarParseInt(value, INT32_MIN, INT32_MAX, i)) {
+      return false;
+    }
+    *(bool *)var.addr = i != 0;
+    return true;
+  case AI_VAR_UINT8:
+    if (!aiVarParseInt(value, 0, UINT8_MAX, i)) {
+      return false;
+    }
+    *(uint8_t *)var.addr = (uint8_t)i;
+    return true;
+  }
+  return false;
+}
+
+// runs the hook of every pending variable once, then clears the batch
+inline void aiVarApplyPending(const AiVar *vars, bool *pending,
+                              size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (!pending[i]) {
+      continue;
+    }
+    void (*hook)() = vars[i].apply;
+    for (size_t j = i; j < count; j++) {
+      if (pending[j] && vars[j].apply == hook) {
+        pending[j] = false;
+      }
+    }
+    if (hook) {
+      hook();
+    }
+  }
+}
+
+#endif
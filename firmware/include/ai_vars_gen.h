@@ -1,22 +1,67 @@
 #ifndef AI_VARS_GEN_H
 #define AI_VARS_GEN_H
 
-#include <Arduino.h>
+#include "ai_vars.h"
 
 // Externs
 extern int servoPin;
 extern int ledPin;
+extern int sweepMs;
 
-inline bool updateVariableGeneric(String name, String value) {
-  if (name == "servoPin") {
-    servoPin = (int)value.toInt();
-    return true;
-  }
-  if (name == "ledPin") {
-    ledPin = (int)value.toInt();
-    return true;
+// apply hooks, defined in ai_hooks_gen.cpp
+void ai_apply_servoPin();
+void ai_apply_ledPin();
+
+#define AI_VAR_COUNT 3
+#define AI_VAR_SEED 0u
+#define AI_VAR_MASK 7u
+
+static constexpr AiVar AI_VARS[] = {
+    {"servoPin", AI_VAR_INT, 0, (void *)&servoPin, ai_apply_servoPin},
+    {"ledPin", AI_VAR_INT, 0, (void *)&ledPin, ai_apply_ledPin},
+    {"sweepMs", AI_VAR_INT, 0, (void *)&sweepMs, nullptr},
+};
+
+// AI_VARS index + 1 by hash slot, 0 = empty
+static constexpr uint8_t AI_VAR_SLOTS[] = {0, 0, 2, 0, 1, 3, 0, 0};
+
+static_assert((aiVarHash("servoPin", AI_VAR_SEED) & AI_VAR_MASK) == 4,
+              "generator and ai_vars.h disagree on the hash");
+static_assert((aiVarHash("ledPin", AI_VAR_SEED) & AI_VAR_MASK) == 2,
+              "generator and ai_vars.h disagree on the hash");
+static_assert((aiVarHash("sweepMs", AI_VAR_SEED) & AI_VAR_MASK) == 5,
+              "generator and ai_vars.h disagree on the hash");
+
+// served by /vars, see AI_VAR_SCHEMA_VERSION in ai_vars.h
+static constexpr uint8_t AI_VAR_SCHEMA[] = {
+    0x01, 0x03, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x1c, 0x42, 0x00, 0x00, 0x80, 0x3f, 0x08, 0x73, 0x65, 0x72, 0x76, 0x6f,
+    0x50, 0x69, 0x6e, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x1c, 0x42, 0x00, 0x00, 0x80, 0x3f, 0x06, 0x6c, 0x65, 0x64, 0x50,
+    0x69, 0x6e, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0xfa, 0x43, 0x00, 0x40,
+    0x9c, 0x45, 0x00, 0x00, 0xc8, 0x42, 0x07, 0x73, 0x77, 0x65, 0x65, 0x70,
+    0x4d, 0x73,
+};
+
+inline bool *aiVarPending() {
+  static bool pending[AI_VAR_COUNT + 1];
+  return pending;
+}
+
+// sets a variable and queues its apply hook; call applyVariableHooks()
+// once the whole batch is in so a shared hook only runs once
+inline bool updateVariableGeneric(const char *name, const char *value) {
+  const AiVar *var =
+      aiVarLookup(AI_VARS, AI_VAR_SLOTS, AI_VAR_MASK, AI_VAR_SEED, name);
+  if (!var || !aiVarSet(*var, value)) {
+    return false;
   }
-  return false;
+  aiVarPending()[var - AI_VARS] = true;
+  return true;
+}
+
+inline void applyVariableHooks() {
+  aiVarApplyPending(AI_VARS, aiVarPending(), AI_VAR_COUNT);
 }
 
 #endif
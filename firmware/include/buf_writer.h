@@ -0,0 +1,92 @@
+#ifndef BUF_WRITER_H
+#define BUF_WRITER_H
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// appends text into a caller-owned buffer, always NUL terminated; output
+// that does not fit is cut off and remembered in overflowed(). Used instead
+// of String so request handling and OTA error paths never touch the heap.
+class BufWriter {
+public:
+  BufWriter(char *buf, size_t cap) : buf(buf), cap(cap), len(0), overflow(false) {
+    buf[0] = '\0';
+  }
+
+  BufWriter &print(const char *s) { return write(s, strlen(s)); }
+
+  BufWriter &write(const char *s, size_t n) {
+    size_t room = cap - 1 - len;
+    if (n > room) {
+      n = room;
+      overflow = true;
+    }
+    memcpy(buf + len, s, n);
+    len += n;
+    buf[len] = '\0';
+    return *this;
+  }
+
+  // s as the inside of a json string: quotes, backslashes and control
+  // characters escaped
+  BufWriter &printJson(const char *s) {
+    for (; *s; s++) {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\') {
+        char esc[2] = {'\\', (char)c};
+        write(esc, 2);
+      } else if (c < 0x20) {
+        printf("\\u%04x", c);
+      } else {
+        write(s, 1);
+      }
+    }
+    return *this;
+  }
+
+  BufWriter &printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + len, cap - len, fmt, args);
+    va_end(args);
+    if (n < 0) {
+      buf[len] = '\0';
+      overflow = true;
+    } else if ((size_t)n >= cap - len) {
+      len = cap - 1;
+      overflow = true;
+    } else {
+      len += n;
+    }
+    return *this;
+  }
+
+  void clear() {
+    len = 0;
+    overflow = false;
+    buf[0] = '\0';
+  }
+
+  const char *c_str() const { return buf; }
+  size_t length() const { return len; }
+  bool overflowed() const { return overflow; }
+
+private:
+  char *buf;
+  size_t cap;
+  size_t len;
+  bool overflow;
+};
+
+// a BufWriter with its own storage, for use on the stack
+template <size_t N> class StackWriter : public BufWriter {
+public:
+  StackWriter() : BufWriter(storage, N) {}
+  StackWriter(const StackWriter &) = delete;
+
+private:
+  char storage[N];
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef CONTROL_CHANNEL_H
+#define CONTROL_CHANNEL_H
+#include <Arduino.h>
+
+// low-latency variable updates over UDP, for the mobile sliders
+//
+// every packet starts with
+//   u8 type | u8 version | u16 seq | u16 generation   (little endian)
+// client -> device
+//   CTRL_HELLO  -> CTRL_LIST
+//   CTRL_SET    then entries: u8 id | u8 len | len value bytes. Numeric
+//               variables take a 4-byte little endian int32 (float32 for
+//               AI_VAR_FLOAT), text variables their raw bytes. generation
+//               must match the last CTRL_LIST.
+//   CTRL_WATCH  u16 interval ms (0 = stop) | u16 sensor deadband | u8 flags |
+//               u8 pin count | pins. Subscribes to CTRL_VALUES for
+//               CTRL_WATCH_TTL_MS; send it again to renew. The first push
+//               (and any with CTRL_WATCH_SNAPSHOT) carries every variable.
+//               CTRL_WATCH_SAMPLES also subscribes to CTRL_SAMPLES.
+// device -> client
+//   CTRL_LIST   header carries the generation, then u8 count and per
+//               variable u8 type | u8 name length | name, in id order
+//   CTRL_ACK    header seq = newest set seq taken, then u8 status |
+//               u8 packets covered
+//   CTRL_VALUES header seq counts pushes, generation is the live table's.
+//               u8 count | entries as in CTRL_SET (only the variables that
+//               changed) | u8 sensor count | per pin u8 pin | u16 raw adc
+//               (only the pins that moved past the deadband). Nothing is
+//               sent while nothing changes; see var_watch.h.
+//   CTRL_SAMPLES header seq counts batches. u32 index of the first sample |
+//               u32 samples dropped so far | u32 raw rate hz | u16 decimate |
+//               u8 pin | u8 reserved | u16 count | count x u16 adc counts;
+//               the adc_stream.h output, every ADC_STREAM_BATCH_MS
+//
+// Everything that arrives back to back is coalesced per variable, staged
+// as one var_batch and acknowledged once, so a slider drag costs one
+// batch per burst instead of one HTTP request per move.
+
+#ifndef CTRL_PORT
+#define CTRL_PORT 4210
+#endif
+#define CTRL_VERSION 1
+#define CTRL_HEADER_SIZE 6
+
+#define CTRL_HELLO 'H'
+#define CTRL_SET 'S'
+#define CTRL_LIST 'L'
+#define CTRL_ACK 'A'
+#define CTRL_WATCH 'W'
+#define CTRL_VALUES 'V'
+#define CTRL_SAMPLES 'Q'
+
+#define CTRL_WATCH_SNAPSHOT 0x01
+#define CTRL_WATCH_SAMPLES 0x02
+
+#define CTRL_STATUS_OK 0
+#define CTRL_STATUS_STALE 1 // variable table changed, send CTRL_HELLO again
+#define CTRL_STATUS_BAD 2   // malformed entry or unknown id
+#define CTRL_STATUS_FULL 3  // ai loop is not draining batches, retry
+
+#ifndef CTRL_MAX_VARS
+#define CTRL_MAX_VARS 64
+#endif
+#ifndef CTRL_VALUE_MAX
+#define CTRL_VALUE_MAX 32
+#endif
+#ifndef CTRL_PACKET_MAX
+#define CTRL_PACKET_MAX 1024
+#endif
+
+#ifndef CTRL_TASK_STACK
+#define CTRL_TASK_STACK 4096
+#endif
+#ifndef CTRL_TASK_PRIORITY
+#define CTRL_TASK_PRIORITY 3
+#endif
+#ifndef CTRL_TASK_CORE
+#define CTRL_TASK_CORE 0
+#endif
+
+bool startControlChannel();
+
+struct sockaddr_in;
+// sends from the channel's socket, for var_watch
+void controlChannelSend(const uint8_t *buf, size_t len,
+                        const sockaddr_in &to);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef CONTROL_TASK_H
+#define CONTROL_TASK_H
+#include <Arduino.h>
+
+// runs the ai loop steps at a fixed rate on its own task instead of the
+// arduino loop() task. Each tick: wait for the ai gate, commit pending
+// variables, run one user step, then sleep until the next tick with
+// vTaskDelayUntil, so the rate does not drift with the step length.
+//
+// The default keeps it on the app core, away from wifi and the network
+// tasks on core 0, above their app-level priorities. All three can be
+// overridden from build_flags.
+
+#ifndef CONTROL_TASK_PERIOD_MS
+#define CONTROL_TASK_PERIOD_MS 1 // 1 kHz, one freertos tick
+#endif
+#ifndef CONTROL_TASK_CORE
+#define CONTROL_TASK_CORE 1
+#endif
+#ifndef CONTROL_TASK_PRIORITY
+#define CONTROL_TASK_PRIORITY 10
+#endif
+#ifndef CONTROL_TASK_STACK
+#define CONTROL_TASK_STACK 8192
+#endif
+
+// call at the end of setup(), once the ai code or module has been set up
+bool startControlTask();
+
+// control task only: stops the servos and patterns of the built-in sketch
+// or module, for code taking their pins over (the vm). Whichever of the two
+// runs next sets itself up again, as on a module load or unload.
+void controlTaskPark();
+
+#endif
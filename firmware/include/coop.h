@@ -0,0 +1,188 @@
+#ifndef COOP_H
+#define COOP_H
+// cooperative scheduler for user logic
+//
+// A behavior is a function that runs one short step and returns. The
+// CO_* macros turn it into a resumable state machine (protothread style):
+// CO_DELAY and CO_YIELD return to the scheduler and the next call resumes
+// right after them. Locals do not survive a yield, so keep loop counters
+// and other state in globals.
+//
+//   int pos = 0;
+//
+//   void sweepStep(CoopTask &t) {
+//     CO_BEGIN(t);
+//     for (pos = 0; pos <= 180; pos++) {
+//       servo.write(pos);
+//       CO_DELAY(t, 15);
+//     }
+//     CO_END(t);
+//   }
+//
+//   void ai_test_setup() { coopReset(); coopSpawn(sweepStep); }
+//   void ai_test_loop() { coopTick(); }
+//
+// coopTick() runs every behavior that is due once and returns, so a stop
+// request is seen within one tick and behaviors never block each other.
+//
+// Plain periodic work needs no state machine at all:
+//
+//   void readSensor() { level = analogRead(34); }
+//   void ai_test_setup() { coopReset(); coopEvery(readSensor, 10); }
+//
+// Periodic callbacks keep their rate: a late run does not push the next
+// one back. The control task (control_task.h) ticks at a fixed rate, so the
+// period is exact to one control tick.
+// Header only so generated sketches and user modules can use it as is.
+#include <stdint.h>
+
+// builds against the module shims have no ai.h, see firmware/module
+#ifdef USER_API_H
+#define COOP_STOP_REQUESTED() stopRequested()
+#else
+#include "ai.h"
+#define COOP_STOP_REQUESTED() shouldStop
+#endif
+
+#ifndef COOP_MAX_TASKS
+#define COOP_MAX_TASKS 8
+#endif
+
+#ifndef COOP_MAX_PERIODIC
+#define COOP_MAX_PERIODIC 8
+#endif
+
+#define COOP_DONE 0xffff
+
+struct CoopTask {
+  uint16_t line;        // resume point, 0 = start, COOP_DONE = finished
+  unsigned long wakeAt; // millis() before which the step is not run
+};
+
+typedef void (*CoopFn)(CoopTask &t);
+typedef void (*CoopPeriodicFn)();
+
+#define CO_BEGIN(t)                                                            \
+  switch ((t).line) {                                                          \
+  case 0:
+
+// each resume point needs its own case label; __COUNTER__ (rather than
+// __LINE__) keeps several CO_* on one line apart
+#define CO_YIELD(t) CO_YIELD_AT_(t, __COUNTER__ + 1)
+#define CO_YIELD_AT_(t, n)                                                     \
+  do {                                                                         \
+    (t).line = n;                                                              \
+    return;                                                                    \
+  case n:;                                                                     \
+  } while (0)
+
+#define CO_DELAY(t, ms) CO_DELAY_AT_(t, ms, __COUNTER__ + 1)
+#define CO_DELAY_AT_(t, ms, n)                                                 \
+  do {                                                                         \
+    (t).wakeAt = millis() + (ms);                                              \
+    (t).line = n;                                                              \
+    return;                                                                    \
+  case n:;                                                                     \
+  } while (0)
+
+// yields until cond holds, checked once per tick
+#define CO_WAIT_UNTIL(t, cond) CO_WAIT_UNTIL_AT_(t, cond, __COUNTER__ + 1)
+#define CO_WAIT_UNTIL_AT_(t, cond, n)                                          \
+  do {                                                                         \
+    (t).line = n;                                                              \
+    __attribute__((fallthrough));                                              \
+  case n:                                                                      \
+    if (!(cond))                                                               \
+      return;                                                                  \
+  } while (0)
+
+// a finished behavior is dropped; use CO_RESTART to run it again forever
+#define CO_END(t)                                                              \
+  }                                                                            \
+  (t).line = COOP_DONE
+
+#define CO_RESTART(t)                                                          \
+  }                                                                            \
+  (t).line = 0
+
+struct CoopScheduler {
+  CoopFn fn[COOP_MAX_TASKS];
+  CoopTask task[COOP_MAX_TASKS];
+  uint8_t count;
+
+  CoopPeriodicFn every[COOP_MAX_PERIODIC];
+  unsigned long periodMs[COOP_MAX_PERIODIC];
+  unsigned long nextAt[COOP_MAX_PERIODIC];
+  uint8_t everyCount;
+};
+
+// zero initialised, so there is no guard or constructor to run
+inline CoopScheduler &coopScheduler() {
+  static CoopScheduler sched;
+  return sched;
+}
+
+inline void coopReset() {
+  coopScheduler().count = 0;
+  coopScheduler().everyCount = 0;
+}
+
+inline bool coopSpawn(CoopFn fn) {
+  CoopScheduler &s = coopScheduler();
+  if (s.count == COOP_MAX_TASKS) {
+    return false;
+  }
+  s.fn[s.count] = fn;
+  s.task[s.count].line = 0;
+  s.task[s.count].wakeAt = millis();
+  s.count++;
+  return true;
+}
+
+// calls fn every periodMs, first one period from now
+inline bool coopEvery(CoopPeriodicFn fn, unsigned long periodMs) {
+  CoopScheduler &s = coopScheduler();
+  if (s.everyCount == COOP_MAX_PERIODIC || periodMs == 0) {
+    return false;
+  }
+  s.every[s.everyCount] = fn;
+  s.periodMs[s.everyCount] = periodMs;
+  s.nextAt[s.everyCount] = millis() + periodMs;
+  s.everyCount++;
+  return true;
+}
+
+// runs one step of each due behavior and each due periodic callback;
+// returns false once all behaviors have finished and nothing is periodic
+inline bool coopTick() {
+  CoopScheduler &s = coopScheduler();
+  for (uint8_t i = 0; i < s.everyCount && !COOP_STOP_REQUESTED(); i++) {
+    unsigned long now = millis();
+    if ((long)(now - s.nextAt[i]) < 0) {
+      continue;
+    }
+    s.every[i]();
+    s.nextAt[i] += s.periodMs[i];
+    // more than a period behind (a pause, a slow step): skip the missed
+    // runs instead of bursting through them
+    if ((long)(now - s.nextAt[i]) >= 0) {
+      s.nextAt[i] = now + s.periodMs[i];
+    }
+  }
+  for (uint8_t i = 0; i < s.count && !COOP_STOP_REQUESTED();) {
+    CoopTask &t = s.task[i];
+    if ((long)(millis() - t.wakeAt) >= 0) {
+      s.fn[i](t);
+    }
+    if (t.line == COOP_DONE) {
+      s.count--;
+      s.fn[i] = s.fn[s.count];
+      s.task[i] = s.task[s.count];
+    } else {
+      i++;
+    }
+  }
+  return s.count > 0 || s.everyCount > 0;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef FLEET_OTA_H
+#define FLEET_OTA_H
+#include <Arduino.h>
+
+// fleet mode ota: backend/fleet_ota.py multicasts one image to every board
+// at once, so flashing a lab full of devices costs about as much air time
+// as flashing one. Chunks may arrive in any order; each is written at its
+// offset with esp_ota_write_with_offset(), and the gaps are repaired with
+// NACK rounds.
+//
+// every packet starts with
+//   u8 type | u8 version | u16 reserved | u32 session      (little endian)
+// sender -> group
+//   FLEET_OFFER  u32 image size | u16 chunk size | u16 reserved |
+//                u8 sha256[32] of the image | u8 build[32] (elf sha256,
+//                zero if unknown). Repeated for a few seconds before data
+//                so receivers can erase the ota partition.
+//   FLEET_DATA   u32 chunk index | chunk bytes
+//   FLEET_END    end of a round; every receiver answers after a random
+//                backoff so replies do not all land at once
+// receiver -> sender (unicast to the offer's source)
+//   FLEET_NACK   u16 count | count x (u32 first chunk | u16 chunks missing)
+//   FLEET_DONE   u8 status (FLEET_OK, FLEET_CURRENT, FLEET_FAILED)
+//
+// Boards that already run the offered build answer FLEET_CURRENT and stay
+// out of it. A complete image is checked against the sha256 and booted
+// the same way an http ota is.
+
+#ifndef FLEET_GROUP
+#define FLEET_GROUP "239.255.42.99"
+#endif
+#ifndef FLEET_PORT
+#define FLEET_PORT 4211
+#endif
+#define FLEET_VERSION 1
+#define FLEET_HEADER_SIZE 8
+
+#define FLEET_OFFER 'O'
+#define FLEET_DATA 'D'
+#define FLEET_END 'E'
+#define FLEET_NACK 'N'
+#define FLEET_DONE 'F'
+
+#define FLEET_OK 0
+#define FLEET_CURRENT 1
+#define FLEET_FAILED 2
+
+#define FLEET_MAX_CHUNK 1400
+#define FLEET_PACKET_MAX (FLEET_HEADER_SIZE + 4 + FLEET_MAX_CHUNK)
+// ranges per nack, the sender asks again next round for the rest
+#define FLEET_MAX_RANGES 64
+#ifndef FLEET_NACK_JITTER_MS
+#define FLEET_NACK_JITTER_MS 200
+#endif
+// a session nobody has sent to for this long is dropped
+#ifndef FLEET_IDLE_TIMEOUT_MS
+#define FLEET_IDLE_TIMEOUT_MS 30000
+#endif
+
+#define FLEET_TASK_STACK 4096
+#define FLEET_TASK_PRIORITY 4
+#define FLEET_TASK_CORE 0
+
+// joins the group and starts the receiver task; call once wifi is up
+bool startFleetOta();
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef HTTP_UTIL_H
+#define HTTP_UTIL_H
+#include <esp_http_server.h>
+
+// small helpers over esp_http_server for the control plane handlers
+
+#ifndef HTTP_SERVER_STACK
+#define HTTP_SERVER_STACK 8192
+#endif
+#ifndef HTTP_SERVER_PRIORITY
+#define HTTP_SERVER_PRIORITY 5
+#endif
+#ifndef HTTP_SERVER_CORE
+#define HTTP_SERVER_CORE 0
+#endif
+#define HTTP_MAX_SOCKETS 5
+#define HTTP_MAX_HANDLERS 32
+#define HTTP_QUERY_MAX 512
+
+// sends body with a status line such as "200 OK", plus the CORS header
+// every endpoint carries
+esp_err_t httpSend(httpd_req_t *req, const char *status, const char *type,
+                   const char *body);
+
+inline esp_err_t httpText(httpd_req_t *req, const char *status,
+                          const char *body) {
+  return httpSend(req, status, "text/plain", body);
+}
+
+inline esp_err_t httpJson(httpd_req_t *req, const char *body) {
+  return httpSend(req, "200 OK", "application/json", body);
+}
+
+// raw query string into buf, empty if there is none; false if too long
+bool httpQuery(httpd_req_t *req, char *buf, size_t size);
+
+// url-decoded value of one query parameter, false if missing or too long
+bool httpQueryArg(const char *query, const char *key, char *out, size_t size);
+
+// decodes query in place and calls fn for every key=value pair, stopping
+// early (and returning false) when fn does
+typedef bool (*HttpArgFn)(const char *key, size_t keyLen, const char *value,
+                          size_t valueLen, void *ctx);
+bool httpForEachArg(char *query, HttpArgFn fn, void *ctx);
+
+// reads the whole request body into buf and NUL terminates it; returns its
+// length, or -1 if it does not fit or the client went away
+int httpReadBody(httpd_req_t *req, char *buf, size_t size);
+
+// answers CORS preflight requests for every uri
+esp_err_t httpHandleOptions(httpd_req_t *req);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef LED_PATTERN_H
+#define LED_PATTERN_H
+#include <stddef.h>
+#include <stdint.h>
+
+// on/off patterns played by the RMT peripheral. A pattern is compiled into
+// RMT items once and the hardware clocks it out, one-shot or looping, so a
+// blinking LED or a Morse message costs no cpu while it plays:
+//
+//   ledPatternMorse(ledPin, "HELLO", 200, true);
+//
+// Durations are exact to the RMT tick. The tick is 1 us (REF_TICK) unless
+// the pattern is too long to fit the channel memory at that resolution,
+// then it grows to the smallest whole number of us that fits. While a
+// pattern owns a pin, digitalWrite() on it has no effect; ledPatternStop()
+// hands the pin back.
+
+#ifndef LED_PATTERN_PINS
+#define LED_PATTERN_PINS 2 // rmt channels 0 and 4, four memory blocks each
+#endif
+#ifndef LED_PATTERN_MAX_SPANS
+#define LED_PATTERN_MAX_SPANS 256
+#endif
+
+// durationsUs alternates on and off, starting with on; false if there are
+// too many spans, every pattern pin is busy, or the rmt setup failed
+bool ledPatternPlay(uint8_t pin, const uint32_t *durationsUs, size_t count,
+                    bool loop);
+
+// letters, digits and spaces in international Morse at unitMs per dot;
+// the pattern ends with a word gap so a loop repeats cleanly
+bool ledPatternMorse(uint8_t pin, const char *text, uint32_t unitMs,
+                     bool loop);
+
+// true until a one-shot pattern has finished; loops are busy until stopped
+bool ledPatternBusy(uint8_t pin);
+
+// stops any pattern on pin, leaves it low and back under digitalWrite()
+void ledPatternStop(uint8_t pin);
+void ledPatternStopAll();
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+#include <esp_http_server.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// logging that never blocks the caller: an entry is a message id, three
+// integer arguments and an optional short text, written into a fixed RAM
+// ring with one compare-and-swap, from any task or ISR. The format strings
+// live in LOG_MESSAGES below and are only expanded by a low priority drain
+// task, which prints to the UART and keeps the last LOG_HISTORY lines for
+// /logs, so a request handler or an ota job no longer waits on 115200 baud.
+//
+//   logWrite(LOG_OTA_RESUME, offset, attempt);
+//   logText(LOG_OTA_START, url);
+//
+// A message that takes text has %s as its first conversion, the integers
+// follow. When the ring is full new entries are dropped and counted.
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 64 // entries, power of two
+#endif
+#ifndef LOG_HISTORY
+#define LOG_HISTORY 32 // formatted lines kept for /logs
+#endif
+#ifndef LOG_TEXT_MAX
+#define LOG_TEXT_MAX 48 // longer text is cut
+#endif
+#ifndef LOG_DRAIN_MS
+#define LOG_DRAIN_MS 50
+#endif
+// 0 keeps the UART quiet, /logs still has everything
+#ifndef LOG_TO_SERIAL
+#define LOG_TO_SERIAL 1
+#endif
+
+#define LOG_LINE_MAX 128
+
+#define LOG_TASK_STACK 3072
+#define LOG_TASK_PRIORITY 1
+#define LOG_TASK_CORE 0
+
+enum LogLevel : uint8_t { LOG_ERROR, LOG_WARN, LOG_INFO };
+
+// X(id, level, format)
+#define LOG_MESSAGES(X)                                                        \
+  X(LOG_DROPPED, LOG_WARN, "%u log entries dropped")                           \
+  X(LOG_FIRST_REQUEST, LOG_INFO, "first request served %u ms after boot")      \
+  X(LOG_OTA_START, LOG_INFO, "starting ota from %s")                           \
+  X(LOG_OTA_RESUME, LOG_WARN, "resuming ota at byte %u (attempt %u)")          \
+  X(LOG_OTA_INFLATED, LOG_INFO, "inflated %u -> %u bytes")                     \
+  X(LOG_OTA_PATCHED, LOG_INFO, "patched running image -> %u bytes")            \
+  X(LOG_OTA_REBOOT, LOG_INFO, "ota success, rebooting")                        \
+  X(LOG_OTA_FAILED, LOG_ERROR, "ota failed: %s")                               \
+  X(LOG_OTA_PAUSING, LOG_INFO, "waiting for the ai loop to stop")              \
+  X(LOG_OTA_PAUSED, LOG_INFO, "ai loop stopped")                               \
+  X(LOG_OTA_PAUSE_TIMEOUT, LOG_WARN, "ai loop did not stop in time")           \
+  X(LOG_MODULE_START, LOG_INFO, "starting module update from %s")              \
+  X(LOG_MODULE_LOADED, LOG_INFO, "module loaded, resuming ai loop")            \
+  X(LOG_MODULE_LOG, LOG_INFO, "module: %s")                                    \
+  X(LOG_FLEET_SESSION, LOG_INFO, "fleet ota session %08x: %u bytes")           \
+  X(LOG_VARS_RESTORED, LOG_INFO, "restored %u saved variables")                \
+  X(LOG_VAR_NOT_SAVED, LOG_WARN, "%s not saved: %u chars, at most %u fit")     \
+  X(LOG_VM_LOG, LOG_INFO, "vm: %d")                                            \
+  X(LOG_VM_STORED, LOG_INFO, "stored vm program loaded")                       \
+  X(LOG_VM_REJECTED, LOG_WARN, "stored vm program rejected: %s")               \
+  X(LOG_WIFI_BAD_STATIC, LOG_ERROR, "bad WIFI_STATIC_IP, using dhcp")          \
+  X(LOG_WIFI_SCAN, LOG_WARN, "cached ap did not answer, scanning")             \
+  X(LOG_BENCH_RUN, LOG_INFO, "bench %s, %u byte buffers: %u KiB/s")            \
+  X(LOG_BENCH_FAILED, LOG_WARN, "bench run failed: %s")
+
+#define LOG_ID(id, level, format) id,
+enum LogId : uint16_t { LOG_MESSAGES(LOG_ID) LOG_MESSAGE_COUNT };
+#undef LOG_ID
+
+// starts the drain; entries written before that wait in the ring
+bool logInit();
+
+// any task or ISR, never blocks
+void logWrite(LogId id, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0);
+void logText(LogId id, const char *text, uint32_t a = 0, uint32_t b = 0);
+
+// drains on the calling task, before a reboot
+void logFlush();
+
+// /logs[?since=n]: the kept lines numbered from boot, those after n only
+esp_err_t logSend(httpd_req_t *req, uint32_t since);
+
+#endif
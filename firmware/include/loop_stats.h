@@ -0,0 +1,111 @@
+#ifndef LOOP_STATS_H
+#define LOOP_STATS_H
+#include "control_task.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+// timing of the ai loop steps, exported by /metrics.
+//
+// Every step records its run time and how far its start drifted from the
+// declared period (jitter) into log2 histograms of cpu cycles, and counts a
+// deadline miss when a step starts more than the slack after its slot. The
+// hot path is a cycle count read, two clz and a few increments, well under
+// a microsecond.
+
+#ifndef LOOP_PERIOD_US
+#define LOOP_PERIOD_US (CONTROL_TASK_PERIOD_MS * 1000)
+#endif
+#ifndef LOOP_DEADLINE_SLACK_US
+#define LOOP_DEADLINE_SLACK_US LOOP_PERIOD_US
+#endif
+
+// bucket b counts values below 2^b cycles, the last one everything above
+#define LOOP_STATS_BUCKETS 33
+
+struct LoopStats {
+  uint32_t steps;
+  uint32_t misses;
+  uint32_t maxCycles;
+  uint32_t maxJitterCycles;
+  uint64_t totalCycles;
+  uint64_t totalJitterCycles;
+  uint32_t stepBuckets[LOOP_STATS_BUCKETS];
+  uint32_t jitterBuckets[LOOP_STATS_BUCKETS];
+};
+
+struct LoopStatsState {
+  // odd while the control task is updating stats, so readers on the other core
+  // can retry instead of seeing half of a 64-bit sum
+  volatile uint32_t seq;
+  uint32_t start;
+  uint32_t lastStart;
+  bool haveLast;
+  uint32_t periodCycles;
+  uint32_t slackCycles;
+  LoopStats stats;
+};
+
+// defined in loop_stats.cpp, only the control task writes it
+extern LoopStatsState loopStatsState;
+
+// call once from setup(); the period can be changed later
+void loopStatsInit();
+void loopStatsSetPeriod(uint32_t periodUs, uint32_t slackUs);
+
+// consistent copy for the metrics scrape, plus the cycle clock in MHz
+void loopStatsSnapshot(LoopStats &out);
+uint32_t loopStatsCyclesPerUs();
+
+inline uint8_t loopStatsBucket(uint32_t cycles) {
+  return cycles ? 32 - __builtin_clz(cycles) : 0;
+}
+
+// the barriers keep the stats writes inside the odd window (memw on xtensa)
+inline void loopStatsOpen(LoopStatsState &s) {
+  s.seq++;
+  __sync_synchronize();
+}
+
+inline void loopStatsClose(LoopStatsState &s) {
+  __sync_synchronize();
+  s.seq++;
+}
+
+// resumed says the step follows a pause, so the gap is not a miss
+inline void loopStatsBegin(bool resumed) {
+  LoopStatsState &s = loopStatsState;
+  uint32_t now = ESP.getCycleCount();
+  if (s.haveLast && !resumed) {
+    uint32_t interval = now - s.lastStart;
+    uint32_t jitter = interval > s.periodCycles ? interval - s.periodCycles
+                                                : s.periodCycles - interval;
+    loopStatsOpen(s);
+    s.stats.jitterBuckets[loopStatsBucket(jitter)]++;
+    s.stats.totalJitterCycles += jitter;
+    if (jitter > s.stats.maxJitterCycles) {
+      s.stats.maxJitterCycles = jitter;
+    }
+    if (interval > s.periodCycles + s.slackCycles) {
+      s.stats.misses++;
+    }
+    loopStatsClose(s);
+  }
+  s.haveLast = true;
+  s.lastStart = now;
+  s.start = now;
+}
+
+inline void loopStatsEnd() {
+  LoopStatsState &s = loopStatsState;
+  uint32_t cycles = ESP.getCycleCount() - s.start;
+  loopStatsOpen(s);
+  s.stats.steps++;
+  s.stats.stepBuckets[loopStatsBucket(cycles)]++;
+  s.stats.totalCycles += cycles;
+  if (cycles > s.stats.maxCycles) {
+    s.stats.maxCycles = cycles;
+  }
+  loopStatsClose(s);
+}
+
+#endif
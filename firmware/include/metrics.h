@@ -0,0 +1,35 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <esp_http_server.h>
+#include <stdint.h>
+
+// device health for GET /metrics, in the Prometheus text format so the
+// fleet scraper can poll every board with a stock prometheus job.
+//
+// Per task cpu time (esp_task_runtime_seconds_total, esp_task_cpu_ratio)
+// needs FreeRTOS run time stats, which the stock arduino-esp32 core leaves
+// off; without them only esp_task_runtime_stats_enabled 0 is reported.
+//
+// Request counters are only touched from the http server task (handlers
+// and the scrape both run there), so they need no locking.
+
+#ifndef METRICS_MAX_ROUTES
+#define METRICS_MAX_ROUTES 16
+#endif
+#ifndef METRICS_MAX_TASKS
+#define METRICS_MAX_TASKS 24
+#endif
+// bytes per chunk of the streamed response
+#define METRICS_CHUNK 512
+
+// hooks wifi events for the reconnect counter, call before WiFi.begin()
+void metricsInit();
+
+// returns the id to pass to metricsRecordRequest(), -1 if the table is full
+int metricsAddRoute(const char *uri);
+void metricsRecordRequest(int route, uint32_t elapsedUs, bool ok);
+
+// streams the current metrics as the response to req
+esp_err_t metricsSend(httpd_req_t *req);
+
+#endif
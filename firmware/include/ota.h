@@ -0,0 +1,88 @@
+#ifndef OTA_H
+#define OTA_H
+#include <Arduino.h>
+
+// ota job task config (override with -D in platformio.ini)
+#ifndef OTA_TASK_STACK
+#define OTA_TASK_STACK 8192
+#endif
+#ifndef OTA_TASK_PRIORITY
+#define OTA_TASK_PRIORITY 1
+#endif
+#ifndef OTA_TASK_CORE
+#define OTA_TASK_CORE 0
+#endif
+#ifndef OTA_URL_MAX
+#define OTA_URL_MAX 256
+#endif
+// short reads are resumed with Range requests up to this many attempts
+#ifndef OTA_MAX_ATTEMPTS
+#define OTA_MAX_ATTEMPTS 5
+#endif
+#ifndef OTA_RETRY_DELAY_MS
+#define OTA_RETRY_DELAY_MS 500
+#endif
+// free-form label reported next to the build hash, e.g. a git describe
+#ifndef FIRMWARE_BUILD_ID
+#define FIRMWARE_BUILD_ID ""
+#endif
+
+enum OtaState {
+  OTA_IDLE = 0,
+  OTA_WAITING_AI,
+  OTA_DOWNLOADING,
+  OTA_FINISHING,
+  OTA_SUCCESS,
+  OTA_FAILED,
+};
+
+enum OtaJobKind {
+  OTA_JOB_FIRMWARE = 0, // full or delta app image, reboots on success
+  OTA_JOB_MODULE,       // user logic module, swapped in without a reboot
+};
+
+// snapshot of the running (or last) ota job
+struct OtaStatus {
+  OtaState state;
+  uint32_t bytesWritten;
+  uint32_t totalBytes;
+  uint32_t bytesPerSec;
+  uint32_t elapsedMs;
+  uint32_t attempts;
+  char lastError[96];
+};
+
+// start an ota job in the background, false if one is already running or
+// the arguments are invalid; `sha256` (hex, optional) is checked against the
+// written image before it is marked bootable
+bool startOTAJob(const char *url, const char *sha256 = NULL,
+                 OtaJobKind kind = OTA_JOB_FIRMWARE);
+bool isOTARunning();
+
+// lets another transport (fleet_ota.h) run a firmware update in the same
+// job slot, so /ota/status reports it and HTTP jobs are refused meanwhile.
+// otaAcquire() parks the ai loop, and fails the job if the loop does not
+// stop in time; otaRelease() reboots into the new image
+// on success, else records the error and resumes the loop.
+bool otaAcquire(uint32_t totalBytes);
+void otaReportProgress(size_t done, size_t total);
+void otaRelease(bool ok, const char *error);
+
+// holds the job slot without touching the status, so no update writes
+// flash while ota_bench.h does
+bool otaReserve();
+void otaUnreserve();
+
+void getOTAStatus(OtaStatus &out);
+
+// sha256 of the running app image (what delta patches are made against),
+// computed on first use; NULL if the partition could not be hashed
+const uint8_t *getRunningImageSha256();
+const char *otaStateName(OtaState state);
+
+// sha256 of the linked elf as hex, from the app description the image tool
+// fills in; identical sources link to the same hash, so it tells a no-op
+// rebuild apart without hashing flash. NULL if the image does not carry it.
+const char *getRunningBuildHash();
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef OTA_BENCH_H
+#define OTA_BENCH_H
+#include <esp_http_server.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// on-device throughput benchmark of the update path (/bench), to tell a
+// slow link or server from slow flash on a given board and site. Three
+// phases, each run once per buffer size of the sweep:
+//
+//   net    the url through HTTPClient and OtaPipeline, bytes dropped
+//   flash  random data into the inactive app partition, erase included
+//   full   the url through the real sink chain into Update, then aborted
+//
+// A run moves the first `bytes` of the image. All the while a probe stages
+// an empty variable batch every OTA_BENCH_PROBE_MS and times how long the
+// ai loop takes to apply it, the wait /changeVar does; the ai loop keeps
+// running, unlike during a real update. The bench holds the ota job slot.
+// Nothing is marked bootable, the inactive partition is left with junk the
+// next update erases anyway.
+
+#ifndef OTA_BENCH_BYTES
+#define OTA_BENCH_BYTES (256 * 1024)
+#endif
+#ifndef OTA_BENCH_MAX_SIZES
+#define OTA_BENCH_MAX_SIZES 6
+#endif
+#ifndef OTA_BENCH_PROBE_MS
+#define OTA_BENCH_PROBE_MS 50
+#endif
+// probe baseline before the first phase
+#ifndef OTA_BENCH_IDLE_MS
+#define OTA_BENCH_IDLE_MS 1000
+#endif
+
+// the pipeline allocates OTA_BUF_COUNT of them, a run the heap cannot hold
+// fails with that error
+#define OTA_BENCH_MAX_BUF (32 * 1024)
+#define OTA_BENCH_PROBE_SAMPLES 128 // kept per phase for the percentiles
+
+#define OTA_BENCH_TASK_STACK 8192
+#define OTA_BENCH_TASK_PRIORITY 1
+#define OTA_BENCH_TASK_CORE 0
+// the probe stands in for the http server task
+#define OTA_BENCH_PROBE_STACK 3072
+#define OTA_BENCH_PROBE_PRIORITY 5
+#define OTA_BENCH_PROBE_CORE 0
+
+// url may be NULL, then only the flash phase runs; sizes is a comma list
+// of buffer sizes (rounded up to sectors), NULL or empty for the default
+// sweep. False if the arguments are bad or an update holds the job slot.
+bool otaBenchStart(const char *url, uint32_t bytes, const char *sizes);
+bool otaBenchRunning();
+
+// the current or last report as json
+esp_err_t otaBenchSend(httpd_req_t *req);
+
+#endif
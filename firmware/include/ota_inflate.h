@@ -0,0 +1,60 @@
+#ifndef OTA_INFLATE_H
+#define OTA_INFLATE_H
+#include "ota_pipe.h"
+#include <Arduino.h>
+
+// deflate window the device keeps (2^bits bytes), images must be compressed
+// with a window no larger than this (see backend/server.py GZIP_WINDOW_BITS)
+#ifndef OTA_GZIP_WINDOW_BITS
+#define OTA_GZIP_WINDOW_BITS 13
+#endif
+
+struct tinfl_decompressor_tag;
+
+// gunzips into the inner sink as data arrives; anything that does not start
+// with the gzip magic is passed through unchanged unless gzip is required
+class InflateSink : public OtaSink {
+public:
+  explicit InflateSink(OtaSink &inner);
+  ~InflateSink();
+
+  // reject non-gzip data, set before the first write
+  void requireGzip() { gzipRequired = true; }
+
+  bool write(const uint8_t *data, size_t len) override;
+  bool finish() override;
+  const char *error() override;
+
+  bool isCompressed() const { return mode == MODE_GZIP; }
+  size_t outputBytes() const { return outTotal; }
+
+private:
+  enum Mode { MODE_SNIFF, MODE_RAW, MODE_GZIP };
+  enum Stage { ST_HEADER, ST_EXTRA_LEN, ST_EXTRA, ST_NAME, ST_COMMENT, ST_HCRC,
+               ST_DEFLATE, ST_TRAILER, ST_DONE };
+
+  Stage headerStageAfter(Stage from) const;
+  bool fail(const char *msg);
+
+  OtaSink &inner;
+  bool gzipRequired;
+  Mode mode;
+  Stage stage;
+
+  uint8_t header[10];
+  size_t headerLen;
+  uint16_t extraLeft;
+  uint8_t extraLenBytes;
+  uint8_t hcrcLeft;
+  uint8_t trailer[8];
+  size_t trailerLen;
+
+  tinfl_decompressor_tag *decomp;
+  uint8_t *window;
+  size_t windowPos;
+  uint32_t crc;
+  size_t outTotal;
+  const char *lastError;
+};
+
+#endif
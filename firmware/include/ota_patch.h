@@ -0,0 +1,63 @@
+#ifndef OTA_PATCH_H
+#define OTA_PATCH_H
+#include "ota_pipe.h"
+#include <Arduino.h>
+#include <esp_partition.h>
+
+// delta patch format, produced by backend/delta_patch.py
+//   header:  "FDP1" | u32 new size | u8[32] sha256 of the base image
+//   records: u8 op, then
+//     OP_ADD     u32 len | u32 old offset | len diff bytes (new = old + diff)
+//     OP_INSERT  u32 len | len literal bytes
+//     OP_END
+#define OTA_PATCH_MAGIC "FDP1"
+#define OTA_PATCH_OP_END 0x00
+#define OTA_PATCH_OP_ADD 0x01
+#define OTA_PATCH_OP_INSERT 0x02
+
+#ifndef OTA_PATCH_SCRATCH
+#define OTA_PATCH_SCRATCH 512
+#endif
+
+// rebuilds the new image from the running partition plus a patch stream;
+// data that does not start with the patch magic is passed through unchanged
+class PatchSink : public OtaSink {
+public:
+  PatchSink(OtaSink &inner, const esp_partition_t *base,
+            const uint8_t baseSha256[32]);
+
+  bool write(const uint8_t *data, size_t len) override;
+  bool finish() override;
+  const char *error() override;
+
+  bool isPatch() const { return mode == MODE_PATCH; }
+  size_t outputBytes() const { return outTotal; }
+
+private:
+  enum Mode { MODE_SNIFF, MODE_RAW, MODE_PATCH };
+  enum Stage { ST_HEADER, ST_OP, ST_ARGS, ST_ADD, ST_INSERT, ST_DONE };
+
+  bool startRecord();
+  bool fail(const char *msg);
+
+  OtaSink &inner;
+  const esp_partition_t *base;
+  const uint8_t *baseSha;
+  Mode mode;
+  Stage stage;
+
+  // header and record arguments are collected here before parsing
+  uint8_t hdr[40];
+  size_t hdrLen;
+  size_t hdrWant;
+  uint8_t op;
+
+  uint32_t newSize;
+  uint32_t left;
+  uint32_t oldOffset;
+  size_t outTotal;
+  uint8_t scratch[OTA_PATCH_SCRATCH];
+  const char *lastError;
+};
+
+#endif
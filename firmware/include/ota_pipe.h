@@ -0,0 +1,133 @@
+#ifndef OTA_PIPE_H
+#define OTA_PIPE_H
+#include <Arduino.h>
+#include <Client.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+// pipeline buffer config (override with -D in platformio.ini)
+// buffers are rounded up to whole flash sectors
+#ifndef OTA_BUF_SIZE
+#define OTA_BUF_SIZE 4096
+#endif
+#ifndef OTA_BUF_COUNT
+#define OTA_BUF_COUNT 4
+#endif
+#ifndef OTA_WRITER_STACK
+#define OTA_WRITER_STACK 4096
+#endif
+#ifndef OTA_WRITER_PRIORITY
+#define OTA_WRITER_PRIORITY 2
+#endif
+// ai loop is parked during ota, so core 1 is free for flash commits
+#ifndef OTA_WRITER_CORE
+#define OTA_WRITER_CORE 1
+#endif
+#ifndef OTA_STREAM_TIMEOUT_MS
+#define OTA_STREAM_TIMEOUT_MS 5000
+#endif
+
+#define OTA_SECTOR_SIZE 4096
+
+// destination for image bytes
+class OtaSink {
+public:
+  virtual ~OtaSink() {}
+  virtual bool write(const uint8_t *data, size_t len) = 0;
+  // called once after the last write
+  virtual bool finish() { return true; }
+  virtual const char *error() { return ""; }
+};
+
+// writes straight into the inactive ota partition via Update, hashing the
+// image on the way
+class UpdateSink : public OtaSink {
+public:
+  UpdateSink();
+  ~UpdateSink();
+
+  bool write(const uint8_t *data, size_t len) override;
+  bool finish() override;
+  const char *error() override;
+
+  // sha256 of everything written, valid after finish()
+  const uint8_t *digest() const { return hash; }
+
+private:
+  mbedtls_sha256_context sha;
+  uint8_t hash[32];
+};
+
+// writes into a raw data partition, erasing each sector just before use
+class PartitionSink : public OtaSink {
+public:
+  explicit PartitionSink(const esp_partition_t *part);
+  ~PartitionSink();
+
+  bool write(const uint8_t *data, size_t len) override;
+  bool finish() override;
+  const char *error() override { return lastError; }
+
+  const uint8_t *digest() const { return hash; }
+  size_t written() const { return offset; }
+
+private:
+  const esp_partition_t *part;
+  size_t offset;
+  size_t erased;
+  mbedtls_sha256_context sha;
+  uint8_t hash[32];
+  const char *lastError;
+};
+
+struct OtaPipeConfig {
+  size_t bufSize;
+  size_t bufCount;
+};
+
+typedef void (*OtaProgressFn)(size_t done, size_t total);
+
+// receives into a ring of buffers on the calling task while a writer task
+// commits full buffers to the sink
+class OtaPipeline {
+public:
+  explicit OtaPipeline(OtaPipeConfig config = {OTA_BUF_SIZE, OTA_BUF_COUNT});
+  ~OtaPipeline();
+
+  // pump `total` bytes from the client into the sink, returns bytes committed
+  size_t run(Client &src, size_t total, OtaSink &sink,
+             OtaProgressFn progress = NULL);
+
+  // true once every byte was committed and the sink accepted the end
+  bool finished() const { return sinkFinished; }
+  // the sink rejected data (as opposed to the stream ending early)
+  bool sinkFailed() const { return writerFailed; }
+  const char *error() const { return lastError; }
+
+private:
+  struct Chunk {
+    uint8_t index;
+    uint32_t len; // 0 ends the stream
+  };
+
+  static void writerTask(void *arg);
+  bool allocate();
+  void release();
+  size_t fill(Client &src, uint8_t *buf, size_t want);
+
+  OtaPipeConfig cfg;
+  uint8_t **bufs;
+  QueueHandle_t freeQueue;
+  QueueHandle_t fullQueue;
+  SemaphoreHandle_t writerDone;
+
+  OtaSink *sink;
+  OtaProgressFn progress;
+  size_t total;
+  volatile size_t committed;
+  volatile bool writerFailed;
+  bool sinkFinished;
+  const char *lastError;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef SERVO_MOTION_H
+#define SERVO_MOTION_H
+#include <ESP32Servo.h>
+#include <stdint.h>
+
+// timed servo moves that run without the caller. A move is a target, a
+// duration and a velocity profile; an esp_timer callback recomputes every
+// moving servo's pulse width from the elapsed time each MOTION_TICK_MS and
+// hands it to the LEDC channel ESP32Servo set up. User code starts a move
+// and carries on, several servos move at once:
+//
+//   motionAttach(sg90, 13, 500, 2400);
+//   motionMove(sg90, 180, 2700, MOTION_SCURVE);
+//   CO_WAIT_UNTIL(t, !motionBusy(sg90));
+//
+// The timer runs in the esp_timer task rather than an ISR because
+// ledcWrite() takes a lock; the task sits on core 0, so the control task
+// on core 1 loses no time. It is only armed while something moves.
+// Writing a moving servo directly fights the engine, motionStop() first.
+
+#ifndef MOTION_MAX_SERVOS
+#define MOTION_MAX_SERVOS 4
+#endif
+#ifndef MOTION_TICK_MS
+#define MOTION_TICK_MS 10 // servos refresh at 50 Hz, twice that is plenty
+#endif
+// angle mapping for motionMove() on servos not attached through
+// motionAttach()
+#ifndef MOTION_MIN_US
+#define MOTION_MIN_US 500
+#endif
+#ifndef MOTION_MAX_US
+#define MOTION_MAX_US 2400
+#endif
+
+enum MotionProfile {
+  MOTION_LINEAR,    // constant speed, instant start and stop
+  MOTION_TRAPEZOID, // ramps speed up over the first and down over the last
+                    // quarter of the move
+  MOTION_SCURVE,    // minimum jerk, smooth speed and acceleration
+};
+
+// servo.attach(pin, minUs, maxUs), remembering the range so motionMove()
+// maps angles the way the servo's own write() does
+int motionAttach(Servo &servo, int pin, int minUs = MOTION_MIN_US,
+                 int maxUs = MOTION_MAX_US);
+
+// starts (or retargets) a move from the servo's current position; false if
+// every motion slot is busy with another servo
+bool motionMoveMicroseconds(Servo &servo, int targetUs, uint32_t durationMs,
+                            MotionProfile profile = MOTION_SCURVE);
+bool motionMove(Servo &servo, int angle, uint32_t durationMs,
+                MotionProfile profile = MOTION_SCURVE);
+
+bool motionBusy(Servo &servo);
+
+// holds the servo where it is now
+void motionStop(Servo &servo);
+
+// stops and detaches every servo attached through motionAttach(), for
+// code taking the pins over from the sketch
+void motionDetachAll();
+
+#endif
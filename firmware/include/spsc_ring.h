@@ -0,0 +1,60 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// lock-free ring for exactly one producer task and one consumer task, of
+// trivially copyable T. head is only written by the producer and tail only
+// by the consumer; the barrier (memw on xtensa) makes the slots visible
+// before the index that publishes them. The indexes run free and wrap at
+// 2^32, so N must be a power of two.
+template <typename T, size_t N> class SpscRing {
+  static_assert(N && (N & (N - 1)) == 0, "ring size must be a power of two");
+
+public:
+  // producer: copies up to n items, returns how many fit; the rest count
+  // as dropped
+  size_t push(const T *items, size_t n) {
+    uint32_t h = head;
+    size_t room = N - (h - tail);
+    size_t take = n < room ? n : room;
+    size_t first = N - (h & (N - 1));
+    first = take < first ? take : first;
+    memcpy(&buf[h & (N - 1)], items, first * sizeof(T));
+    memcpy(&buf[0], items + first, (take - first) * sizeof(T));
+    __sync_synchronize();
+    head = h + take;
+    dropped += n - take;
+    return take;
+  }
+
+  // consumer: copies up to n items out, returns how many
+  size_t pop(T *out, size_t n) {
+    uint32_t t = tail;
+    size_t avail = head - t;
+    __sync_synchronize();
+    size_t take = n < avail ? n : avail;
+    size_t first = N - (t & (N - 1));
+    first = take < first ? take : first;
+    memcpy(out, &buf[t & (N - 1)], first * sizeof(T));
+    memcpy(out + first, &buf[0], (take - first) * sizeof(T));
+    __sync_synchronize();
+    tail = t + take;
+    return take;
+  }
+
+  // consumer: forgets everything queued so far
+  void clear() { tail = head; }
+
+  size_t available() const { return head - tail; }
+  uint32_t droppedCount() const { return dropped; }
+
+private:
+  volatile uint32_t head = 0;
+  volatile uint32_t tail = 0;
+  volatile uint32_t dropped = 0; // producer only
+  T buf[N];
+};
+
+#endif
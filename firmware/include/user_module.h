@@ -0,0 +1,146 @@
+#ifndef USER_MODULE_H
+#define USER_MODULE_H
+#include <stddef.h>
+#include <stdint.h>
+
+// user logic can ship as a small relocatable module in its own flash
+// partition instead of being linked into the core image. The core exports a
+// function table, the module exports setup/loop/variable hooks. Modules are
+// built by backend/build_user_module.py against firmware/module/.
+//
+// Only ever append to these structs; bump USER_MODULE_ABI_VERSION when an
+// existing field changes meaning.
+
+#define USER_MODULE_ABI_VERSION 4
+#define USER_MODULE_MAGIC 0x314d5546 // "FUM1"
+
+// data partition holding the module (see partitions_usermod.csv)
+#define USER_MODULE_PARTITION "usermod"
+#define USER_MODULE_SUBTYPE 0x40
+
+// the module is linked with code at 0 and data at this address
+#define USER_MODULE_DATA_VADDR 0x00100000
+// relocation entries: bit 31 set if the word lives in the data segment
+#define USER_MODULE_RELOC_IN_DATA 0x80000000u
+
+// services the core provides to a module
+struct UserCoreApi {
+  uint32_t abiVersion;
+  uint32_t size; // sizeof(UserCoreApi) in the core, for appended fields
+
+  unsigned long (*millis)();
+  unsigned long (*micros)();
+  void (*delay)(unsigned long ms);
+
+  void (*pinMode)(uint8_t pin, uint8_t mode);
+  void (*digitalWrite)(uint8_t pin, uint8_t val);
+  int (*digitalRead)(uint8_t pin);
+  uint16_t (*analogRead)(uint8_t pin);
+
+  // servos are owned by the core, modules use slot numbers
+  int (*servoAttach)(int pin, int minUs, int maxUs);
+  void (*servoWrite)(int slot, int angle);
+  void (*servoWriteMicroseconds)(int slot, int us);
+  void (*servoDetach)(int slot);
+
+  void *(*malloc)(size_t size);
+  void (*free)(void *ptr);
+  void (*log)(const char *msg);
+
+  volatile bool *shouldStop;
+
+  // timed moves through the core's motion engine (servo_motion.h); check
+  // size before use, older cores end the table above
+  bool (*servoMove)(int slot, int angle, uint32_t durationMs, int profile);
+  bool (*servoMoving)(int slot);
+  void (*servoStop)(int slot);
+
+  // rmt led patterns (led_pattern.h), same size check
+  bool (*ledPatternPlay)(uint8_t pin, const uint32_t *durationsUs, size_t count,
+                         bool loop);
+  bool (*ledPatternMorse)(uint8_t pin, const char *text, uint32_t unitMs,
+                          bool loop);
+  bool (*ledPatternBusy)(uint8_t pin);
+  void (*ledPatternStop)(uint8_t pin);
+
+  // dma adc sampling (adc_stream.h), same size check; reduce is AdcReduce
+  bool (*adcStreamStart)(uint8_t pin, uint32_t rateHz, uint16_t decimate,
+                         uint8_t reduce);
+  void (*adcStreamStop)();
+  size_t (*adcStreamRead)(uint16_t *out, size_t max);
+  size_t (*adcStreamAvailable)();
+  uint16_t (*adcStreamLatest)();
+};
+
+struct AiVar; // ai_vars.h
+
+// hooks a module hands back from user_module_init()
+struct UserModuleExports {
+  uint32_t abiVersion;
+  void (*setup)();
+  void (*loop)();
+  bool (*setVar)(const char *name, const char *value);
+  void (*applyVars)(); // runs the apply hooks of the vars set since last call
+  const AiVar *vars;   // the module's generated variable table
+  uint32_t varCount;
+  const uint8_t *schema; // its AI_VAR_SCHEMA, what /vars serves
+  uint32_t schemaSize;
+};
+
+typedef const UserModuleExports *(*UserModuleInitFn)(const UserCoreApi *api);
+
+// image layout in the partition: header | text | data | u32 relocs[]
+struct UserModuleHeader {
+  uint32_t magic;
+  uint16_t abiVersion;
+  uint16_t headerSize;
+  uint32_t textSize;   // code, loaded into executable IRAM
+  uint32_t dataSize;   // rodata + data, loaded into DRAM
+  uint32_t bssSize;    // zeroed DRAM after data
+  uint32_t relocCount; // absolute words to rebase
+  uint32_t entry;      // user_module_init, offset into text
+  uint32_t initArray;  // constructors, offset into data
+  uint32_t initCount;
+  uint32_t crc32; // over everything after the header
+};
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_partition.h>
+
+class BufWriter;
+
+// load (or reload) the module from its partition; false if none is present
+// or it does not match this core. Call only while the ai loop is parked.
+bool userModuleLoad(BufWriter &error);
+void userModuleUnload();
+
+// invalidate the stored module so the linked-in ai code runs after reboot
+void userModuleErase();
+
+bool userModuleActive();
+// bumped on every load and unload, so clients can tell a variable table
+// they resolved ids against has gone away
+uint16_t userModuleGeneration();
+const esp_partition_t *userModulePartition();
+
+// run from the ai loop task instead of ai_test_loop(); the module's setup
+// runs on the next call after a load or userModuleRequestSetup()
+void userModuleLoop();
+void userModuleRequestSetup();
+// stops and detaches the module's servos and patterns, setup attaches
+// them again
+void userModuleReleaseHardware();
+bool userModuleSetVar(const char *name, const char *value);
+void userModuleApplyVars();
+
+// the module's variable table, NULL without a module. Entries point into
+// module memory: hold userModuleLock() while using them off the ai task.
+const AiVar *userModuleVars(size_t *count);
+// the module's /vars schema (ai_vars.h), same lock rules
+const uint8_t *userModuleSchema(size_t *size);
+void userModuleLock();
+void userModuleUnlock();
+#endif
+
+#endif
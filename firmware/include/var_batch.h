@@ -0,0 +1,67 @@
+#ifndef VAR_BATCH_H
+#define VAR_BATCH_H
+#include <Arduino.h>
+#include <esp_http_server.h>
+#include <freertos/FreeRTOS.h>
+
+// double-buffered variable updates
+//
+// Writers (the web server, later the control channel) stage name=value
+// pairs into the back buffer under a short lock. The ai loop swaps the
+// buffers between steps and applies the whole batch, hooks included, on
+// its own task, so user code never sees half a GUI state and the globals
+// are only ever written from the core that reads them.
+
+#ifndef VAR_BATCH_BYTES
+#define VAR_BATCH_BYTES 1024
+#endif
+// how long /changeVar waits to report "applied" instead of "queued"
+#ifndef VAR_BATCH_WAIT_MS
+#define VAR_BATCH_WAIT_MS 200
+#endif
+#ifndef VAR_BATCH_WAITERS
+#define VAR_BATCH_WAITERS 4
+#endif
+#ifndef VAR_BATCH_FAILED_NAMES
+#define VAR_BATCH_FAILED_NAMES 64
+#endif
+
+// what the ai loop hands back to a writer that waited for its batch
+struct VarBatchResult {
+  uint8_t failed; // pairs naming no variable or with a value that did not fit
+  char names[VAR_BATCH_FAILED_NAMES]; // theirs, comma separated, cut to fit
+};
+
+void varBatchInit();
+
+// a writer's updates become visible together: begin, stage each pair, end.
+// varBatchStage() returns false when the buffer is full, in which case
+// varBatchAbort() drops everything staged since begin.
+void varBatchBegin();
+bool varBatchStage(const char *name, size_t nameLen, const char *value,
+                   size_t valueLen);
+void varBatchAbort();
+// returns the sequence number to hand to varBatchWait()
+uint32_t varBatchEnd(bool wait);
+
+// blocks until the batch with this sequence number has been applied, false
+// on timeout (loop paused or busy in a long step); once applied, result
+// gets the pairs of this writer that failed
+bool varBatchWait(uint32_t seq, TickType_t timeout,
+                  VarBatchResult *result = NULL);
+
+// ai loop only, between steps; never blocks on writers
+void varBatchCommit();
+
+// stages every member of a flat json object ({"name": value, ...}; values
+// may be numbers, strings or booleans) between begin and end. Returns the
+// number of pairs, or -1 with *err set.
+int varBatchStageJson(const char *body, size_t len, const char **err);
+
+// /changeVar?name=value&..., or a posted flat json object: stages the
+// request as one batch and answers "Applied" once the ai loop took it, 400
+// with the failing names if some pair was not applied, or "Queued" if the
+// loop did not get to it within VAR_BATCH_WAIT_MS
+esp_err_t varBatchHandle(httpd_req_t *req);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef VAR_STORE_H
+#define VAR_STORE_H
+#include <stddef.h>
+#include <stdint.h>
+
+// keeps the values set over /changeVar and the control channel in nvs, so
+// a reboot comes back with the GUI state instead of the sketch defaults.
+//
+// The store mirrors the last applied text of every variable set since boot
+// and writes it out once changes have been quiet for VAR_STORE_DEBOUNCE_MS
+// (or have kept coming for VAR_STORE_MAX_DELAY_MS), on its own task, so a
+// dragged slider costs one flash write instead of one per event. Values
+// are keyed by a signature of the variable table (names and types), so a
+// sketch with different variables starts from its defaults.
+//
+// Only the first VAR_STORE_MAX_VARS variables of a table are kept, later
+// ones always start from their defaults. A value of VAR_STORE_VALUE_MAX
+// chars or more is logged and not saved rather than saved cut short.
+
+#ifndef VAR_STORE_MAX_VARS
+#define VAR_STORE_MAX_VARS 32
+#endif
+#ifndef VAR_STORE_VALUE_MAX
+#define VAR_STORE_VALUE_MAX 32
+#endif
+#ifndef VAR_STORE_DEBOUNCE_MS
+#define VAR_STORE_DEBOUNCE_MS 1000
+#endif
+#ifndef VAR_STORE_MAX_DELAY_MS
+#define VAR_STORE_MAX_DELAY_MS 5000
+#endif
+
+#define VAR_STORE_TASK_STACK 3072
+#define VAR_STORE_TASK_PRIORITY 1
+#define VAR_STORE_TASK_CORE 0
+
+// starts the writer task
+bool varStoreInit();
+
+// sets the saved values of the live table (module or built-in) without
+// running hooks; call after a module loads, or before ai_test_setup()
+void varStoreRestore();
+
+// control task only: a value varBatchCommit() applied, and the per-step
+// check that hands due changes to the writer
+void varStoreRecord(const char *name, const char *value);
+void varStoreTick();
+
+// writes pending changes now, from whichever task; used before a reboot.
+// The control task must be parked.
+void varStoreFlush();
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef VAR_WATCH_H
+#define VAR_WATCH_H
+#include <Arduino.h>
+
+// pushes current values to control channel clients that sent CTRL_WATCH
+// (control_channel.h), so the app sees what the sketch and other clients
+// changed without polling.
+//
+// Whenever a subscriber is due, the control task fingerprints every entry
+// of the live variable table and sets a dirty bit per subscriber for each
+// one that moved since the last scan. A push carries only dirty variables
+// and the sensor pins that moved past the subscriber's deadband, so an
+// idle device sends nothing. Packets are built on the control task and
+// sent from a low priority task, the loop never waits on lwip.
+
+#ifndef VAR_WATCH_MAX_SUBSCRIBERS
+#define VAR_WATCH_MAX_SUBSCRIBERS 4
+#endif
+#ifndef VAR_WATCH_MAX_SENSORS
+#define VAR_WATCH_MAX_SENSORS 8
+#endif
+#ifndef VAR_WATCH_MIN_INTERVAL_MS
+#define VAR_WATCH_MIN_INTERVAL_MS 20
+#endif
+// a subscription nobody renewed for this long is dropped
+#ifndef CTRL_WATCH_TTL_MS
+#define CTRL_WATCH_TTL_MS 10000
+#endif
+
+#define VAR_WATCH_TASK_STACK 3072
+#define VAR_WATCH_TASK_PRIORITY 2
+#define VAR_WATCH_TASK_CORE 0
+
+// starts the sender task, done by startControlChannel()
+bool varWatchInit();
+
+// control channel task: a CTRL_WATCH body from a client
+struct sockaddr_in;
+void varWatchSubscribe(const sockaddr_in &from, const uint8_t *p, size_t len);
+
+// the peers subscribed with CTRL_WATCH_SAMPLES, for adc_stream
+size_t varWatchSampleTargets(sockaddr_in *out, size_t max);
+
+// control task only, once per tick: scans and pushes to due subscribers
+void varWatchTick();
+
+#endif
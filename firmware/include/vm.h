@@ -0,0 +1,128 @@
+#ifndef VM_H
+#define VM_H
+#include <stddef.h>
+#include <stdint.h>
+
+// a small register vm for user logic that can be swapped in over http in
+// a few ms, no build and no reboot. backend/vm_asm.py assembles programs.
+//
+// image: header | var names (NUL terminated) | u32 code[]
+// instruction word: op | a << 8 | b << 12 | imm16 << 16, where three
+// register ops take c from the low 4 bits of imm16.
+//
+// Sixteen int32 registers keep their values across ticks. A tick runs
+// until YIELD, SLEEP or HALT, or VM_MAX_STEPS instructions, then the
+// control task moves on; a program is a loop that yields once per pass.
+// Variables are named in the image and bound to the live variable table
+// (module or built-in) when the program is swapped in, so LDV/STV work on
+// the same values /changeVar and the control channel set.
+//
+// A program parks the sketch or module it displaces, whose servos are
+// detached and led patterns stopped, and unloading it runs that code's
+// setup again so it gets its pins back.
+
+#define VM_MAGIC 0x314d5646 // "FVM1"
+#define VM_VERSION 1
+
+#ifndef VM_MAX_IMAGE
+#define VM_MAX_IMAGE 4096
+#endif
+#ifndef VM_MAX_VARS
+#define VM_MAX_VARS 16
+#endif
+#ifndef VM_MAX_STEPS
+#define VM_MAX_STEPS 2000
+#endif
+#ifndef VM_SERVOS
+#define VM_SERVOS 2
+#endif
+
+#define VM_REGS 16
+
+struct VmHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t codeWords;
+  uint16_t varCount;
+  uint16_t namesSize; // bytes of names, padded to a multiple of 4
+  uint32_t crc32;     // over names and code
+};
+
+enum VmOp : uint8_t {
+  VM_HALT,
+  VM_LDI,   // a = sext(imm)
+  VM_LUI,   // a = imm << 16 | (a & 0xffff)
+  VM_MOV,   // a = b
+  VM_ADD,   // a = b + c
+  VM_SUB,
+  VM_MUL,
+  VM_DIV,   // stops the program on division by zero
+  VM_MOD,
+  VM_AND,
+  VM_OR,
+  VM_XOR,
+  VM_SHL,
+  VM_SHR,   // arithmetic
+  VM_ADDI,  // a = b + sext(imm)
+  VM_SLT,   // a = b < c
+  VM_SLE,
+  VM_SEQ,
+  VM_SNE,
+  VM_JMP,   // pc = imm
+  VM_JZ,    // if a == 0 pc = imm
+  VM_JNZ,
+  VM_SYS,   // r0 = builtin imm(r0, r1, r2, r3)
+  VM_YIELD, // end the tick, resume after it
+  VM_SLEEP, // end the tick, resume after it once a ms have passed
+  VM_LDV,   // a = variable imm
+  VM_STV,   // variable imm = a, then its apply hook runs
+  VM_OP_COUNT,
+};
+
+// builtin ids for VM_SYS, the assembler's names match
+enum VmSys : uint8_t {
+  VM_SYS_MILLIS,       // () -> ms since boot
+  VM_SYS_PIN_MODE,     // (pin, mode)
+  VM_SYS_DWRITE,       // (pin, level)
+  VM_SYS_DREAD,        // (pin) -> level
+  VM_SYS_AREAD,        // (pin) -> raw adc
+  VM_SYS_SERVO_ATTACH, // (servo, pin) -> 1 on success
+  VM_SYS_SERVO_WRITE,  // (servo, angle)
+  VM_SYS_SERVO_MOVE,   // (servo, angle, ms, profile) -> 1 on success
+  VM_SYS_SERVO_BUSY,   // (servo) -> 1 while moving
+  VM_SYS_LED_BLINK,    // (pin, on ms, off ms), loops in hardware
+  VM_SYS_LED_STOP,     // (pin)
+  VM_SYS_LOG,          // (value) printed to the console
+  VM_SYS_COUNT,
+};
+
+#ifdef ARDUINO
+class BufWriter;
+
+// a load writes into the idle program slot; the control task swaps it in
+// at the start of its next tick. Returns the buffer to fill (VM_MAX_IMAGE
+// + 1 bytes), then vmLoadCommit() checks it; false leaves the running
+// program alone. An empty image (len 0) stops the vm.
+uint8_t *vmLoadBuffer();
+bool vmLoadCommit(size_t len, bool persist, BufWriter &error);
+
+// restores the program saved with persist, if any; call from setup()
+void vmLoadStored();
+
+// control task only: runs one tick of the vm, false if no program is
+// loaded and the module or built-in code should run instead
+bool vmStep();
+
+struct VmStatus {
+  bool loaded;
+  bool halted; // a halted program still owns the loop until replaced
+  uint16_t codeWords;
+  uint16_t varCount;
+  uint16_t pc;
+  uint32_t ticks;
+  char error[48]; // why the last program stopped, empty if it did not
+};
+void vmGetStatus(VmStatus &out);
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef WIFI_FAST_H
+#define WIFI_FAST_H
+#include <stdint.h>
+
+// quick wifi association at boot. The channel and BSSID of the last good
+// connection are kept in nvs, so the next boot connects straight to that
+// AP instead of scanning every channel. After a software reset (an ota
+// reboot, a crash) the last DHCP lease is reused too, which skips the DHCP
+// round trips; the router still holds it for our MAC that soon after.
+//
+// build flags:
+//   -DWIFI_STATIC_IP='"192.168.1.50"'  fixed address, no DHCP at all
+//   -DWIFI_GATEWAY / WIFI_SUBNET / WIFI_DNS  (gateway defaults to .1 of
+//                                             the address, subnet to /24)
+
+#ifndef WIFI_FAST_TIMEOUT_MS
+#define WIFI_FAST_TIMEOUT_MS 2000 // then the cached AP is dropped and we scan
+#endif
+#ifndef WIFI_REUSE_LEASE
+#define WIFI_REUSE_LEASE 1
+#endif
+// a reused lease is not renewed, DHCP takes over again after this long
+#ifndef WIFI_LEASE_REUSE_MS
+#define WIFI_LEASE_REUSE_MS (10 * 60 * 1000)
+#endif
+
+// starts connecting and returns at once, so the rest of setup() can run
+// while the radio associates
+void wifiFastBegin(const char *ssid, const char *password);
+
+// blocks until connected; falls back to a full scan with DHCP if the
+// cached AP does not answer within WIFI_FAST_TIMEOUT_MS
+void wifiFastWait();
+
+// hands a reused lease back to DHCP once it is due, call periodically
+void wifiFastPoll();
+
+struct WifiBootInfo {
+  bool cachedAp;       // connected on the first try to the cached AP
+  bool leaseReused;    // no DHCP at boot
+  bool staticIp;       // WIFI_STATIC_IP
+  uint32_t connectUs;  // boot to got ip, 0 until then
+};
+const WifiBootInfo &wifiBootInfo();
+
+#endif
@@ -0,0 +1 @@
+#include "user_api.h"
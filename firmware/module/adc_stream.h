@@ -0,0 +1,40 @@
+#ifndef ADC_STREAM_H
+#define ADC_STREAM_H
+// module side of firmware/include/adc_stream.h, sampled by the core's i2s
+// dma engine through the api table
+#include "user_api.h"
+
+enum AdcReduce : uint8_t {
+  ADC_REDUCE_MEAN,
+  ADC_REDUCE_PICK,
+};
+
+inline bool adcStreamInCore() {
+  return coreApi->size > offsetof(UserCoreApi, adcStreamLatest);
+}
+
+inline bool adcStreamStart(uint8_t pin, uint32_t rateHz, uint16_t decimate,
+                           AdcReduce reduce) {
+  return adcStreamInCore() &&
+         coreApi->adcStreamStart(pin, rateHz, decimate, reduce);
+}
+
+inline void adcStreamStop() {
+  if (adcStreamInCore()) {
+    coreApi->adcStreamStop();
+  }
+}
+
+inline size_t adcStreamRead(uint16_t *out, size_t max) {
+  return adcStreamInCore() ? coreApi->adcStreamRead(out, max) : 0;
+}
+
+inline size_t adcStreamAvailable() {
+  return adcStreamInCore() ? coreApi->adcStreamAvailable() : 0;
+}
+
+inline uint16_t adcStreamLatest() {
+  return adcStreamInCore() ? coreApi->adcStreamLatest() : 0;
+}
+
+#endif
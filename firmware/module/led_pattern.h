@@ -0,0 +1,33 @@
+#ifndef LED_PATTERN_H
+#define LED_PATTERN_H
+// module side of firmware/include/led_pattern.h, played by the core's rmt
+// engine through the api table
+#include "user_api.h"
+
+inline bool ledPatternAvailable() {
+  return coreApi->size > offsetof(UserCoreApi, ledPatternStop);
+}
+
+inline bool ledPatternPlay(uint8_t pin, const uint32_t *durationsUs,
+                           size_t count, bool loop) {
+  return ledPatternAvailable() &&
+         coreApi->ledPatternPlay(pin, durationsUs, count, loop);
+}
+
+inline bool ledPatternMorse(uint8_t pin, const char *text, uint32_t unitMs,
+                            bool loop) {
+  return ledPatternAvailable() &&
+         coreApi->ledPatternMorse(pin, text, unitMs, loop);
+}
+
+inline bool ledPatternBusy(uint8_t pin) {
+  return ledPatternAvailable() && coreApi->ledPatternBusy(pin);
+}
+
+inline void ledPatternStop(uint8_t pin) {
+  if (ledPatternAvailable()) {
+    coreApi->ledPatternStop(pin);
+  }
+}
+
+#endif
@@ -0,0 +1,158 @@
+// module side of the core/module ABI, linked with the generated ai.cpp by
+// backend/build_user_module.py
+#include "user_api.h"
+#include "ai_vars_gen.h"
+
+void ai_test_setup();
+void ai_test_loop();
+
+const UserCoreApi *coreApi = nullptr;
+ModuleSerial Serial;
+
+static bool moduleSetVar(const char *name, const char *value) {
+  return updateVariableGeneric(name, value);
+}
+
+static const UserModuleExports moduleExports = {
+    USER_MODULE_ABI_VERSION,
+    ai_test_setup,
+    ai_test_loop,
+    moduleSetVar,
+    applyVariableHooks,
+    AI_VARS,
+    AI_VAR_COUNT,
+    AI_VAR_SCHEMA,
+    sizeof(AI_VAR_SCHEMA),
+};
+
+extern "C" const UserModuleExports *user_module_init(const UserCoreApi *api) {
+  if (!api || api->abiVersion != USER_MODULE_ABI_VERSION) {
+    return nullptr;
+  }
+  coreApi = api;
+  return &moduleExports;
+}
+
+void ModuleSerial::flush() {
+  line[len] = '\0';
+  coreApi->log(line);
+  len = 0;
+}
+
+void ModuleSerial::print(const char *s) {
+  while (*s) {
+    if (len == sizeof(line) - 1) {
+      flush();
+    }
+    line[len++] = *s++;
+  }
+}
+
+void ModuleSerial::print(long v) {
+  char buf[12];
+  char *p = buf + sizeof(buf) - 1;
+  unsigned long u = v < 0 ? 0ul - (unsigned long)v : (unsigned long)v;
+  *p = '\0';
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (v < 0) {
+    *--p = '-';
+  }
+  print(p);
+}
+
+void ModuleSerial::println(const char *s) {
+  print(s);
+  flush();
+}
+
+void ModuleSerial::println(long v) {
+  print(v);
+  flush();
+}
+
+// the module links without libc, this is the little it needs
+extern "C" {
+void *memcpy(void *dst, const void *src, size_t n) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  while (n--) {
+    *d++ = *s++;
+  }
+  return dst;
+}
+
+void *memset(void *dst, int c, size_t n) {
+  uint8_t *d = (uint8_t *)dst;
+  while (n--) {
+    *d++ = (uint8_t)c;
+  }
+  return dst;
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+  const uint8_t *x = (const uint8_t *)a;
+  const uint8_t *y = (const uint8_t *)b;
+  for (; n; n--, x++, y++) {
+    if (*x != *y) {
+      return *x - *y;
+    }
+  }
+  return 0;
+}
+
+size_t strlen(const char *s) {
+  size_t n = 0;
+  while (s[n]) {
+    n++;
+  }
+  return n;
+}
+
+int strcmp(const char *a, const char *b) {
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return (uint8_t)*a - (uint8_t)*b;
+}
+
+char *strncpy(char *dst, const char *src, size_t n) {
+  size_t i = 0;
+  for (; i < n && src[i]; i++) {
+    dst[i] = src[i];
+  }
+  for (; i < n; i++) {
+    dst[i] = '\0';
+  }
+  return dst;
+}
+
+void *malloc(size_t size) { return coreApi->malloc(size); }
+void free(void *ptr) { coreApi->free(ptr); }
+
+char *strdup(const char *s) {
+  size_t n = strlen(s) + 1;
+  char *d = (char *)malloc(n);
+  return d ? (char *)memcpy(d, s, n) : nullptr;
+}
+
+long atol(const char *s) {
+  while (*s == ' ' || *s == '\t') {
+    s++;
+  }
+  bool neg = *s == '-';
+  if (*s == '-' || *s == '+') {
+    s++;
+  }
+  long v = 0;
+  while (*s >= '0' && *s <= '9') {
+    v = v * 10 + (*s++ - '0');
+  }
+  return neg ? -v : v;
+}
+
+void __cxa_pure_virtual() {}
+}
@@ -0,0 +1,42 @@
+#ifndef SERVO_MOTION_H
+#define SERVO_MOTION_H
+// module side of firmware/include/servo_motion.h: the same calls, run by
+// the core's motion engine through the api table. Angle moves only.
+#include "user_api.h"
+
+enum MotionProfile {
+  MOTION_LINEAR,
+  MOTION_TRAPEZOID,
+  MOTION_SCURVE,
+};
+
+inline bool motionAvailable() {
+  return coreApi->size > offsetof(UserCoreApi, servoStop);
+}
+
+// the core keeps each slot's pulse range, a plain attach is enough
+inline int motionAttach(Servo &servo, int pin, int minUs = 500,
+                        int maxUs = 2400) {
+  return servo.attach(pin, minUs, maxUs);
+}
+
+inline bool motionMove(Servo &servo, int angle, uint32_t durationMs,
+                       MotionProfile profile = MOTION_SCURVE) {
+  if (!motionAvailable()) {
+    servo.write(angle);
+    return true;
+  }
+  return coreApi->servoMove(servo.coreSlot(), angle, durationMs, profile);
+}
+
+inline bool motionBusy(Servo &servo) {
+  return motionAvailable() && coreApi->servoMoving(servo.coreSlot());
+}
+
+inline void motionStop(Servo &servo) {
+  if (motionAvailable()) {
+    coreApi->servoStop(servo.coreSlot());
+  }
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef USER_API_H
+#define USER_API_H
+// Arduino-style surface for user modules. Everything goes through the
+// function table the core hands to user_module_init(), so a module works
+// with any core build that speaks the same USER_MODULE_ABI_VERSION.
+//
+// Arduino.h and ESP32Servo.h in this directory forward here, so generated
+// ai.cpp sketches compile unchanged as long as they stick to this API.
+#include "user_module.h"
+#include <stddef.h>
+#include <stdint.h>
+
+extern const UserCoreApi *coreApi;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+extern "C" {
+void *memcpy(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+size_t strlen(const char *s);
+int strcmp(const char *a, const char *b);
+char *strncpy(char *dst, const char *src, size_t n);
+char *strdup(const char *s);
+long atol(const char *s);
+void *malloc(size_t size);
+void free(void *ptr);
+}
+
+inline unsigned long millis() { return coreApi->millis(); }
+inline unsigned long micros() { return coreApi->micros(); }
+inline void delay(unsigned long ms) { coreApi->delay(ms); }
+inline void pinMode(uint8_t pin, uint8_t mode) { coreApi->pinMode(pin, mode); }
+inline void digitalWrite(uint8_t pin, uint8_t val) {
+  coreApi->digitalWrite(pin, val);
+}
+inline int digitalRead(uint8_t pin) { return coreApi->digitalRead(pin); }
+inline uint16_t analogRead(uint8_t pin) { return coreApi->analogRead(pin); }
+inline bool stopRequested() { return *coreApi->shouldStop; }
+
+// fixed-size string, modules have no String heap management
+class String {
+public:
+  String() { buf[0] = '\0'; }
+  String(const char *s) { assign(s); }
+  String &operator=(const char *s) {
+    assign(s);
+    return *this;
+  }
+  bool operator==(const char *s) const { return strcmp(buf, s) == 0; }
+  bool operator!=(const char *s) const { return strcmp(buf, s) != 0; }
+  const char *c_str() const { return buf; }
+  size_t length() const { return strlen(buf); }
+  long toInt() const { return atol(buf); }
+
+private:
+  void assign(const char *s) {
+    strncpy(buf, s ? s : "", sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+  }
+  char buf[64];
+};
+
+// servo handle backed by a core-owned ESP32Servo slot
+class Servo {
+public:
+  void setPeriodHertz(int) {}
+  int attach(int pin, int minUs = 500, int maxUs = 2400) {
+    detach();
+    slot = coreApi->servoAttach(pin, minUs, maxUs);
+    return slot >= 0 ? 1 : 0;
+  }
+  void detach() {
+    if (slot >= 0) {
+      coreApi->servoDetach(slot);
+      slot = -1;
+    }
+  }
+  void write(int angle) { coreApi->servoWrite(slot, angle); }
+  void writeMicroseconds(int us) { coreApi->servoWriteMicroseconds(slot, us); }
+  bool attached() const { return slot >= 0; }
+  int coreSlot() const { return slot; }
+
+private:
+  int slot = -1;
+};
+
+// line-oriented logging through the core
+class ModuleSerial {
+public:
+  void begin(unsigned long) {}
+  void print(const char *s);
+  void print(long v);
+  void println(const char *s = "");
+  void println(long v);
+
+private:
+  void flush();
+  char line[96];
+  size_t len = 0;
+};
+
+extern ModuleSerial Serial;
+
+#endif
@@ -0,0 +1,217 @@
+#include "adc_stream.h"
+#include "control_channel.h"
+#include "spsc_ring.h"
+#include "user_module.h"
+#include "var_watch.h"
+#include <Arduino.h>
+#include <driver/adc.h>
+#include <driver/i2s.h>
+#include <lwip/sockets.h>
+
+static SpscRing<uint16_t, ADC_STREAM_RING> readRing; // -> user logic
+static SpscRing<uint16_t, ADC_STREAM_RING> sendRing; // -> export task
+
+static TaskHandle_t sampler = NULL;
+static TaskHandle_t exporter = NULL;
+// set by start, cleared by the sampler once it let go of the driver
+static volatile bool running = false;
+static volatile bool stopRequest = false;
+static volatile uint16_t latest = 0;
+static volatile uint32_t produced = 0;
+static volatile uint16_t runId = 0; // tells the export a new stream began
+
+static uint8_t curPin = 0;
+static uint32_t curRate = 0;
+static uint16_t curDecimate = 1;
+static AdcReduce curReduce = ADC_REDUCE_MEAN;
+
+static uint16_t dma[ADC_STREAM_DMA_LEN];
+static uint16_t reduced[ADC_STREAM_DMA_LEN];
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, v & 0xffff);
+  put16(p + 2, v >> 16);
+}
+
+static void samplerTask(void *pvParameters) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uint32_t sum = 0;
+    uint16_t inBlock = 0;
+    while (!stopRequest) {
+      size_t got = 0;
+      if (i2s_read(I2S_NUM_0, dma, sizeof(dma), &got, pdMS_TO_TICKS(100)) !=
+          ESP_OK) {
+        continue;
+      }
+      size_t count = (got / 2) & ~(size_t)1;
+      size_t n = 0;
+      for (size_t i = 0; i < count; i++) {
+        // the dma hands 16-bit samples over in swapped pairs, with the
+        // channel number in the top four bits
+        uint16_t raw = dma[i ^ 1] & 0x0fff;
+        if (curReduce == ADC_REDUCE_MEAN) {
+          sum += raw;
+        } else if (inBlock == 0) {
+          sum = raw;
+        }
+        if (++inBlock == curDecimate) {
+          reduced[n++] = curReduce == ADC_REDUCE_MEAN ? sum / curDecimate : sum;
+          sum = 0;
+          inBlock = 0;
+        }
+      }
+      if (n) {
+        readRing.push(reduced, n);
+        sendRing.push(reduced, n);
+        latest = reduced[n - 1];
+        produced += n;
+      }
+    }
+    running = false;
+  }
+}
+
+// CTRL_SAMPLES, see control_channel.h
+static void exportTask(void *pvParameters) {
+  static uint16_t batch[ADC_STREAM_BATCH_MAX];
+  static uint8_t packet[CTRL_HEADER_SIZE + 18 + 2 * ADC_STREAM_BATCH_MAX];
+  sockaddr_in peers[VAR_WATCH_MAX_SUBSCRIBERS];
+  uint16_t seenRun = runId;
+  uint32_t index = 0;
+  uint16_t seq = 0;
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(ADC_STREAM_BATCH_MS));
+    if (seenRun != runId) {
+      sendRing.clear();
+      seenRun = runId;
+      index = 0;
+    }
+    size_t peerCount = varWatchSampleTargets(peers, VAR_WATCH_MAX_SUBSCRIBERS);
+    size_t n;
+    while ((n = sendRing.pop(batch, ADC_STREAM_BATCH_MAX)) > 0) {
+      uint32_t first = index;
+      index += n;
+      if (!peerCount) {
+        continue;
+      }
+      packet[0] = CTRL_SAMPLES;
+      packet[1] = CTRL_VERSION;
+      put16(packet + 2, ++seq);
+      put16(packet + 4, userModuleGeneration());
+      uint8_t *p = packet + CTRL_HEADER_SIZE;
+      put32(p, first);
+      put32(p + 4, sendRing.droppedCount());
+      put32(p + 8, curRate);
+      put16(p + 12, curDecimate);
+      p[14] = curPin;
+      p[15] = 0;
+      put16(p + 16, n);
+      p += 18;
+      for (size_t i = 0; i < n; i++, p += 2) {
+        put16(p, batch[i]);
+      }
+      for (size_t i = 0; i < peerCount; i++) {
+        controlChannelSend(packet, p - packet, peers[i]);
+      }
+    }
+  }
+}
+
+static bool startTasks() {
+  if (!sampler &&
+      xTaskCreatePinnedToCore(samplerTask, "AdcStreamTask", ADC_STREAM_TASK_STACK,
+                              NULL, ADC_STREAM_TASK_PRIORITY, &sampler,
+                              ADC_STREAM_TASK_CORE) != pdPASS) {
+    return false;
+  }
+  return exporter ||
+         xTaskCreatePinnedToCore(exportTask, "AdcExportTask", ADC_STREAM_TASK_STACK,
+                                 NULL, ADC_EXPORT_TASK_PRIORITY, &exporter,
+                                 ADC_STREAM_TASK_CORE) == pdPASS;
+}
+
+bool adcStreamStart(uint8_t pin, uint32_t rateHz, uint16_t decimate,
+                    AdcReduce reduce) {
+  int channel = digitalPinToAnalogChannel(pin);
+  // i2s only drives adc1, and adc2 is wifi's anyway
+  if (channel < 0 || channel >= ADC1_CHANNEL_MAX ||
+      rateHz < ADC_STREAM_MIN_RATE || rateHz > ADC_STREAM_MAX_RATE ||
+      decimate == 0) {
+    return false;
+  }
+  adcStreamStop();
+  if (!startTasks()) {
+    return false;
+  }
+
+  i2s_config_t cfg = {};
+  cfg.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN);
+  cfg.sample_rate = rateHz;
+  cfg.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+  cfg.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
+  cfg.communication_format = I2S_COMM_FORMAT_STAND_MSB;
+  cfg.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1;
+  cfg.dma_buf_count = ADC_STREAM_DMA_BUFS;
+  cfg.dma_buf_len = ADC_STREAM_DMA_LEN;
+  if (i2s_driver_install(I2S_NUM_0, &cfg, 0, NULL) != ESP_OK) {
+    return false;
+  }
+  if (adc1_config_width(ADC_WIDTH_BIT_12) != ESP_OK ||
+      adc1_config_channel_atten((adc1_channel_t)channel, ADC_ATTEN_DB_11) !=
+          ESP_OK ||
+      i2s_set_adc_mode(ADC_UNIT_1, (adc1_channel_t)channel) != ESP_OK ||
+      i2s_adc_enable(I2S_NUM_0) != ESP_OK) {
+    i2s_driver_uninstall(I2S_NUM_0);
+    return false;
+  }
+
+  curPin = pin;
+  curRate = rateHz;
+  curDecimate = decimate;
+  curReduce = reduce;
+  readRing.clear(); // start runs on the reading side, user setup
+  latest = 0;
+  produced = 0;
+  runId++;
+  stopRequest = false;
+  running = true;
+  xTaskNotifyGive(sampler);
+  return true;
+}
+
+void adcStreamStop() {
+  if (!running) {
+    return;
+  }
+  stopRequest = true;
+  // the sampler's i2s_read times out within 100 ms
+  while (running) {
+    vTaskDelay(1);
+  }
+  i2s_adc_disable(I2S_NUM_0);
+  i2s_driver_uninstall(I2S_NUM_0);
+}
+
+bool adcStreamRunning() { return running; }
+
+size_t adcStreamRead(uint16_t *out, size_t max) { return readRing.pop(out, max); }
+
+size_t adcStreamAvailable() { return readRing.available(); }
+
+uint16_t adcStreamLatest() { return latest; }
+
+void adcStreamGetStats(AdcStreamStats &out) {
+  out.running = running;
+  out.pin = curPin;
+  out.rateHz = curRate;
+  out.decimate = curDecimate;
+  out.samples = produced;
+  out.readDropped = readRing.droppedCount();
+  out.sentDropped = sendRing.droppedCount();
+}
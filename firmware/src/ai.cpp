@@ -1,40 +1,46 @@
 #include <Arduino.h>
 #include <ESP32Servo.h>
+#include "coop.h"
+#include "servo_motion.h"
 
-int servoPin = 13;
-int ledPin = 2;
+int servoPin = 13; // @min 0 @max 39 @step 1
+int ledPin = 2; // @min 0 @max 39 @step 1
+
+int sweepMs = 2700; // @min 500 @max 5000 @step 100
 
 Servo sg90;
 
-void ai_test_setup() {
-  pinMode(ledPin, OUTPUT);
+// sweep back and forth, LED on while paused at either end; the motion
+// engine drives the servo, this only waits for each move to finish
+void sweepStep(CoopTask &t) {
+  CO_BEGIN(t);
   digitalWrite(ledPin, LOW);
+  motionMove(sg90, 180, sweepMs, MOTION_SCURVE);
+  CO_WAIT_UNTIL(t, !motionBusy(sg90));
 
-  sg90.detach();
-  sg90.setPeriodHertz(50);
-  sg90.attach(servoPin, 500, 2400);
-}
+  digitalWrite(ledPin, HIGH);
+  CO_DELAY(t, 3000);
 
-void ai_test_loop() {
-  // Sweep 0 -> 180
   digitalWrite(ledPin, LOW);
-  for (int pos = 0; pos <= 180; pos += 1) {
-    sg90.write(pos);
-    delay(15);
-  }
+  motionMove(sg90, 0, sweepMs, MOTION_SCURVE);
+  CO_WAIT_UNTIL(t, !motionBusy(sg90));
 
-  // Pause at end; LED on while stopped
   digitalWrite(ledPin, HIGH);
-  delay(3000);
+  CO_DELAY(t, 3000);
+  CO_RESTART(t);
+}
 
-  // Sweep 180 -> 0
+void ai_test_setup() {
+  pinMode(ledPin, OUTPUT);
   digitalWrite(ledPin, LOW);
-  for (int pos = 180; pos >= 0; pos -= 1) {
-    sg90.write(pos);
-    delay(15);
-  }
 
-  // Pause at end; LED on while stopped
-  digitalWrite(ledPin, HIGH);
-  delay(3000);
-}
\ No newline at end of file
+  motionStop(sg90);
+  sg90.detach();
+  sg90.setPeriodHertz(50);
+  motionAttach(sg90, servoPin, 500, 2400);
+
+  coopReset();
+  coopSpawn(sweepStep);
+}
+
+void ai_test_loop() { coopTick(); }
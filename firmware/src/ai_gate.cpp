@@ -0,0 +1,63 @@
+#include "ai_gate.h"
+#include "ai.h"
+#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
+
+#define AI_GATE_RUN BIT0
+#define AI_GATE_PARKED BIT1
+
+volatile bool shouldStop = false;
+
+static EventGroupHandle_t gate = NULL;
+// serialises count updates with the RUN bit so nested pauses cannot
+// interleave a resume with a new pause
+static SemaphoreHandle_t pauseLock = NULL;
+static int pauseCount = 0;
+
+void aiGateInit() {
+  if (!gate) {
+    gate = xEventGroupCreate();
+    pauseLock = xSemaphoreCreateMutex();
+    xEventGroupSetBits(gate, AI_GATE_RUN | AI_GATE_PARKED);
+  }
+}
+
+bool aiGateEnter() {
+  bool waited = !(xEventGroupGetBits(gate) & AI_GATE_RUN);
+  for (;;) {
+    xEventGroupWaitBits(gate, AI_GATE_RUN, pdFALSE, pdTRUE, portMAX_DELAY);
+    xEventGroupClearBits(gate, AI_GATE_PARKED);
+    // a pause that landed between the wait and the clear already saw
+    // PARKED and went ahead, so back off instead of running a step
+    if (xEventGroupGetBits(gate) & AI_GATE_RUN) {
+      return waited;
+    }
+    xEventGroupSetBits(gate, AI_GATE_PARKED);
+    waited = true;
+  }
+}
+
+void aiGateLeave() { xEventGroupSetBits(gate, AI_GATE_PARKED); }
+
+bool aiGatePause(TickType_t timeout) {
+  xSemaphoreTake(pauseLock, portMAX_DELAY);
+  pauseCount++;
+  shouldStop = true;
+  xEventGroupClearBits(gate, AI_GATE_RUN);
+  xSemaphoreGive(pauseLock);
+
+  EventBits_t bits =
+      xEventGroupWaitBits(gate, AI_GATE_PARKED, pdFALSE, pdTRUE, timeout);
+  return bits & AI_GATE_PARKED;
+}
+
+void aiGateResume() {
+  xSemaphoreTake(pauseLock, portMAX_DELAY);
+  if (pauseCount > 0 && --pauseCount == 0) {
+    shouldStop = false;
+    xEventGroupSetBits(gate, AI_GATE_RUN);
+  }
+  xSemaphoreGive(pauseLock);
+}
+
+bool aiGatePaused() { return !(xEventGroupGetBits(gate) & AI_GATE_RUN); }
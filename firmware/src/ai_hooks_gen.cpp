@@ -0,0 +1,22 @@
+// generated from the sketch by backend/generate_variable_glue.py, with
+// the ai_test_setup() statements each variable depends on, replayed when
+// only that variable changes
+#include <Arduino.h>
+#include <ESP32Servo.h>
+#include "coop.h"
+#include "servo_motion.h"
+#include "ai_vars_gen.h"
+
+extern Servo sg90;
+
+void ai_apply_servoPin() {
+  motionStop(sg90);
+  sg90.detach();
+  sg90.setPeriodHertz(50);
+  motionAttach(sg90, servoPin, 500, 2400);
+}
+
+void ai_apply_ledPin() {
+  pinMode(ledPin, OUTPUT);
+  digitalWrite(ledPin, LOW);
+}
@@ -0,0 +1,254 @@
+#include "control_channel.h"
+#include "ai_vars_gen.h"
+#include "user_module.h"
+#include "var_batch.h"
+#include "var_watch.h"
+#include <lwip/sockets.h>
+
+struct PendingValue {
+  bool dirty;
+  uint8_t len;
+  char value[CTRL_VALUE_MAX];
+};
+
+// the client whose packets we last took, old seqs from it are dropped
+struct Peer {
+  uint32_t addr;
+  uint16_t port;
+  uint16_t seq;
+  bool valid;
+};
+
+static int sock = -1;
+static PendingValue pending[CTRL_MAX_VARS];
+static Peer peer;
+static uint16_t pendingGen = 0;
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static bool isText(AiVarType type) {
+  return type == AI_VAR_CHAR || type == AI_VAR_STRING ||
+         type == AI_VAR_CHAR_PTR || type == AI_VAR_CHAR_ARRAY;
+}
+
+// caller holds userModuleLock()
+static size_t varTable(const AiVar **vars) {
+  if (userModuleActive()) {
+    size_t count;
+    *vars = userModuleVars(&count);
+    return count;
+  }
+  *vars = AI_VARS;
+  return AI_VAR_COUNT;
+}
+
+static void sendPacket(const uint8_t *buf, size_t len, const sockaddr_in &to) {
+  sendto(sock, buf, len, 0, (const sockaddr *)&to, sizeof(to));
+}
+
+void controlChannelSend(const uint8_t *buf, size_t len,
+                        const sockaddr_in &to) {
+  if (sock >= 0) {
+    sendPacket(buf, len, to);
+  }
+}
+
+static void sendList(const sockaddr_in &to) {
+  uint8_t buf[CTRL_PACKET_MAX];
+  buf[0] = CTRL_LIST;
+  buf[1] = CTRL_VERSION;
+  put16(buf + 2, 0);
+
+  userModuleLock();
+  put16(buf + 4, userModuleGeneration());
+  const AiVar *vars;
+  size_t count = varTable(&vars);
+  if (count > CTRL_MAX_VARS) {
+    count = CTRL_MAX_VARS;
+  }
+  size_t len = CTRL_HEADER_SIZE + 1;
+  uint8_t listed = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t nameLen = strlen(vars[i].name);
+    if (nameLen > 255 || len + 2 + nameLen > sizeof(buf)) {
+      break;
+    }
+    buf[len++] = vars[i].type;
+    buf[len++] = nameLen;
+    memcpy(buf + len, vars[i].name, nameLen);
+    len += nameLen;
+    listed++;
+  }
+  userModuleUnlock();
+
+  buf[CTRL_HEADER_SIZE] = listed;
+  sendPacket(buf, len, to);
+}
+
+// records the newest value per variable, staged later by flush(). A packet
+// with any bad entry is dropped whole, so none of it is applied.
+static uint8_t takeSet(const uint8_t *p, size_t len, uint16_t gen) {
+  if (gen != userModuleGeneration()) {
+    return CTRL_STATUS_STALE;
+  }
+
+  userModuleLock();
+  const AiVar *vars;
+  size_t count = varTable(&vars);
+  for (size_t off = 0; off < len; off += p[off + 1] + 2) {
+    if (len - off < 2 || (size_t)p[off + 1] + 2 > len - off ||
+        p[off] >= count || p[off] >= CTRL_MAX_VARS ||
+        (!isText(vars[p[off]].type) && p[off + 1] != 4)) {
+      userModuleUnlock();
+      return CTRL_STATUS_BAD;
+    }
+  }
+
+  while (len > 0) {
+    uint8_t id = p[0];
+    uint8_t valueLen = p[1];
+    const uint8_t *value = p + 2;
+    PendingValue &slot = pending[id];
+
+    if (isText(vars[id].type)) {
+      slot.len = valueLen < CTRL_VALUE_MAX ? valueLen : CTRL_VALUE_MAX - 1;
+      memcpy(slot.value, value, slot.len);
+    } else {
+      uint32_t bits = value[0] | (value[1] << 8) | (value[2] << 16) |
+                      ((uint32_t)value[3] << 24);
+      if (vars[id].type == AI_VAR_FLOAT) {
+        float f;
+        memcpy(&f, &bits, 4);
+        slot.len = snprintf(slot.value, sizeof(slot.value), "%.9g", f);
+      } else {
+        slot.len = snprintf(slot.value, sizeof(slot.value), "%ld",
+                            (long)(int32_t)bits);
+      }
+    }
+    slot.dirty = true;
+    p += valueLen + 2;
+    len -= valueLen + 2;
+  }
+  userModuleUnlock();
+  pendingGen = gen;
+  return CTRL_STATUS_OK;
+}
+
+// stages every coalesced value as one batch; kept pending if it does not fit
+static uint8_t flush() {
+  bool any = false;
+  for (uint8_t id = 0; id < CTRL_MAX_VARS; id++) {
+    any |= pending[id].dirty;
+  }
+  if (!any) {
+    return CTRL_STATUS_OK;
+  }
+
+  char name[16];
+  varBatchBegin();
+  for (uint8_t id = 0; id < CTRL_MAX_VARS; id++) {
+    if (!pending[id].dirty) {
+      continue;
+    }
+    size_t nameLen = snprintf(name, sizeof(name), "#%u.%u", pendingGen, id);
+    if (!varBatchStage(name, nameLen, pending[id].value, pending[id].len)) {
+      varBatchAbort();
+      return CTRL_STATUS_FULL;
+    }
+  }
+  varBatchEnd(false);
+  for (uint8_t id = 0; id < CTRL_MAX_VARS; id++) {
+    pending[id].dirty = false;
+  }
+  return CTRL_STATUS_OK;
+}
+
+// false for a replayed or reordered packet from the current peer
+static bool accept(const sockaddr_in &from, uint16_t seq) {
+  if (peer.valid && peer.addr == from.sin_addr.s_addr &&
+      peer.port == from.sin_port && (int16_t)(seq - peer.seq) <= 0) {
+    return false;
+  }
+  peer.addr = from.sin_addr.s_addr;
+  peer.port = from.sin_port;
+  peer.seq = seq;
+  peer.valid = true;
+  return true;
+}
+
+static void controlTask(void *pvParameters) {
+  uint8_t buf[CTRL_PACKET_MAX];
+  for (;;) {
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    int n = recvfrom(sock, buf, sizeof(buf), 0, (sockaddr *)&from, &fromLen);
+
+    bool haveSet = false;
+    uint8_t status = CTRL_STATUS_OK;
+    uint8_t packets = 0;
+    sockaddr_in ackTo;
+
+    // drain whatever queued up meanwhile before staging anything
+    while (n >= CTRL_HEADER_SIZE) {
+      if (buf[1] == CTRL_VERSION && buf[0] == CTRL_HELLO) {
+        sendList(from);
+      } else if (buf[1] == CTRL_VERSION && buf[0] == CTRL_WATCH) {
+        varWatchSubscribe(from, buf + CTRL_HEADER_SIZE, n - CTRL_HEADER_SIZE);
+      } else if (buf[1] == CTRL_VERSION && buf[0] == CTRL_SET) {
+        uint16_t seq = get16(buf + 2);
+        if (accept(from, seq)) {
+          uint8_t s = takeSet(buf + CTRL_HEADER_SIZE, n - CTRL_HEADER_SIZE,
+                              get16(buf + 4));
+          status = s > status ? s : status;
+        }
+        haveSet = true;
+        ackTo = from;
+        packets++;
+      }
+      fromLen = sizeof(from);
+      n = recvfrom(sock, buf, sizeof(buf), MSG_DONTWAIT, (sockaddr *)&from,
+                   &fromLen);
+    }
+
+    if (haveSet) {
+      uint8_t s = flush();
+      status = s > status ? s : status;
+      uint8_t ack[CTRL_HEADER_SIZE + 2];
+      ack[0] = CTRL_ACK;
+      ack[1] = CTRL_VERSION;
+      put16(ack + 2, peer.seq);
+      put16(ack + 4, userModuleGeneration());
+      ack[6] = status;
+      ack[7] = packets;
+      sendPacket(ack, sizeof(ack), ackTo);
+    }
+  }
+}
+
+bool startControlChannel() {
+  if (sock >= 0) {
+    return true;
+  }
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) {
+    return false;
+  }
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(CTRL_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(sock, (sockaddr *)&addr, sizeof(addr)) < 0 || !varWatchInit()) {
+    close(sock);
+    sock = -1;
+    return false;
+  }
+  return xTaskCreatePinnedToCore(controlTask, "ControlTask", CTRL_TASK_STACK,
+                                 NULL, CTRL_TASK_PRIORITY, NULL,
+                                 CTRL_TASK_CORE) == pdPASS;
+}
@@ -0,0 +1,87 @@
+#include "control_task.h"
+#include "ai.h"
+#include "ai_gate.h"
+#include "led_pattern.h"
+#include "loop_stats.h"
+#include "servo_motion.h"
+#include "user_module.h"
+#include "var_batch.h"
+#include "var_store.h"
+#include "var_watch.h"
+#include "vm.h"
+
+// the code whose setup last ran on this task. A module loaded or unloaded
+// under the paused gate swaps the code without touching its pins, so the
+// first step after the swap parks the old code before the new one's setup
+// attaches anything.
+enum SketchOwner { OWNER_NONE, OWNER_BUILTIN, OWNER_MODULE };
+static SketchOwner owner = OWNER_NONE;
+
+void controlTaskPark() {
+  if (owner == OWNER_MODULE) {
+    userModuleReleaseHardware();
+  } else if (owner == OWNER_BUILTIN) {
+    motionDetachAll();
+    ledPatternStopAll();
+  }
+  owner = OWNER_NONE;
+}
+
+static void sketchStep() {
+  SketchOwner want = userModuleActive() ? OWNER_MODULE : OWNER_BUILTIN;
+  if (owner != want) {
+    // an unloaded module's pins already went with userModuleUnload()
+    if (owner == OWNER_BUILTIN) {
+      controlTaskPark();
+    }
+    if (want == OWNER_MODULE) {
+      userModuleRequestSetup();
+    } else {
+      ai_test_setup();
+    }
+    owner = want;
+  }
+  if (owner == OWNER_MODULE) {
+    userModuleLoop();
+  } else {
+    ai_test_loop();
+  }
+}
+
+static void aiControlTask(void *pvParameters) {
+  const TickType_t period =
+      pdMS_TO_TICKS(CONTROL_TASK_PERIOD_MS) ? pdMS_TO_TICKS(CONTROL_TASK_PERIOD_MS)
+                                            : 1;
+  TickType_t last = xTaskGetTickCount();
+  for (;;) {
+    // blocks while OTA or a variable update has the loop paused
+    bool resumed = aiGateEnter();
+    loopStatsBegin(resumed);
+    varBatchCommit();
+    varStoreTick();
+    // a loaded vm program takes precedence over module and built-in code
+    if (!vmStep()) {
+      sketchStep();
+    }
+    loopStatsEnd();
+    // outside the step timing, values as this step left them
+    varWatchTick();
+    aiGateLeave();
+
+    // after a pause or an overrun start a fresh schedule from now, rather
+    // than running the missed ticks back to back
+    TickType_t now = xTaskGetTickCount();
+    if (resumed || now - last >= period) {
+      last = now;
+    }
+    vTaskDelayUntil(&last, period);
+  }
+}
+
+bool startControlTask() {
+  loopStatsInit();
+  owner = userModuleActive() ? OWNER_MODULE : OWNER_BUILTIN;
+  return xTaskCreatePinnedToCore(aiControlTask, "AIControlTask", CONTROL_TASK_STACK,
+                                 NULL, CONTROL_TASK_PRIORITY, NULL,
+                                 CONTROL_TASK_CORE) == pdPASS;
+}
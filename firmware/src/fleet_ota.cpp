@@ -0,0 +1,314 @@
+#include "fleet_ota.h"
+#include "log_ring.h"
+#include "ota.h"
+#include <WiFi.h>
+#include <esp_ota_ops.h>
+#include <lwip/sockets.h>
+#include <mbedtls/sha256.h>
+
+struct FleetSession {
+  bool active;
+  uint32_t id;
+  uint32_t size;
+  uint16_t chunkSize;
+  uint32_t chunkCount;
+  uint32_t received;
+  uint8_t sha256[32];
+  uint8_t *have; // one bit per chunk
+  const esp_partition_t *part;
+  esp_ota_handle_t handle;
+  uint32_t lastPacketMs;
+};
+
+static int sock = -1;
+static FleetSession session;
+static sockaddr_in sender;
+// the last session we are done with and what we answered, repeated to
+// every later FLEET_END in case the first reply was lost
+static uint32_t doneId = 0;
+static uint8_t doneStatus = FLEET_OK;
+static uint8_t packet[FLEET_PACKET_MAX];
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, v & 0xffff);
+  put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static uint32_t get32(const uint8_t *p) {
+  return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static bool haveChunk(uint32_t i) { return session.have[i / 8] & (1 << (i % 8)); }
+
+static size_t header(uint8_t *buf, uint8_t type, uint32_t id) {
+  buf[0] = type;
+  buf[1] = FLEET_VERSION;
+  put16(buf + 2, 0);
+  put32(buf + 4, id);
+  return FLEET_HEADER_SIZE;
+}
+
+// every receiver answers the same FLEET_END, so spread the replies out
+static void backoff() {
+  vTaskDelay(pdMS_TO_TICKS(esp_random() % FLEET_NACK_JITTER_MS));
+}
+
+static void sendDone(uint32_t id, uint8_t status) {
+  uint8_t buf[FLEET_HEADER_SIZE + 1];
+  size_t len = header(buf, FLEET_DONE, id);
+  buf[len++] = status;
+  sendto(sock, buf, len, 0, (const sockaddr *)&sender, sizeof(sender));
+}
+
+static void sendNack() {
+  uint8_t buf[FLEET_HEADER_SIZE + 2 + FLEET_MAX_RANGES * 6];
+  size_t len = header(buf, FLEET_NACK, session.id) + 2;
+  uint16_t ranges = 0;
+  for (uint32_t i = 0; i < session.chunkCount && ranges < FLEET_MAX_RANGES;) {
+    if (haveChunk(i)) {
+      i++;
+      continue;
+    }
+    uint32_t first = i;
+    while (i < session.chunkCount && !haveChunk(i) && i - first < 0xffff) {
+      i++;
+    }
+    put32(buf + len, first);
+    put16(buf + len + 4, i - first);
+    len += 6;
+    ranges++;
+  }
+  put16(buf + FLEET_HEADER_SIZE, ranges);
+  sendto(sock, buf, len, 0, (const sockaddr *)&sender, sizeof(sender));
+}
+
+static void endSession(bool ok, const char *error) {
+  free(session.have);
+  session.have = NULL;
+  session.active = false;
+  WiFi.setSleep(true);
+  otaRelease(ok, error); // does not return on success
+}
+
+static void failSession(const char *error) {
+  esp_ota_abort(session.handle);
+  doneId = session.id;
+  doneStatus = FLEET_FAILED;
+  sendDone(session.id, FLEET_FAILED);
+  endSession(false, error);
+}
+
+static bool runningBuild(const uint8_t build[32]) {
+  const char *running = getRunningBuildHash();
+  if (!running) {
+    return false;
+  }
+  char hex[65];
+  for (int i = 0; i < 32; i++) {
+    snprintf(hex + 2 * i, 3, "%02x", build[i]);
+  }
+  return strcmp(hex, running) == 0;
+}
+
+static void onOffer(uint32_t id, const uint8_t *p, size_t len) {
+  if (len < 4 + 2 + 2 + 32 + 32 || id == doneId) {
+    return;
+  }
+  if (session.active) {
+    if (id == session.id) {
+      session.lastPacketMs = millis();
+    }
+    return;
+  }
+
+  uint32_t size = get32(p);
+  uint16_t chunkSize = get16(p + 4);
+  const uint8_t *build = p + 8 + 32;
+  static const uint8_t unknown[32] = {0};
+  if (memcmp(build, unknown, 32) != 0 && runningBuild(build)) {
+    doneId = id;
+    doneStatus = FLEET_CURRENT;
+    return;
+  }
+
+  const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+  if (!part || size == 0 || size > part->size || chunkSize == 0 ||
+      chunkSize > FLEET_MAX_CHUNK) {
+    return;
+  }
+  // an http job owns the slot, this board sits the session out
+  if (!otaAcquire(size)) {
+    return;
+  }
+  logWrite(LOG_FLEET_SESSION, id, size);
+
+  session.id = id;
+  session.size = size;
+  session.chunkSize = chunkSize;
+  session.chunkCount = (size + chunkSize - 1) / chunkSize;
+  session.received = 0;
+  memcpy(session.sha256, p + 8, 32);
+  session.part = part;
+  session.lastPacketMs = millis();
+  session.have = (uint8_t *)calloc((session.chunkCount + 7) / 8, 1);
+  session.active = true;
+  if (!session.have) {
+    endSession(false, "out of memory for the chunk map");
+    return;
+  }
+  // the sender keeps offering while this erases the image's sectors
+  if (esp_ota_begin(part, size, &session.handle) != ESP_OK) {
+    endSession(false, "esp_ota_begin failed");
+    return;
+  }
+  // multicast is only delivered at dtim beacons while the modem sleeps
+  WiFi.setSleep(false);
+}
+
+static void onData(uint32_t id, const uint8_t *p, size_t len) {
+  if (!session.active || id != session.id || len < 4) {
+    return;
+  }
+  session.lastPacketMs = millis();
+  uint32_t index = get32(p);
+  if (index >= session.chunkCount || haveChunk(index)) {
+    return;
+  }
+  uint32_t offset = index * session.chunkSize;
+  uint32_t want = session.size - offset < session.chunkSize
+                      ? session.size - offset
+                      : session.chunkSize;
+  if (len - 4 != want) {
+    return;
+  }
+  if (esp_ota_write_with_offset(session.handle, p + 4, want, offset) != ESP_OK) {
+    failSession("flash write failed");
+    return;
+  }
+  session.have[index / 8] |= 1 << (index % 8);
+  session.received++;
+  if (session.received % 16 == 0 || session.received == session.chunkCount) {
+    size_t done = session.received * (size_t)session.chunkSize;
+    otaReportProgress(done < session.size ? done : session.size, session.size);
+  }
+}
+
+// reads the written image back, the chunks took too many paths to trust
+// a running hash
+static bool verify() {
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts_ret(&sha, 0);
+  bool ok = true;
+  for (uint32_t pos = 0; ok && pos < session.size; pos += FLEET_MAX_CHUNK) {
+    uint32_t n = session.size - pos < FLEET_MAX_CHUNK ? session.size - pos
+                                                      : FLEET_MAX_CHUNK;
+    ok = esp_partition_read(session.part, pos, packet, n) == ESP_OK;
+    mbedtls_sha256_update_ret(&sha, packet, n);
+  }
+  uint8_t digest[32];
+  mbedtls_sha256_finish_ret(&sha, digest);
+  mbedtls_sha256_free(&sha);
+  return ok && memcmp(digest, session.sha256, 32) == 0;
+}
+
+static void onEnd(uint32_t id) {
+  if (id == doneId) {
+    backoff();
+    sendDone(id, doneStatus);
+    return;
+  }
+  if (!session.active || id != session.id) {
+    return;
+  }
+  session.lastPacketMs = millis();
+  if (session.received < session.chunkCount) {
+    backoff();
+    sendNack();
+    return;
+  }
+
+  if (!verify()) {
+    failSession("image sha256 mismatch");
+    return;
+  }
+  if (esp_ota_end(session.handle) != ESP_OK ||
+      esp_ota_set_boot_partition(session.part) != ESP_OK) {
+    doneId = id;
+    doneStatus = FLEET_FAILED;
+    sendDone(id, FLEET_FAILED);
+    endSession(false, "image did not validate");
+    return;
+  }
+  // a couple of copies, nobody is left to retry once we reboot
+  for (int i = 0; i < 3; i++) {
+    sendDone(id, FLEET_OK);
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+  endSession(true, "");
+}
+
+static void fleetTask(void *pvParameters) {
+  for (;;) {
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    int n = recvfrom(sock, packet, sizeof(packet), 0, (sockaddr *)&from,
+                     &fromLen);
+    if (session.active &&
+        millis() - session.lastPacketMs > FLEET_IDLE_TIMEOUT_MS) {
+      failSession("fleet sender went away");
+    }
+    if (n < FLEET_HEADER_SIZE || packet[1] != FLEET_VERSION) {
+      continue;
+    }
+    uint32_t id = get32(packet + 4);
+    const uint8_t *body = packet + FLEET_HEADER_SIZE;
+    size_t len = n - FLEET_HEADER_SIZE;
+    if (packet[0] == FLEET_OFFER) {
+      sender = from;
+      onOffer(id, body, len);
+    } else if (packet[0] == FLEET_DATA) {
+      onData(id, body, len);
+    } else if (packet[0] == FLEET_END) {
+      onEnd(id);
+    }
+  }
+}
+
+bool startFleetOta() {
+  if (sock >= 0) {
+    return true;
+  }
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) {
+    return false;
+  }
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(FLEET_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  ip_mreq mreq;
+  mreq.imr_multiaddr.s_addr = inet_addr(FLEET_GROUP);
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+  // wakes up once a second to drop a session whose sender vanished
+  timeval timeout = {1, 0};
+  if (bind(sock, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+      setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+      setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+    close(sock);
+    sock = -1;
+    return false;
+  }
+  return xTaskCreatePinnedToCore(fleetTask, "FleetOtaTask", FLEET_TASK_STACK,
+                                 NULL, FLEET_TASK_PRIORITY, NULL,
+                                 FLEET_TASK_CORE) == pdPASS;
+}
@@ -0,0 +1,107 @@
+#include "http_util.h"
+#include <Arduino.h>
+
+esp_err_t httpSend(httpd_req_t *req, const char *status, const char *type,
+                   const char *body) {
+  httpd_resp_set_status(req, status);
+  httpd_resp_set_type(req, type);
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, body, HTTPD_RESP_USE_STRLEN);
+}
+
+bool httpQuery(httpd_req_t *req, char *buf, size_t size) {
+  size_t len = httpd_req_get_url_query_len(req);
+  if (len == 0) {
+    buf[0] = '\0';
+    return true;
+  }
+  return len < size && httpd_req_get_url_query_str(req, buf, size) == ESP_OK;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// decodes [s, s + len) in place, returns the new length
+static size_t urlDecode(char *s, size_t len) {
+  size_t out = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (s[i] == '+') {
+      s[out++] = ' ';
+    } else if (s[i] == '%' && i + 2 < len && hexValue(s[i + 1]) >= 0 &&
+               hexValue(s[i + 2]) >= 0) {
+      s[out++] = (char)(hexValue(s[i + 1]) << 4 | hexValue(s[i + 2]));
+      i += 2;
+    } else {
+      s[out++] = s[i];
+    }
+  }
+  return out;
+}
+
+bool httpQueryArg(const char *query, const char *key, char *out, size_t size) {
+  if (httpd_query_key_value(query, key, out, size) != ESP_OK) {
+    return false;
+  }
+  out[urlDecode(out, strlen(out))] = '\0';
+  return true;
+}
+
+bool httpForEachArg(char *query, HttpArgFn fn, void *ctx) {
+  char *p = query;
+  while (*p) {
+    char *end = strchr(p, '&');
+    size_t pairLen = end ? (size_t)(end - p) : strlen(p);
+    char *eq = (char *)memchr(p, '=', pairLen);
+    size_t keyLen = eq ? (size_t)(eq - p) : pairLen;
+    char *value = eq ? eq + 1 : p + pairLen;
+    size_t valueLen = eq ? pairLen - keyLen - 1 : 0;
+
+    keyLen = urlDecode(p, keyLen);
+    valueLen = urlDecode(value, valueLen);
+    if (keyLen > 0 && !fn(p, keyLen, value, valueLen, ctx)) {
+      return false;
+    }
+    if (!end) {
+      break;
+    }
+    p = end + 1;
+  }
+  return true;
+}
+
+int httpReadBody(httpd_req_t *req, char *buf, size_t size) {
+  if (req->content_len >= size) {
+    return -1;
+  }
+  size_t got = 0;
+  while (got < req->content_len) {
+    int n = httpd_req_recv(req, buf + got, req->content_len - got);
+    if (n == HTTPD_SOCK_ERR_TIMEOUT) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    got += n;
+  }
+  buf[got] = '\0';
+  return got;
+}
+
+esp_err_t httpHandleOptions(httpd_req_t *req) {
+  httpd_resp_set_status(req, "204 No Content");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Methods", "GET, POST, OPTIONS");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "Content-Type");
+  return httpd_resp_send(req, NULL, 0);
+}
@@ -0,0 +1,253 @@
+#include "led_pattern.h"
+#include <Arduino.h>
+#include <driver/rmt.h>
+#include <esp_rom_gpio.h>
+#include <soc/gpio_sig_map.h>
+
+// the eight 64-item rmt memory blocks are shared out between the pattern
+// pins; a channel owning n blocks borrows the memory of the next n - 1
+#define BLOCKS_PER_PIN (8 / LED_PATTERN_PINS)
+#define MAX_ITEMS (64 * BLOCKS_PER_PIN)
+#define MAX_TICKS 32767 // 15-bit duration field
+#define MAX_DIV 255
+
+struct PatternSlot {
+  int16_t pin;
+  bool installed;
+  bool loop;
+  volatile bool playing; // cleared by the tx end interrupt
+};
+
+static PatternSlot slots[LED_PATTERN_PINS];
+static bool slotsReady = false;
+
+// compile buffers, patterns are only started from the control task
+static rmt_item32_t items[MAX_ITEMS];
+static uint32_t morse[LED_PATTERN_MAX_SPANS];
+
+static rmt_channel_t channelOf(int slot) {
+  return (rmt_channel_t)(slot * BLOCKS_PER_PIN);
+}
+
+static void IRAM_ATTR onTxEnd(rmt_channel_t channel, void *arg) {
+  int slot = channel / BLOCKS_PER_PIN;
+  if (slot < LED_PATTERN_PINS && !slots[slot].loop) {
+    slots[slot].playing = false;
+  }
+}
+
+static void slotsInit() {
+  if (!slotsReady) {
+    for (int i = 0; i < LED_PATTERN_PINS; i++) {
+      slots[i].pin = -1;
+    }
+    rmt_register_tx_end_callback(onTxEnd, NULL);
+    slotsReady = true;
+  }
+}
+
+// gives the pin back to the gpio matrix so digitalWrite() drives it again
+static void releasePin(PatternSlot &s, int slot) {
+  if (s.installed) {
+    rmt_tx_stop(channelOf(slot));
+    rmt_set_tx_loop_mode(channelOf(slot), false);
+  }
+  s.playing = false;
+  if (s.pin >= 0) {
+    esp_rom_gpio_connect_out_signal(s.pin, SIG_GPIO_OUT_IDX, false, false);
+    digitalWrite(s.pin, LOW);
+    s.pin = -1;
+  }
+}
+
+// the slot already driving pin, else an idle one routed to it
+static int claimSlot(uint8_t pin) {
+  slotsInit();
+  int idle = -1;
+  for (int i = 0; i < LED_PATTERN_PINS; i++) {
+    if (slots[i].pin == pin) {
+      return i;
+    }
+    if (idle < 0 && (slots[i].pin < 0 || !slots[i].playing)) {
+      idle = i;
+    }
+  }
+  if (idle < 0) {
+    return -1;
+  }
+
+  PatternSlot &s = slots[idle];
+  releasePin(s, idle);
+  rmt_channel_t ch = channelOf(idle);
+  if (!s.installed) {
+    rmt_config_t cfg = RMT_DEFAULT_CONFIG_TX((gpio_num_t)pin, ch);
+    cfg.mem_block_num = BLOCKS_PER_PIN;
+    cfg.clk_div = 1;
+    cfg.flags = RMT_CHANNEL_FLAGS_AWARE_DFS; // 1 MHz REF_TICK source
+    cfg.tx_config.idle_output_en = true;
+    cfg.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+    if (rmt_config(&cfg) != ESP_OK || rmt_driver_install(ch, 0, 0) != ESP_OK) {
+      return -1;
+    }
+    s.installed = true;
+  } else if (rmt_set_gpio(ch, RMT_MODE_TX, (gpio_num_t)pin, false) != ESP_OK) {
+    return -1;
+  }
+  s.pin = pin;
+  return idle;
+}
+
+static uint32_t ticksFor(uint32_t us, uint32_t div) {
+  uint32_t ticks = (us + div / 2) / div;
+  return ticks ? ticks : 1; // a zero duration would end the pattern early
+}
+
+// rmt half-items needed at div us per tick, spans over MAX_TICKS split up
+static size_t halvesFor(const uint32_t *spans, size_t count, uint32_t div) {
+  size_t halves = 0;
+  for (size_t i = 0; i < count; i++) {
+    halves += (ticksFor(spans[i], div) + MAX_TICKS - 1) / MAX_TICKS;
+  }
+  return halves;
+}
+
+static void putHalf(size_t half, uint32_t level, uint32_t ticks) {
+  rmt_item32_t &item = items[half / 2];
+  if (half % 2 == 0) {
+    item.level0 = level;
+    item.duration0 = ticks;
+  } else {
+    item.level1 = level;
+    item.duration1 = ticks;
+  }
+}
+
+// fills items, returns how many are used, 0 if it cannot fit at any tick
+static size_t compile(const uint32_t *spans, size_t count, uint32_t *div) {
+  // one half stays free for the zero-length end marker
+  uint32_t d = 1;
+  while (d <= MAX_DIV && halvesFor(spans, count, d) + 1 > 2 * MAX_ITEMS) {
+    d++;
+  }
+  if (d > MAX_DIV) {
+    return 0;
+  }
+
+  memset(items, 0, sizeof(items));
+  size_t half = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t level = i % 2 == 0 ? 1 : 0;
+    for (uint32_t left = ticksFor(spans[i], d); left > 0;) {
+      uint32_t n = left < MAX_TICKS ? left : MAX_TICKS;
+      putHalf(half++, level, n);
+      left -= n;
+    }
+  }
+  putHalf(half++, 0, 0);
+  *div = d;
+  return (half + 1) / 2;
+}
+
+bool ledPatternPlay(uint8_t pin, const uint32_t *durationsUs, size_t count,
+                    bool loop) {
+  if (count == 0 || count > LED_PATTERN_MAX_SPANS) {
+    return false;
+  }
+  uint32_t div;
+  size_t n = compile(durationsUs, count, &div);
+  int slot = n ? claimSlot(pin) : -1;
+  if (slot < 0) {
+    return false;
+  }
+
+  PatternSlot &s = slots[slot];
+  rmt_channel_t ch = channelOf(slot);
+  rmt_tx_stop(ch);
+  s.loop = loop;
+  rmt_set_clk_div(ch, div);
+  rmt_set_tx_loop_mode(ch, loop);
+  rmt_fill_tx_items(ch, items, n, 0);
+  s.playing = true;
+  return rmt_tx_start(ch, true) == ESP_OK;
+}
+
+// dots and dashes for A-Z, then 0-9
+static const char *const morseCodes[] = {
+    ".-",    "-...",  "-.-.",  "-..",   ".",     "..-.",  "--.",
+    "....",  "..",    ".---",  "-.-",   ".-..",  "--",    "-.",
+    "---",   ".--.",  "--.-",  ".-.",   "...",   "-",     "..-",
+    "...-",  ".--",   "-..-",  "-.--",  "--..",  "-----", ".----",
+    "..---", "...--", "....-", ".....", "-....", "--...", "---..",
+    "----.",
+};
+
+static const char *morseCode(char c) {
+  if (c >= 'a' && c <= 'z') {
+    c -= 'a' - 'A';
+  }
+  if (c >= 'A' && c <= 'Z') {
+    return morseCodes[c - 'A'];
+  }
+  if (c >= '0' && c <= '9') {
+    return morseCodes[26 + c - '0'];
+  }
+  return NULL;
+}
+
+bool ledPatternMorse(uint8_t pin, const char *text, uint32_t unitMs,
+                     bool loop) {
+  uint32_t unit = unitMs * 1000;
+  size_t n = 0;
+  uint32_t gap = 0; // units of off time owed before the next symbol
+  for (const char *p = text; *p; p++) {
+    if (*p == ' ') {
+      gap = n ? 7 : 0;
+      continue;
+    }
+    const char *code = morseCode(*p);
+    if (!code) {
+      continue;
+    }
+    for (const char *sym = code; *sym; sym++) {
+      if (n + 2 > LED_PATTERN_MAX_SPANS) {
+        return false;
+      }
+      if (n) {
+        morse[n++] = gap * unit;
+      }
+      morse[n++] = (*sym == '-' ? 3 : 1) * unit;
+      gap = 1;
+    }
+    if (gap < 3) {
+      gap = 3;
+    }
+  }
+  if (n == 0 || n == LED_PATTERN_MAX_SPANS) {
+    return false;
+  }
+  morse[n++] = 7 * unit;
+  return ledPatternPlay(pin, morse, n, loop);
+}
+
+bool ledPatternBusy(uint8_t pin) {
+  for (int i = 0; slotsReady && i < LED_PATTERN_PINS; i++) {
+    if (slots[i].pin == pin) {
+      return slots[i].playing;
+    }
+  }
+  return false;
+}
+
+void ledPatternStop(uint8_t pin) {
+  for (int i = 0; slotsReady && i < LED_PATTERN_PINS; i++) {
+    if (slots[i].pin == pin) {
+      releasePin(slots[i], i);
+    }
+  }
+}
+
+void ledPatternStopAll() {
+  for (int i = 0; slotsReady && i < LED_PATTERN_PINS; i++) {
+    releasePin(slots[i], i);
+  }
+}
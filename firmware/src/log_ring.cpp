@@ -0,0 +1,192 @@
+#include "log_ring.h"
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <freertos/semphr.h>
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0,
+              "LOG_RING_SIZE must be a power of two");
+
+struct LogEntry {
+  volatile uint32_t seq; // ring index + 1 once the writer is done
+  uint32_t timeMs;
+  uint16_t id;
+  bool hasText;
+  uint32_t args[3];
+  char text[LOG_TEXT_MAX];
+};
+
+struct LogMessage {
+  LogLevel level;
+  const char *format;
+};
+
+#define LOG_MESSAGE(id, level, format) {level, format},
+static const LogMessage messages[] = {LOG_MESSAGES(LOG_MESSAGE)};
+#undef LOG_MESSAGE
+
+// writers claim head with a cas; tail belongs to whoever holds drainLock
+static LogEntry ring[LOG_RING_SIZE];
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t dropped = 0;
+
+// drained entries for /logs, numbered from 1 since boot; drainLock too
+static LogEntry history[LOG_HISTORY];
+static uint32_t drained = 0;
+
+static SemaphoreHandle_t drainLock = NULL;
+static TaskHandle_t drainer = NULL;
+
+static void IRAM_ATTR put(LogId id, const char *text, uint32_t a, uint32_t b,
+                          uint32_t c) {
+  uint32_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+  do {
+    if (h - tail >= LOG_RING_SIZE) {
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&head, &h, h + 1, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  LogEntry &e = ring[h & (LOG_RING_SIZE - 1)];
+  e.timeMs = esp_timer_get_time() / 1000;
+  e.id = id;
+  e.args[0] = a;
+  e.args[1] = b;
+  e.args[2] = c;
+  e.hasText = text != NULL;
+  size_t i = 0;
+  for (; text && text[i] && i < LOG_TEXT_MAX - 1; i++) {
+    e.text[i] = text[i];
+  }
+  e.text[i] = '\0';
+  __atomic_store_n(&e.seq, h + 1, __ATOMIC_RELEASE);
+}
+
+void IRAM_ATTR logWrite(LogId id, uint32_t a, uint32_t b, uint32_t c) {
+  put(id, NULL, a, b, c);
+}
+
+void IRAM_ATTR logText(LogId id, const char *text, uint32_t a, uint32_t b) {
+  put(id, text ? text : "", a, b, 0);
+}
+
+// "12.345 W message"
+static size_t format(const LogEntry &e, char *out, size_t size) {
+  const LogMessage &m =
+      messages[e.id < LOG_MESSAGE_COUNT ? e.id : (uint16_t)LOG_DROPPED];
+  int n = snprintf(out, size, "%u.%03u %c ", (unsigned)(e.timeMs / 1000),
+                   (unsigned)(e.timeMs % 1000), "EWI"[m.level]);
+  if (n < 0 || (size_t)n >= size) {
+    return size - 1;
+  }
+  int body =
+      e.hasText ? snprintf(out + n, size - n, m.format, e.text, e.args[0],
+                           e.args[1])
+                : snprintf(out + n, size - n, m.format, e.args[0], e.args[1],
+                           e.args[2]);
+  n += body < 0 ? 0 : body;
+  return (size_t)n < size ? n : size - 1;
+}
+
+static void emit(const LogEntry &e) {
+  history[drained % LOG_HISTORY] = e;
+  drained++;
+#if LOG_TO_SERIAL
+  char line[LOG_LINE_MAX];
+  format(e, line, sizeof(line));
+  Serial.println(line);
+#endif
+}
+
+// caller holds drainLock
+static void drainLocked() {
+  uint32_t lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+  if (lost) {
+    LogEntry e = {};
+    e.timeMs = esp_timer_get_time() / 1000;
+    e.id = LOG_DROPPED;
+    e.args[0] = lost;
+    emit(e);
+  }
+  while (tail != head) {
+    LogEntry &slot = ring[tail & (LOG_RING_SIZE - 1)];
+    // claimed but still being written, it is next in line so wait for it
+    if (__atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE) != tail + 1) {
+      break;
+    }
+    LogEntry e = slot;
+    __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    emit(e);
+  }
+}
+
+static void drainTask(void *pvParameters) {
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+    xSemaphoreTake(drainLock, portMAX_DELAY);
+    drainLocked();
+    xSemaphoreGive(drainLock);
+  }
+}
+
+bool logInit() {
+  if (!drainLock) {
+    drainLock = xSemaphoreCreateMutex();
+  }
+  return drainLock &&
+         (drainer || xTaskCreatePinnedToCore(drainTask, "LogDrainTask",
+                                             LOG_TASK_STACK, NULL,
+                                             LOG_TASK_PRIORITY, &drainer,
+                                             LOG_TASK_CORE) == pdPASS);
+}
+
+void logFlush() {
+  if (drainLock && xSemaphoreTake(drainLock, pdMS_TO_TICKS(100)) == pdTRUE) {
+    drainLocked();
+    xSemaphoreGive(drainLock);
+  }
+#if LOG_TO_SERIAL
+  Serial.flush();
+#endif
+}
+
+esp_err_t logSend(httpd_req_t *req, uint32_t since) {
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  char buf[512];
+  size_t len = 0;
+  for (uint32_t n = since + 1;; n++) {
+    LogEntry e;
+    bool have = false;
+    if (drainLock) {
+      xSemaphoreTake(drainLock, portMAX_DELAY);
+      // older lines have been overwritten
+      if (drained > LOG_HISTORY && n <= drained - LOG_HISTORY) {
+        n = drained - LOG_HISTORY + 1;
+      }
+      have = n <= drained;
+      if (have) {
+        e = history[(n - 1) % LOG_HISTORY];
+      }
+      xSemaphoreGive(drainLock);
+    }
+    if (!have) {
+      break;
+    }
+    if (len + LOG_LINE_MAX + 12 > sizeof(buf)) {
+      if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) {
+        return ESP_FAIL;
+      }
+      len = 0;
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, "%u ", (unsigned)n);
+    len += format(e, buf + len, sizeof(buf) - len - 1);
+    buf[len++] = '\n';
+  }
+  if (len && httpd_resp_send_chunk(req, buf, len) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
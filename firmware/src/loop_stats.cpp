@@ -0,0 +1,35 @@
+#include "loop_stats.h"
+
+LoopStatsState loopStatsState;
+static uint32_t cyclesPerUs = 240;
+
+void loopStatsInit() {
+  cyclesPerUs = getCpuFrequencyMhz();
+  loopStatsSetPeriod(LOOP_PERIOD_US, LOOP_DEADLINE_SLACK_US);
+}
+
+// takes effect from the next step; the old jitter history stays
+void loopStatsSetPeriod(uint32_t periodUs, uint32_t slackUs) {
+  loopStatsState.periodCycles = periodUs * cyclesPerUs;
+  loopStatsState.slackCycles = slackUs * cyclesPerUs;
+  loopStatsState.haveLast = false;
+}
+
+uint32_t loopStatsCyclesPerUs() { return cyclesPerUs; }
+
+// retries until no update overlapped the copy; sleeping between tries lets
+// a preempted writer finish even if it shares our core
+void loopStatsSnapshot(LoopStats &out) {
+  for (;;) {
+    uint32_t before = loopStatsState.seq;
+    if (!(before & 1)) {
+      __sync_synchronize();
+      memcpy(&out, &loopStatsState.stats, sizeof(out));
+      __sync_synchronize();
+      if (loopStatsState.seq == before) {
+        return;
+      }
+    }
+    vTaskDelay(1);
+  }
+}
@@ -1,141 +1,351 @@
 #include "ai.h"
+#include "ai_gate.h"
 #include "ai_vars_gen.h"
+#include "buf_writer.h"
+#include "control_channel.h"
+#include "control_task.h"
+#include "fleet_ota.h"
+#include "http_util.h"
+#include "log_ring.h"
+#include "metrics.h"
+#include "ota.h"
+#include "ota_bench.h"
+#include "user_module.h"
+#include "var_batch.h"
+#include "var_store.h"
+#include "vm.h"
+#include "wifi_fast.h"
 #include <Arduino.h>
 #include <ArduinoOTA.h>
 #include <ESPmDNS.h>
-#include <HTTPClient.h>
-#include <Update.h>
-#include <WebServer.h>
 #include <WiFi.h>
 #include <WiFiUdp.h>
+#include <esp_ota_ops.h>
+#include <esp_timer.h>
+
+#ifndef ARDUINO_OTA_POLL_MS
+#define ARDUINO_OTA_POLL_MS 100
+#endif
 
 // wifi credentials
 const char *ssid = WIFI_SSID;
 const char *password = WIFI_PASSWORD;
 
-WebServer server(80);
-
-// Synchronization flags for OTA vs AI loop
-volatile bool isUpdating = false; 
-volatile bool aiBusy = false;     
-volatile bool shouldStop = false; 
+httpd_handle_t server = NULL;
 
 // handle root (return)
-void handleRoot() {
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  String message = "ESP32 is running!\n";
-  server.send(200, "text/plain", message);
+esp_err_t handleRoot(httpd_req_t *req) {
+  const char *build = getRunningBuildHash();
+  char body[128];
+  snprintf(body, sizeof(body), "ESP32 is running! build %.16s %s\n",
+           build ? build : "unknown", FIRMWARE_BUILD_ID);
+  return httpText(req, "200 OK", body);
 }
 
-// Execute OTA update from a URL
-String executeOTAFromURL(String url) {
-  HTTPClient http;
-  Serial.println("Starting OTA from URL: " + url);
-
-  http.begin(url);
-  int httpCode = http.GET();
-
-  if (httpCode != HTTP_CODE_OK) {
-    http.end();
-    return "Error: HTTP GET failed, code " + String(httpCode);
+// shared by /ota/update and /module/update: url and optional sha256 from
+// the query; the download runs on its own task
+static esp_err_t startJob(httpd_req_t *req, OtaJobKind kind) {
+  char query[HTTP_QUERY_MAX];
+  char url[OTA_URL_MAX];
+  char sha256[65] = "";
+  char build[65] = "";
+  if (!httpQuery(req, query, sizeof(query)) ||
+      !httpQueryArg(query, "url", url, sizeof(url))) {
+    return httpText(req, "400 Bad Request", "Missing 'url' parameter");
+  }
+  httpQueryArg(query, "sha256", sha256, sizeof(sha256));
+
+  // a rebuild of the same sources links to the same hash, nothing to flash
+  const char *running = getRunningBuildHash();
+  if (kind == OTA_JOB_FIRMWARE && running &&
+      httpQueryArg(query, "build", build, sizeof(build)) &&
+      strcasecmp(build, running) == 0) {
+    return httpText(req, "200 OK", "Already current");
   }
 
-  int contentLength = http.getSize();
-  if (contentLength <= 0) {
-    http.end();
-    return "Error: Content-Length is invalid";
+  if (isOTARunning()) {
+    return httpText(req, "409 Conflict", "OTA update already in progress");
+  }
+  if (!startOTAJob(url, sha256, kind)) {
+    return httpText(req, "400 Bad Request",
+                    kind == OTA_JOB_MODULE
+                        ? "Error: could not start module job (bad url or sha256)"
+                        : "Error: could not start OTA job (bad url or sha256)");
   }
 
-  bool canBegin = Update.begin(contentLength);
-  if (!canBegin) {
-    http.end();
-    return "Error: Not enough space for OTA";
+  char body[OTA_URL_MAX + 48];
+  snprintf(body, sizeof(body), "%s from %s...",
+           kind == OTA_JOB_MODULE ? "Loading user module" : "Starting OTA update",
+           url);
+  return httpText(req, "202 Accepted", body);
+}
+
+// handle ota update request (post /ota/update?url=...[&sha256=...][&build=...])
+// poll /ota/status for progress; build is the new image's elf sha256 and
+// skips the update if it is what is already running
+esp_err_t handleOTAUpdate(httpd_req_t *req) {
+  return startJob(req, OTA_JOB_FIRMWARE);
+}
+
+// handle user module request (post /module/update?url=...[&sha256=...])
+// only the user logic is replaced, the core keeps running without a reboot
+esp_err_t handleModuleUpdate(httpd_req_t *req) {
+  if (!userModulePartition()) {
+    return httpText(req, "501 Not Implemented",
+                    "Error: no usermod partition on this device");
   }
+  return startJob(req, OTA_JOB_MODULE);
+}
 
-  WiFiClient *stream = http.getStreamPtr();
-  size_t written = Update.writeStream(*stream);
+// handle ota status request (get /ota/status)
+esp_err_t handleOTAStatus(httpd_req_t *req) {
+  OtaStatus st;
+  getOTAStatus(st);
+
+  // http error strings come from the server, so the error is escaped
+  StackWriter<384> body;
+  body.printf("{\"state\":\"%s\",\"written\":%u,\"total\":%u,\"bps\":%u,"
+              "\"elapsed_ms\":%u,\"attempts\":%u,\"error\":\"",
+              otaStateName(st.state), (unsigned)st.bytesWritten,
+              (unsigned)st.totalBytes, (unsigned)st.bytesPerSec,
+              (unsigned)st.elapsedMs, (unsigned)st.attempts);
+  body.printJson(st.lastError).print("\"}");
+  return httpJson(req, body.c_str());
+}
 
-  if (written != contentLength) {
-    http.end();
-    return "Error: Written " + String(written) + " / " + String(contentLength);
+// handle running image request (get /ota/image)
+// the backend diffs against this hash to send a delta instead of a full image
+esp_err_t handleOTAImage(httpd_req_t *req) {
+  const uint8_t *sha = getRunningImageSha256();
+  if (!sha) {
+    return httpText(req, "500 Internal Server Error",
+                    "Error: could not hash running image");
   }
 
-  if (!Update.end()) {
-    http.end();
-    return "Error: Update.end() failed. Error #: " + String(Update.getError());
+  char hex[65];
+  for (int i = 0; i < 32; i++) {
+    snprintf(hex + 2 * i, 3, "%02x", sha[i]);
   }
 
-  if (!Update.isFinished()) {
-    http.end();
-    return "Error: Update not finished via isFinished()";
+  char body[128];
+  snprintf(body, sizeof(body), "{\"sha256\":\"%s\",\"partition\":\"%s\"}",
+           hex, esp_ota_get_running_partition()->label);
+  return httpJson(req, body);
+}
+
+// handle build request (get /ota/build), read from the mapped app
+// description so it costs no flash hashing, unlike /ota/image
+esp_err_t handleOTABuild(httpd_req_t *req) {
+  const esp_app_desc_t *desc = esp_ota_get_app_description();
+  const char *build = getRunningBuildHash();
+  char body[256];
+  snprintf(body, sizeof(body),
+           "{\"build\":\"%s\",\"label\":\"%s\",\"idf\":\"%s\","
+           "\"partition\":\"%s\",\"module\":%s}",
+           build ? build : "", FIRMWARE_BUILD_ID, desc->idf_ver,
+           esp_ota_get_running_partition()->label,
+           userModuleActive() ? "true" : "false");
+  return httpJson(req, body);
+}
+
+// handle variable updates (get /changeVar?name=value&..., or post a flat
+// json object), see varBatchHandle()
+esp_err_t handleChangeVar(httpd_req_t *req) { return varBatchHandle(req); }
+
+// handle variable schema request (get /vars): u16 generation, then the
+// live table's schema as laid out in ai_vars.h. Ids are table order, the
+// same the control channel uses, so a client can go straight to CTRL_SET.
+esp_err_t handleVars(httpd_req_t *req) {
+  const uint8_t *schema = AI_VAR_SCHEMA;
+  size_t size = sizeof(AI_VAR_SCHEMA);
+  uint8_t *copy = NULL;
+  uint8_t prefix[2];
+
+  // a module's table lives in its memory and may be unloaded mid send
+  userModuleLock();
+  uint16_t generation = userModuleGeneration();
+  if (userModuleActive()) {
+    const uint8_t *src = userModuleSchema(&size);
+    copy = (uint8_t *)malloc(size);
+    if (copy && src) {
+      memcpy(copy, src, size);
+    }
+    schema = src ? copy : NULL;
+  }
+  userModuleUnlock();
+  if (!schema) {
+    free(copy);
+    return httpText(req, "500 Internal Server Error",
+                    "Error: schema unavailable");
   }
 
-  http.end();
-  return "Success";
+  prefix[0] = generation & 0xff;
+  prefix[1] = generation >> 8;
+  httpd_resp_set_type(req, "application/octet-stream");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  esp_err_t err = httpd_resp_send_chunk(req, (const char *)prefix, 2);
+  if (err == ESP_OK) {
+    err = httpd_resp_send_chunk(req, (const char *)schema, size);
+  }
+  if (err == ESP_OK) {
+    err = httpd_resp_send_chunk(req, NULL, 0);
+  }
+  free(copy);
+  return err;
 }
 
-// handle ota update request (post /ota/update?url=...)
-void handleOTAUpdate() {
-  server.sendHeader("Access-Control-Allow-Origin", "*");
+// handle vm program upload (post /vm/load[?persist=1], body is an image
+// from backend/vm_asm.py). The control task swaps it in on its next tick;
+// persist also keeps it across reboots.
+esp_err_t handleVmLoad(httpd_req_t *req) {
+  char query[HTTP_QUERY_MAX];
+  char persist[4] = "";
+  if (httpQuery(req, query, sizeof(query))) {
+    httpQueryArg(query, "persist", persist, sizeof(persist));
+  }
+  if (req->content_len == 0) {
+    return httpText(req, "400 Bad Request", "Error: empty program");
+  }
 
-  if (!server.hasArg("url")) {
-    server.send(400, "text/plain", "Missing 'url' parameter");
-    return;
+  // read straight into the idle program slot, no copy
+  int len = httpReadBody(req, (char *)vmLoadBuffer(), VM_MAX_IMAGE + 1);
+  if (len < 0) {
+    return httpText(req, "400 Bad Request", "Error: program too large");
   }
+  StackWriter<64> error;
+  if (!vmLoadCommit(len, persist[0] == '1', error)) {
+    char body[80];
+    snprintf(body, sizeof(body), "Error: %s", error.c_str());
+    return httpText(req, "400 Bad Request", body);
+  }
+  return httpText(req, "200 OK", "Program loaded");
+}
 
-  String url = server.arg("url");
-  server.send(200, "text/plain", "Starting OTA update from " + url + "...");
+// handle vm stop (post /vm/stop), also forgets a persisted program
+esp_err_t handleVmStop(httpd_req_t *req) {
+  StackWriter<8> error;
+  vmLoadBuffer();
+  vmLoadCommit(0, true, error);
+  return httpText(req, "200 OK", "VM stopped");
+}
 
-  // 1. tell ai to stop
-  isUpdating = true;
-  shouldStop = true;
-  Serial.println("Waiting for AI loop to stop...");
+// handle vm status request (get /vm/status)
+esp_err_t handleVmStatus(httpd_req_t *req) {
+  VmStatus st;
+  vmGetStatus(st);
+  char body[160];
+  snprintf(body, sizeof(body),
+           "{\"loaded\":%s,\"halted\":%s,\"words\":%u,\"vars\":%u,"
+           "\"pc\":%u,\"ticks\":%u,\"error\":\"%s\"}",
+           st.loaded ? "true" : "false", st.halted ? "true" : "false",
+           (unsigned)st.codeWords, (unsigned)st.varCount, (unsigned)st.pc,
+           (unsigned)st.ticks, st.error);
+  return httpJson(req, body);
+}
+
+// handle metrics request (get /metrics), prometheus text format
+esp_err_t handleMetrics(httpd_req_t *req) { return metricsSend(req); }
 
-  // 2. wait for ai to finish current step (max 10s)
-  unsigned long startWait = millis();
-  while (aiBusy && (millis() - startWait < 10000)) {
-    delay(10);
+// handle log request (get /logs[?since=n]), one numbered line per entry;
+// pass the last number seen to get only what is new
+esp_err_t handleLogs(httpd_req_t *req) {
+  char query[HTTP_QUERY_MAX];
+  char since[12] = "";
+  if (httpQuery(req, query, sizeof(query))) {
+    httpQueryArg(query, "since", since, sizeof(since));
   }
+  return logSend(req, strtoul(since, NULL, 10));
+}
 
-  if (aiBusy) {
-    Serial.println("Warning: AI loop did not stop in time. Proceeding anyway...");
-  } else {
-    Serial.println("AI loop stopped. Proceeding with OTA...");
+// handle benchmark request (post /bench?start=1[&url=...][&bytes=n][&sizes=a,b])
+// without a url only flash is measured; get /bench for the report
+esp_err_t handleBench(httpd_req_t *req) {
+  char query[HTTP_QUERY_MAX];
+  char start[4] = "";
+  if (!httpQuery(req, query, sizeof(query)) ||
+      !httpQueryArg(query, "start", start, sizeof(start))) {
+    return otaBenchSend(req);
   }
 
-  delay(100);
+  char url[OTA_URL_MAX];
+  char bytes[12] = "";
+  char sizes[48] = "";
+  bool hasUrl = httpQueryArg(query, "url", url, sizeof(url));
+  httpQueryArg(query, "bytes", bytes, sizeof(bytes));
+  httpQueryArg(query, "sizes", sizes, sizeof(sizes));
+
+  if (isOTARunning() || otaBenchRunning()) {
+    return httpText(req, "409 Conflict", "OTA update already in progress");
+  }
+  if (!otaBenchStart(hasUrl ? url : NULL, strtoul(bytes, NULL, 10), sizes)) {
+    return httpText(req, "400 Bad Request",
+                    "Error: could not start benchmark (bad url or sizes)");
+  }
+  return httpText(req, "202 Accepted",
+                  "Benchmark started, poll /bench for the report");
+}
 
-  // 4. run update
-  String result = executeOTAFromURL(url);
+// every route answers GET and POST, as it did under WebServer
+struct Route {
+  const char *uri;
+  esp_err_t (*handler)(httpd_req_t *req);
+};
+
+static const Route routes[] = {
+    {"/", handleRoot},
+    {"/ota/update", handleOTAUpdate},
+    {"/ota/status", handleOTAStatus},
+    {"/ota/image", handleOTAImage},
+    {"/ota/build", handleOTABuild},
+    {"/changeVar", handleChangeVar},
+    {"/vars", handleVars},
+    {"/module/update", handleModuleUpdate},
+    {"/metrics", handleMetrics},
+    {"/logs", handleLogs},
+    {"/bench", handleBench},
+    {"/vm/load", handleVmLoad},
+    {"/vm/stop", handleVmStop},
+    {"/vm/status", handleVmStatus},
+};
+#define ROUTE_COUNT (sizeof(routes) / sizeof(routes[0]))
+
+static int routeMetric[ROUTE_COUNT];
+
+// every handler runs through here so requests are counted and timed
+static esp_err_t dispatch(httpd_req_t *req) {
+  size_t i = (const Route *)req->user_ctx - routes;
+  int64_t start = esp_timer_get_time();
+  esp_err_t err = routes[i].handler(req);
+  metricsRecordRequest(routeMetric[i], esp_timer_get_time() - start,
+                       err == ESP_OK);
+  return err;
+}
 
-  if (result == "Success") {
-    Serial.println("OTA Success! Rebooting...");
-    ESP.restart();
-  } else {
-    Serial.println("OTA Failed: " + result);
-    isUpdating = false;
-    shouldStop = false;
-  }
-}
-
-// Handle variable changes dynamically via query params
-void handleChangeVar() {
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  String response = "Update status:\n";
-  
-  for (int i = 0; i < server.args(); i++) {
-    String name = server.argName(i);
-    String value = server.arg(i);
-    
-    if (updateVariableGeneric(name, value)) {
-      response += " - " + name + " updated successfully\n";
-    } else {
-      response += " - " + name + " FAILED (not found or type mismatch)\n";
-    }
+// event driven: the server task sleeps in select() until a socket has work
+bool startHttpServer() {
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.stack_size = HTTP_SERVER_STACK;
+  config.task_priority = HTTP_SERVER_PRIORITY;
+  config.core_id = HTTP_SERVER_CORE;
+  config.max_open_sockets = HTTP_MAX_SOCKETS;
+  config.max_uri_handlers = HTTP_MAX_HANDLERS;
+  config.lru_purge_enable = true;
+  config.uri_match_fn = httpd_uri_match_wildcard;
+  if (httpd_start(&server, &config) != ESP_OK) {
+    return false;
   }
 
-  ai_test_setup();
-  server.send(200, "text/plain", response);
+  for (size_t i = 0; i < ROUTE_COUNT; i++) {
+    const Route &r = routes[i];
+    routeMetric[i] = metricsAddRoute(r.uri);
+    httpd_uri_t get = {r.uri, HTTP_GET, dispatch, (void *)&r};
+    httpd_uri_t post = {r.uri, HTTP_POST, dispatch, (void *)&r};
+    httpd_register_uri_handler(server, &get);
+    httpd_register_uri_handler(server, &post);
+  }
+  httpd_uri_t options = {"/*", HTTP_OPTIONS, httpHandleOptions, NULL};
+  httpd_register_uri_handler(server, &options);
+  return true;
 }
 
 void setupOTA() {
@@ -143,49 +353,75 @@ void setupOTA() {
   ArduinoOTA.begin();
 }
 
-void webServerTask(void *pvParameters) {
+// espota from the IDE is the one legacy client left that needs polling, a
+// slow poll is enough for it, and for handing a reused lease back to DHCP
+void arduinoOTATask(void *pvParameters) {
   for (;;) {
-    server.handleClient();
     ArduinoOTA.handle();
-    vTaskDelay(pdMS_TO_TICKS(1));
+    wifiFastPoll();
+    vTaskDelay(pdMS_TO_TICKS(ARDUINO_OTA_POLL_MS));
   }
 }
 
 void setup() {
   Serial.begin(115200);
-
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, password);
-
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
+  logInit();
+  aiGateInit();
+  varBatchInit();
+  varStoreInit();
+  metricsInit();
+
+  // association runs in the background while the rest comes up; the
+  // server and control channel listen on any address, so they are ready
+  // the moment an ip is assigned
+  wifiFastBegin(ssid, password);
+
+  // a stored user module replaces the linked-in ai code; either way the
+  // saved GUI state is back before setup runs
+  StackWriter<96> moduleError;
+  if (userModuleLoad(moduleError)) {
+    Serial.println("User module loaded");
+    varStoreRestore();
+  } else {
+    Serial.printf("No user module (%s), using built-in AI code\n",
+                  moduleError.c_str());
+    varStoreRestore();
+    ai_test_setup();
   }
+  vmLoadStored();
 
-  Serial.println("\nWiFi connected! IP: " + WiFi.localIP().toString());
-
-  setupOTA();
-  ai_test_setup();
+  if (startHttpServer()) {
+    Serial.println("HTTP server started");
+  }
 
-  server.on("/", handleRoot);
-  server.on("/ota/update", HTTP_POST, handleOTAUpdate);
-  server.on("/ota/update", HTTP_GET, handleOTAUpdate);
-  server.on("/changeVar", HTTP_GET, handleChangeVar);
+  if (startControlChannel()) {
+    Serial.printf("Control channel on UDP %d\n", CTRL_PORT);
+  }
 
-  server.enableCORS(true);
-  server.begin();
-  Serial.println("HTTP server started"); 
+  if (startControlTask()) {
+    Serial.printf("Control task at %d ms on core %d\n", CONTROL_TASK_PERIOD_MS,
+                  CONTROL_TASK_CORE);
+  } else {
+    Serial.println("Error: could not start control task");
+  }
 
-  xTaskCreatePinnedToCore(webServerTask, "WebServerTask", 4096, NULL, 1, NULL, 0);
-}
+  wifiFastWait();
+  const WifiBootInfo &boot = wifiBootInfo();
+  Serial.printf("WiFi connected! IP: %s (%u ms%s%s)\n",
+                WiFi.localIP().toString().c_str(),
+                (unsigned)(boot.connectUs / 1000),
+                boot.cachedAp ? ", cached AP" : "",
+                boot.leaseReused ? ", reused lease" : "");
 
-void loop() {
-  if (isUpdating) {
-    delay(100);
-    return;
+  if (startFleetOta()) {
+    Serial.printf("Fleet OTA on %s:%d\n", FLEET_GROUP, FLEET_PORT);
   }
 
-  aiBusy = true;
-  ai_test_loop();
-  aiBusy = false;
+  // mdns wants the interface up
+  setupOTA();
+  xTaskCreatePinnedToCore(arduinoOTATask, "ArduinoOTATask", 4096, NULL, 1, NULL, 0);
 }
+
+// the ai steps run on the fixed-rate control task, nothing is left for the
+// arduino loop task to do
+void loop() { vTaskDelete(NULL); }
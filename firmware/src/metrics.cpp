@@ -0,0 +1,331 @@
+#include "metrics.h"
+#include "adc_stream.h"
+#include "buf_writer.h"
+#include "log_ring.h"
+#include "loop_stats.h"
+#include "wifi_fast.h"
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+// request latency buckets in microseconds, the last bucket is +Inf
+static const uint32_t latencyBounds[] = {1000, 5000, 20000, 100000, 500000,
+                                         2000000};
+#define LATENCY_BUCKETS (sizeof(latencyBounds) / sizeof(latencyBounds[0]) + 1)
+
+struct RouteStats {
+  const char *uri;
+  uint32_t count;
+  uint32_t errors;
+  uint64_t totalUs;
+  uint32_t buckets[LATENCY_BUCKETS];
+};
+
+static RouteStats routeStats[METRICS_MAX_ROUTES];
+static int routeCount = 0;
+static int64_t firstRequestUs = 0; // boot to the first answered request
+
+// written from the wifi event task, read by the scrape
+static volatile uint32_t wifiConnects = 0;
+static volatile uint32_t wifiDisconnects = 0;
+
+// a snapshot is ~1 KB, kept off the server task stack
+static TaskStatus_t taskStatus[METRICS_MAX_TASKS];
+
+static void onWifiGotIp(WiFiEvent_t event, WiFiEventInfo_t info) {
+  wifiConnects++;
+}
+
+static void onWifiDisconnected(WiFiEvent_t event, WiFiEventInfo_t info) {
+  wifiDisconnects++;
+}
+
+void metricsInit() {
+  WiFi.onEvent(onWifiGotIp, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  WiFi.onEvent(onWifiDisconnected, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+}
+
+int metricsAddRoute(const char *uri) {
+  if (routeCount == METRICS_MAX_ROUTES) {
+    return -1;
+  }
+  routeStats[routeCount].uri = uri;
+  return routeCount++;
+}
+
+void metricsRecordRequest(int route, uint32_t elapsedUs, bool ok) {
+  if (route < 0 || route >= routeCount) {
+    return;
+  }
+  if (firstRequestUs == 0) {
+    firstRequestUs = esp_timer_get_time();
+    logWrite(LOG_FIRST_REQUEST, firstRequestUs / 1000);
+  }
+  RouteStats &s = routeStats[route];
+  s.count++;
+  s.totalUs += elapsedUs;
+  if (!ok) {
+    s.errors++;
+  }
+  size_t b = 0;
+  while (b < LATENCY_BUCKETS - 1 && elapsedUs > latencyBounds[b]) {
+    b++;
+  }
+  s.buckets[b]++;
+}
+
+// collects lines into a fixed buffer and sends it as one chunk whenever the
+// next line might not fit, so a scrape never allocates
+class ChunkOut {
+public:
+  explicit ChunkOut(httpd_req_t *req) : req(req), failed(false) {}
+
+  void line(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char tmp[160];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, args);
+    va_end(args);
+    if (n < 0) {
+      return;
+    }
+    if ((size_t)n >= sizeof(tmp)) {
+      n = sizeof(tmp) - 1;
+    }
+    if (buf.length() + n + 1 >= METRICS_CHUNK) {
+      flush();
+    }
+    buf.write(tmp, n).write("\n", 1);
+  }
+
+  esp_err_t finish() {
+    flush();
+    if (!failed && httpd_resp_send_chunk(req, NULL, 0) != ESP_OK) {
+      failed = true;
+    }
+    return failed ? ESP_FAIL : ESP_OK;
+  }
+
+private:
+  void flush() {
+    if (!failed && buf.length() > 0 &&
+        httpd_resp_send_chunk(req, buf.c_str(), buf.length()) != ESP_OK) {
+      failed = true;
+    }
+    buf.clear();
+  }
+
+  httpd_req_t *req;
+  StackWriter<METRICS_CHUNK> buf;
+  bool failed;
+};
+
+static void heapMetrics(ChunkOut &out) {
+  static const struct {
+    const char *name;
+    uint32_t caps;
+  } heaps[] = {
+      {"8bit", MALLOC_CAP_8BIT},
+      {"exec", MALLOC_CAP_EXEC}, // what a user module has to fit into
+  };
+
+  out.line("# TYPE esp_heap_free_bytes gauge");
+  for (const auto &h : heaps) {
+    out.line("esp_heap_free_bytes{caps=\"%s\"} %u", h.name,
+             (unsigned)heap_caps_get_free_size(h.caps));
+  }
+  out.line("# TYPE esp_heap_largest_free_block_bytes gauge");
+  for (const auto &h : heaps) {
+    out.line("esp_heap_largest_free_block_bytes{caps=\"%s\"} %u", h.name,
+             (unsigned)heap_caps_get_largest_free_block(h.caps));
+  }
+  out.line("# TYPE esp_heap_min_free_bytes gauge");
+  for (const auto &h : heaps) {
+    out.line("esp_heap_min_free_bytes{caps=\"%s\"} %u", h.name,
+             (unsigned)heap_caps_get_minimum_free_size(h.caps));
+  }
+}
+
+static void taskMetrics(ChunkOut &out) {
+  out.line("# TYPE esp_tasks gauge");
+  out.line("esp_tasks %u", (unsigned)uxTaskGetNumberOfTasks());
+
+  // returns 0 when there are more tasks than slots, then only the count
+  // above is reported
+  uint32_t totalRuntime = 0;
+  UBaseType_t n =
+      uxTaskGetSystemState(taskStatus, METRICS_MAX_TASKS, &totalRuntime);
+
+  // high water mark is in bytes on esp32 (StackType_t is a byte)
+  out.line("# TYPE esp_task_stack_free_min_bytes gauge");
+  for (UBaseType_t i = 0; i < n; i++) {
+    out.line("esp_task_stack_free_min_bytes{task=\"%s\"} %u",
+             taskStatus[i].pcTaskName,
+             (unsigned)taskStatus[i].usStackHighWaterMark);
+  }
+
+  // the stock arduino-esp32 core is built without freertos run time stats,
+  // so the per task cpu series below need a core with
+  // CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS (see platformio.ini.example);
+  // this gauge tells a scraper which build it is looking at
+  out.line("# TYPE esp_task_runtime_stats_enabled gauge");
+  out.line("esp_task_runtime_stats_enabled %d",
+           configGENERATE_RUN_TIME_STATS ? 1 : 0);
+
+#if configGENERATE_RUN_TIME_STATS
+  // the run time counter is the esp_timer microsecond clock, so the share is
+  // of one core since boot; it wraps after ~71 minutes like the counter
+  out.line("# TYPE esp_task_runtime_seconds_total counter");
+  for (UBaseType_t i = 0; i < n; i++) {
+    out.line("esp_task_runtime_seconds_total{task=\"%s\"} %.3f",
+             taskStatus[i].pcTaskName,
+             taskStatus[i].ulRunTimeCounter / 1000000.0);
+  }
+  if (totalRuntime > 0) {
+    out.line("# TYPE esp_task_cpu_ratio gauge");
+    for (UBaseType_t i = 0; i < n; i++) {
+      out.line("esp_task_cpu_ratio{task=\"%s\"} %.4f",
+               taskStatus[i].pcTaskName,
+               (double)taskStatus[i].ulRunTimeCounter / totalRuntime);
+    }
+  }
+#endif
+}
+
+static void wifiMetrics(ChunkOut &out) {
+  bool connected = WiFi.status() == WL_CONNECTED;
+  out.line("# TYPE esp_wifi_connected gauge");
+  out.line("esp_wifi_connected %d", connected ? 1 : 0);
+  if (connected) {
+    out.line("# TYPE esp_wifi_rssi_dbm gauge");
+    out.line("esp_wifi_rssi_dbm %d", (int)WiFi.RSSI());
+  }
+  // the first connect at boot is not a reconnect
+  uint32_t connects = wifiConnects;
+  out.line("# TYPE esp_wifi_reconnects_total counter");
+  out.line("esp_wifi_reconnects_total %u",
+           (unsigned)(connects > 0 ? connects - 1 : 0));
+  out.line("# TYPE esp_wifi_disconnects_total counter");
+  out.line("esp_wifi_disconnects_total %u", (unsigned)wifiDisconnects);
+}
+
+// times are from the esp_timer epoch, so the bootloader is not included
+static void bootMetrics(ChunkOut &out) {
+  const WifiBootInfo &boot = wifiBootInfo();
+  out.line("# TYPE esp_boot_wifi_cached_ap gauge");
+  out.line("esp_boot_wifi_cached_ap %d", boot.cachedAp ? 1 : 0);
+  out.line("# TYPE esp_boot_wifi_lease_reused gauge");
+  out.line("esp_boot_wifi_lease_reused %d", boot.leaseReused ? 1 : 0);
+  out.line("# TYPE esp_boot_wifi_static_ip gauge");
+  out.line("esp_boot_wifi_static_ip %d", boot.staticIp ? 1 : 0);
+  if (boot.connectUs) {
+    out.line("# TYPE esp_boot_wifi_connected_seconds gauge");
+    out.line("esp_boot_wifi_connected_seconds %.3f", boot.connectUs / 1000000.0);
+  }
+  if (firstRequestUs) {
+    out.line("# TYPE esp_boot_first_request_seconds gauge");
+    out.line("esp_boot_first_request_seconds %.3f", firstRequestUs / 1000000.0);
+  }
+}
+
+static void requestMetrics(ChunkOut &out) {
+  out.line("# TYPE esp_http_request_errors_total counter");
+  for (int r = 0; r < routeCount; r++) {
+    out.line("esp_http_request_errors_total{uri=\"%s\"} %u",
+             routeStats[r].uri, (unsigned)routeStats[r].errors);
+  }
+
+  out.line("# TYPE esp_http_request_duration_seconds histogram");
+  for (int r = 0; r < routeCount; r++) {
+    const RouteStats &s = routeStats[r];
+    uint32_t cumulative = 0;
+    for (size_t b = 0; b < LATENCY_BUCKETS - 1; b++) {
+      cumulative += s.buckets[b];
+      out.line("esp_http_request_duration_seconds_bucket{uri=\"%s\",le=\"%g\"} "
+               "%u",
+               s.uri, latencyBounds[b] / 1000000.0, (unsigned)cumulative);
+    }
+    out.line("esp_http_request_duration_seconds_bucket{uri=\"%s\",le=\"+Inf\"} "
+             "%u",
+             s.uri, (unsigned)s.count);
+    out.line("esp_http_request_duration_seconds_sum{uri=\"%s\"} %.6f", s.uri,
+             s.totalUs / 1000000.0);
+    out.line("esp_http_request_duration_seconds_count{uri=\"%s\"} %u", s.uri,
+             (unsigned)s.count);
+  }
+}
+
+// buckets below 2^LOOP_FIRST_BUCKET cycles (~4 us) fold into the first line
+#define LOOP_FIRST_BUCKET 10
+
+static void loopHistogram(ChunkOut &out, const char *name,
+                          const uint32_t *buckets, uint32_t count,
+                          uint64_t totalCycles, double cyclesPerSec) {
+  out.line("# TYPE %s histogram", name);
+  uint32_t cumulative = 0;
+  for (int b = 0; b < LOOP_STATS_BUCKETS; b++) {
+    cumulative += buckets[b];
+    if (b >= LOOP_FIRST_BUCKET) {
+      out.line("%s_bucket{le=\"%g\"} %u", name, (double)(1ull << b) / cyclesPerSec,
+               (unsigned)cumulative);
+    }
+  }
+  out.line("%s_bucket{le=\"+Inf\"} %u", name, (unsigned)count);
+  out.line("%s_sum %.6f", name, totalCycles / cyclesPerSec);
+  out.line("%s_count %u", name, (unsigned)count);
+}
+
+static void loopMetrics(ChunkOut &out) {
+  LoopStats st;
+  loopStatsSnapshot(st);
+  double cyclesPerSec = loopStatsCyclesPerUs() * 1000000.0;
+
+  loopHistogram(out, "esp_loop_step_seconds", st.stepBuckets, st.steps,
+                st.totalCycles, cyclesPerSec);
+  // one jitter sample per step after the first since boot or a pause
+  uint32_t jitterCount = 0;
+  for (int b = 0; b < LOOP_STATS_BUCKETS; b++) {
+    jitterCount += st.jitterBuckets[b];
+  }
+  loopHistogram(out, "esp_loop_jitter_seconds", st.jitterBuckets, jitterCount,
+                st.totalJitterCycles, cyclesPerSec);
+
+  out.line("# TYPE esp_loop_step_max_seconds gauge");
+  out.line("esp_loop_step_max_seconds %.6f", st.maxCycles / cyclesPerSec);
+  out.line("# TYPE esp_loop_jitter_max_seconds gauge");
+  out.line("esp_loop_jitter_max_seconds %.6f", st.maxJitterCycles / cyclesPerSec);
+  out.line("# TYPE esp_loop_deadline_misses_total counter");
+  out.line("esp_loop_deadline_misses_total %u", (unsigned)st.misses);
+}
+
+static void adcMetrics(ChunkOut &out) {
+  AdcStreamStats st;
+  adcStreamGetStats(st);
+  out.line("# TYPE esp_adc_stream_running gauge");
+  out.line("esp_adc_stream_running %d", st.running ? 1 : 0);
+  out.line("# TYPE esp_adc_stream_samples_total counter");
+  out.line("esp_adc_stream_samples_total %u", (unsigned)st.samples);
+  out.line("# TYPE esp_adc_stream_dropped_total counter");
+  out.line("esp_adc_stream_dropped_total{ring=\"read\"} %u",
+           (unsigned)st.readDropped);
+  out.line("esp_adc_stream_dropped_total{ring=\"export\"} %u",
+           (unsigned)st.sentDropped);
+}
+
+esp_err_t metricsSend(httpd_req_t *req) {
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  ChunkOut out(req);
+  out.line("# TYPE esp_uptime_seconds gauge");
+  out.line("esp_uptime_seconds %.3f", esp_timer_get_time() / 1000000.0);
+  heapMetrics(out);
+  taskMetrics(out);
+  wifiMetrics(out);
+  bootMetrics(out);
+  loopMetrics(out);
+  adcMetrics(out);
+  requestMetrics(out);
+  return out.finish();
+}
@@ -0,0 +1,497 @@
+#include "ota.h"
+#include "ai_gate.h"
+#include "buf_writer.h"
+#include "log_ring.h"
+#include "ota_inflate.h"
+#include "ota_patch.h"
+#include "ota_pipe.h"
+#include "user_module.h"
+#include "var_store.h"
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <Update.h>
+#include <esp_ota_ops.h>
+
+static portMUX_TYPE statusMux = portMUX_INITIALIZER_UNLOCKED;
+static OtaStatus status = {OTA_IDLE, 0, 0, 0, 0, 0, ""};
+static uint32_t jobStartMs = 0;
+static uint32_t downloadStartMs = 0;
+static uint32_t downloadEndMs = 0;
+static volatile bool jobRunning = false;
+
+// job arguments, only written while no job is running
+static char jobUrl[OTA_URL_MAX];
+static uint8_t jobHash[32];
+static bool jobHasHash = false;
+static OtaJobKind jobKind = OTA_JOB_FIRMWARE;
+
+static void setState(OtaState state) {
+  portENTER_CRITICAL(&statusMux);
+  status.state = state;
+  portEXIT_CRITICAL(&statusMux);
+}
+
+static void setError(const char *error) {
+  portENTER_CRITICAL(&statusMux);
+  strncpy(status.lastError, error, sizeof(status.lastError) - 1);
+  status.lastError[sizeof(status.lastError) - 1] = '\0';
+  portEXIT_CRITICAL(&statusMux);
+}
+
+static void onProgress(size_t done, size_t total) {
+  portENTER_CRITICAL(&statusMux);
+  status.bytesWritten = done;
+  status.totalBytes = total;
+  portEXIT_CRITICAL(&statusMux);
+}
+
+static uint8_t runningSha[32];
+static bool runningShaValid = false;
+
+const uint8_t *getRunningImageSha256() {
+  // hashing the app image reads all of it, so do it once
+  if (!runningShaValid) {
+    runningShaValid =
+        esp_partition_get_sha256(esp_ota_get_running_partition(), runningSha) ==
+        ESP_OK;
+  }
+  return runningShaValid ? runningSha : NULL;
+}
+
+const char *getRunningBuildHash() {
+  static char hex[65] = "";
+  if (!hex[0]) {
+    esp_ota_get_app_elf_sha256(hex, sizeof(hex));
+  }
+  // left zeroed when the image was made without --elf-sha256-offset
+  return hex[0] && strspn(hex, "0") != strlen(hex) ? hex : NULL;
+}
+
+// pipeline progress is relative to the current attempt
+static size_t progressBase = 0;
+
+static void onPipeProgress(size_t done, size_t total) {
+  onProgress(progressBase + done, progressBase + total);
+}
+
+static bool parseSha256(const char *hex, uint8_t out[32]) {
+  if (strlen(hex) != 64) {
+    return false;
+  }
+  for (int i = 0; i < 32; i++) {
+    char pair[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+    char *end;
+    out[i] = (uint8_t)strtoul(pair, &end, 16);
+    if (*end != '\0') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// fetch `url` into `image`, resuming short reads with Range requests; the
+// sink chain stays open across attempts so decoder state carries over.
+// A download longer than `capacity` is refused before the first byte.
+// HTTPClient still allocates internally, but nothing here builds Strings.
+static bool downloadToSink(const char *url, InflateSink &image,
+                           size_t capacity, size_t &imageLength,
+                           BufWriter &err) {
+  imageLength = 0;
+  bool done = false;
+  size_t offset = 0; // bytes committed so far, where the next attempt resumes
+  String validator;  // ETag / Last-Modified of the first response
+  err.clear();
+  err.print("no attempt made");
+
+  for (int attempt = 1; attempt <= OTA_MAX_ATTEMPTS && !done; attempt++) {
+    if (attempt > 1) {
+      logWrite(LOG_OTA_RESUME, offset, attempt);
+      vTaskDelay(pdMS_TO_TICKS(OTA_RETRY_DELAY_MS * (attempt - 1)));
+    }
+
+    portENTER_CRITICAL(&statusMux);
+    status.attempts = attempt;
+    portEXIT_CRITICAL(&statusMux);
+
+    HTTPClient http;
+    http.begin(url);
+    const char *headerKeys[] = {"Content-Type", "Content-Encoding",
+                                "Content-Range", "ETag", "Last-Modified"};
+    http.collectHeaders(headerKeys, 5);
+    if (offset > 0) {
+      char range[32];
+      snprintf(range, sizeof(range), "bytes=%u-", (unsigned)offset);
+      http.addHeader("Range", range);
+      if (validator.length() > 0) {
+        // full 200 instead of 206 if the image changed in between
+        http.addHeader("If-Range", validator);
+      }
+    }
+    int httpCode = http.GET();
+
+    if (offset == 0 && httpCode == HTTP_CODE_OK) {
+      int contentLength = http.getSize();
+      if (contentLength <= 0) {
+        http.end();
+        err.clear();
+        err.print("Content-Length is invalid");
+        return false;
+      }
+      // compressed images only grow, so this holds for them too
+      if ((size_t)contentLength > capacity) {
+        http.end();
+        err.clear();
+        err.printf("image is %u bytes, the partition holds %u",
+                   (unsigned)contentLength, (unsigned)capacity);
+        return false;
+      }
+      imageLength = contentLength;
+      validator = http.header("ETag");
+      if (validator.length() == 0) {
+        validator = http.header("Last-Modified");
+      }
+
+      // compressed images are picked by header, anything else is sniffed by
+      // magic; the inflated size is unknown until the gzip trailer arrives
+      if (http.header("Content-Encoding").indexOf("gzip") >= 0 ||
+          http.header("Content-Type").indexOf("gzip") >= 0) {
+        image.requireGzip();
+      }
+
+      onProgress(0, imageLength);
+      downloadStartMs = millis();
+    } else if (offset > 0 && httpCode == HTTP_CODE_PARTIAL_CONTENT) {
+      String range = http.header("Content-Range");
+      char expect[32];
+      snprintf(expect, sizeof(expect), "bytes %u-", (unsigned)offset);
+      if (strncmp(range.c_str(), expect, strlen(expect)) != 0) {
+        http.end();
+        err.clear();
+        err.printf("unexpected Content-Range '%s'", range.c_str());
+        break;
+      }
+    } else if (offset > 0 && httpCode == HTTP_CODE_OK) {
+      http.end();
+      err.clear();
+      err.print("server cannot resume (no Range support or image changed)");
+      break;
+    } else {
+      http.end();
+      err.clear();
+      err.printf("HTTP GET failed, code %d", httpCode);
+      continue;
+    }
+
+    setState(OTA_DOWNLOADING);
+
+    // socket receive and flash commit overlap on two tasks
+    WiFiClient *stream = http.getStreamPtr();
+    OtaPipeline pipe;
+    progressBase = offset;
+    offset += pipe.run(*stream, imageLength - offset, image, onPipeProgress);
+    http.end();
+
+    if (pipe.finished()) {
+      done = true;
+    } else if (pipe.sinkFailed()) {
+      // flash or decoder error, a retry would fail the same way
+      err.clear();
+      err.print(pipe.error());
+      break;
+    } else {
+      err.clear();
+      err.printf("Written %u / %u (%s)", (unsigned)offset,
+                 (unsigned)imageLength, pipe.error());
+    }
+  }
+  downloadEndMs = millis();
+
+  if (!done) {
+    return false;
+  }
+  err.clear();
+  if (image.isCompressed()) {
+    logWrite(LOG_OTA_INFLATED, imageLength, image.outputBytes());
+  }
+  return true;
+}
+
+// Execute OTA update from a URL
+static bool executeOTAFromURL(const char *url, const uint8_t *expectedHash,
+                              BufWriter &err) {
+  logText(LOG_OTA_START, url);
+
+  // network -> gunzip -> delta patch -> flash, each stage passes through
+  // data that is not in its format
+  UpdateSink flash;
+  PatchSink patch(flash, esp_ota_get_running_partition(),
+                  getRunningImageSha256());
+  InflateSink image(patch);
+
+  const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+  // the flashed size is only known up front for a plain image, Update
+  // checks the rest against the partition as it is written
+  if (!target || !Update.begin(UPDATE_SIZE_UNKNOWN)) {
+    err.print("Not enough space for OTA");
+    return false;
+  }
+
+  size_t imageLength;
+  if (!downloadToSink(url, image, target->size, imageLength, err)) {
+    Update.abort();
+    return false;
+  }
+
+  setState(OTA_FINISHING);
+  if (patch.isPatch()) {
+    logWrite(LOG_OTA_PATCHED, patch.outputBytes());
+  }
+
+  if (expectedHash && memcmp(flash.digest(), expectedHash, 32) != 0) {
+    Update.abort();
+    err.print("image sha256 mismatch");
+    return false;
+  }
+
+  if (!Update.end(true)) {
+    err.printf("Update.end() failed. Error #: %u", (unsigned)Update.getError());
+    return false;
+  }
+
+  if (!Update.isFinished()) {
+    err.print("Update not finished via isFinished()");
+    return false;
+  }
+
+  // the new image carries its own ai code, a stored module would shadow it
+  userModuleErase();
+  return true;
+}
+
+// Store a user module from a URL and swap it in without rebooting
+static bool executeModuleFromURL(const char *url, const uint8_t *expectedHash,
+                                 BufWriter &err) {
+  logText(LOG_MODULE_START, url);
+
+  const esp_partition_t *part = userModulePartition();
+  if (!part) {
+    err.print("no usermod partition in the partition table");
+    return false;
+  }
+
+  // the partition is rewritten in place, drop the old module first
+  userModuleUnload();
+  PartitionSink store(part);
+  InflateSink image(store);
+
+  size_t imageLength;
+  if (!downloadToSink(url, image, part->size, imageLength, err)) {
+    userModuleErase();
+    return false;
+  }
+
+  setState(OTA_FINISHING);
+  if (expectedHash && memcmp(store.digest(), expectedHash, 32) != 0) {
+    userModuleErase();
+    err.print("module sha256 mismatch");
+    return false;
+  }
+
+  if (!userModuleLoad(err)) {
+    userModuleErase();
+    return false;
+  }
+  return true;
+}
+
+static void rebootIntoUpdate() {
+  logWrite(LOG_OTA_REBOOT);
+  // changes still inside the debounce window would be lost otherwise
+  varStoreFlush();
+  logFlush();
+  ESP.restart();
+}
+
+static void otaTask(void *pvParameters) {
+  // 1. park the ai loop, returns as soon as the current step is done
+  logWrite(LOG_OTA_PAUSING);
+  bool parked = aiGatePause();
+  logWrite(parked ? LOG_OTA_PAUSED : LOG_OTA_PAUSE_TIMEOUT);
+
+  // 2. run update
+  const uint8_t *hash = jobHasHash ? jobHash : NULL;
+  // failures are reported as "Error: <detail>"
+  char result[sizeof(status.lastError)] = "Error: ";
+  size_t prefix = strlen(result);
+  BufWriter err(result + prefix, sizeof(result) - prefix);
+  bool ok = false;
+  if (!parked) {
+    // a step may still be running, possibly out of the module text
+    err.print("ai loop did not stop in time");
+  } else {
+    ok = jobKind == OTA_JOB_MODULE ? executeModuleFromURL(jobUrl, hash, err)
+                                   : executeOTAFromURL(jobUrl, hash, err);
+  }
+
+  if (ok && jobKind == OTA_JOB_MODULE) {
+    varStoreRestore();
+    setState(OTA_SUCCESS);
+    logWrite(LOG_MODULE_LOADED);
+    aiGateResume();
+  } else if (ok) {
+    setState(OTA_SUCCESS);
+    rebootIntoUpdate();
+  } else {
+    setError(result);
+    setState(OTA_FAILED);
+    logText(LOG_OTA_FAILED, result + strlen("Error: "));
+    aiGateResume();
+  }
+
+  portENTER_CRITICAL(&statusMux);
+  status.elapsedMs = millis() - jobStartMs;
+  portEXIT_CRITICAL(&statusMux);
+
+  jobRunning = false;
+  vTaskDelete(NULL);
+}
+
+// takes the single job slot and resets the status for a new job
+static bool claimJob() {
+  portENTER_CRITICAL(&statusMux);
+  bool free = !jobRunning;
+  if (free) {
+    jobRunning = true;
+    status.state = OTA_WAITING_AI;
+    status.bytesWritten = 0;
+    status.totalBytes = 0;
+    status.bytesPerSec = 0;
+    status.elapsedMs = 0;
+    status.attempts = 0;
+    status.lastError[0] = '\0';
+  }
+  portEXIT_CRITICAL(&statusMux);
+  if (free) {
+    jobStartMs = millis();
+    downloadStartMs = 0;
+    downloadEndMs = 0;
+  }
+  return free;
+}
+
+bool startOTAJob(const char *url, const char *sha256, OtaJobKind kind) {
+  if (jobRunning || strlen(url) >= sizeof(jobUrl)) {
+    return false;
+  }
+  bool hasHash = sha256 && sha256[0];
+  uint8_t hash[32];
+  if ((hasHash && !parseSha256(sha256, hash)) || !claimJob()) {
+    return false;
+  }
+
+  jobHasHash = hasHash;
+  memcpy(jobHash, hash, sizeof(hash));
+  jobKind = kind;
+  strcpy(jobUrl, url);
+
+  if (xTaskCreatePinnedToCore(otaTask, "OTATask", OTA_TASK_STACK, NULL,
+                              OTA_TASK_PRIORITY, NULL,
+                              OTA_TASK_CORE) != pdPASS) {
+    setError("Error: could not create OTA task");
+    setState(OTA_FAILED);
+    jobRunning = false;
+    return false;
+  }
+  return true;
+}
+
+bool isOTARunning() { return jobRunning; }
+
+bool otaAcquire(uint32_t totalBytes) {
+  if (!claimJob()) {
+    return false;
+  }
+  bool parked = aiGatePause();
+  logWrite(parked ? LOG_OTA_PAUSED : LOG_OTA_PAUSE_TIMEOUT);
+  if (!parked) {
+    otaRelease(false, "ai loop did not stop in time");
+    return false;
+  }
+  portENTER_CRITICAL(&statusMux);
+  status.state = OTA_DOWNLOADING;
+  status.totalBytes = totalBytes;
+  status.attempts = 1;
+  portEXIT_CRITICAL(&statusMux);
+  downloadStartMs = millis();
+  return true;
+}
+
+void otaReportProgress(size_t done, size_t total) {
+  onProgress(done, total);
+}
+
+void otaRelease(bool ok, const char *error) {
+  downloadEndMs = millis();
+  portENTER_CRITICAL(&statusMux);
+  status.elapsedMs = downloadEndMs - jobStartMs;
+  portEXIT_CRITICAL(&statusMux);
+  if (ok) {
+    setState(OTA_SUCCESS);
+    // the new image carries its own ai code, a stored module would shadow it
+    userModuleErase();
+    rebootIntoUpdate();
+  }
+  char result[sizeof(status.lastError)];
+  snprintf(result, sizeof(result), "Error: %s", error);
+  setError(result);
+  setState(OTA_FAILED);
+  logText(LOG_OTA_FAILED, result + strlen("Error: "));
+  jobRunning = false;
+  aiGateResume();
+}
+
+bool otaReserve() {
+  portENTER_CRITICAL(&statusMux);
+  bool free = !jobRunning;
+  jobRunning = true;
+  portEXIT_CRITICAL(&statusMux);
+  return free;
+}
+
+void otaUnreserve() { jobRunning = false; }
+
+void getOTAStatus(OtaStatus &out) {
+  portENTER_CRITICAL(&statusMux);
+  out = status;
+  portEXIT_CRITICAL(&statusMux);
+
+  // elapsed/throughput are derived on read while the job is live
+  uint32_t now = millis();
+  if (jobRunning) {
+    out.elapsedMs = now - jobStartMs;
+  }
+  if (downloadStartMs != 0) {
+    uint32_t dlMs = (downloadEndMs != 0 ? downloadEndMs : now) - downloadStartMs;
+    if (dlMs > 0) {
+      out.bytesPerSec = (uint32_t)((uint64_t)out.bytesWritten * 1000 / dlMs);
+    }
+  }
+}
+
+const char *otaStateName(OtaState state) {
+  switch (state) {
+  case OTA_IDLE:
+    return "idle";
+  case OTA_WAITING_AI:
+    return "waiting_ai";
+  case OTA_DOWNLOADING:
+    return "downloading";
+  case OTA_FINISHING:
+    return "finishing";
+  case OTA_SUCCESS:
+    return "success";
+  case OTA_FAILED:
+    return "failed";
+  }
+  return "unknown";
+}
@@ -0,0 +1,354 @@
+#include "ota_bench.h"
+#include "buf_writer.h"
+#include "http_util.h"
+#include "log_ring.h"
+#include "ota.h"
+#include "ota_inflate.h"
+#include "ota_patch.h"
+#include "ota_pipe.h"
+#include "var_batch.h"
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <Update.h>
+#include <WiFi.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/semphr.h>
+
+enum BenchPhase { PHASE_IDLE, PHASE_NET, PHASE_FLASH, PHASE_FULL, PHASE_COUNT };
+
+static const char *const phaseNames[PHASE_COUNT] = {"idle", "net", "flash",
+                                                    "full"};
+static const uint32_t defaultSizes[] = {4096, 8192, 16384};
+
+struct BenchRun {
+  uint8_t phase;
+  uint32_t bufSize;
+  uint32_t bytes;   // moved, short of the target on failure
+  uint32_t setupMs; // GET until the headers were in
+  uint32_t ms;      // moving the bytes
+  char error[48];
+};
+
+struct ProbeStats {
+  uint32_t count;
+  uint32_t timeouts;
+  uint32_t maxUs;
+  uint32_t samples[OTA_BENCH_PROBE_SAMPLES]; // the first ones
+};
+
+// job arguments, only written while no bench runs
+static char benchUrl[OTA_URL_MAX];
+static bool hasUrl = false;
+static uint32_t benchBytes = OTA_BENCH_BYTES;
+static uint32_t sizes[OTA_BENCH_MAX_SIZES];
+static size_t sizeCount = 0;
+
+// results, written by the bench and probe tasks and read by /bench
+static SemaphoreHandle_t lock = NULL;
+static BenchRun runs[3 * OTA_BENCH_MAX_SIZES];
+static size_t runCount = 0;
+static ProbeStats probes[PHASE_COUNT];
+static uint32_t imageBytes = 0;
+static int8_t rssi = 0;
+static bool started = false;
+
+static volatile bool running = false;
+static volatile int phase = -1; // the probe files samples under it, -1 stops it
+static SemaphoreHandle_t probeDone = NULL;
+
+static uint32_t kibPerSec(const BenchRun &run) {
+  return run.ms ? (uint64_t)run.bytes * 1000 / 1024 / run.ms : 0;
+}
+
+// no variable can be called that, so applying the batch is a no-op
+static const char probeName[] = "~bench";
+
+static void probeTask(void *pvParameters) {
+  int at;
+  while ((at = phase) >= 0) {
+    int64_t start = esp_timer_get_time();
+    varBatchBegin();
+    if (!varBatchStage(probeName, sizeof(probeName) - 1, "", 0)) {
+      varBatchAbort(); // a writer filled the batch, try again next time
+    } else {
+      uint32_t seq = varBatchEnd(true);
+      bool applied = varBatchWait(seq, pdMS_TO_TICKS(VAR_BATCH_WAIT_MS));
+      uint32_t us = esp_timer_get_time() - start;
+
+      xSemaphoreTake(lock, portMAX_DELAY);
+      ProbeStats &p = probes[at];
+      if (!applied) {
+        p.timeouts++;
+      } else {
+        if (p.count < OTA_BENCH_PROBE_SAMPLES) {
+          p.samples[p.count] = us;
+        }
+        p.count++;
+        p.maxUs = us > p.maxUs ? us : p.maxUs;
+      }
+      xSemaphoreGive(lock);
+    }
+    vTaskDelay(pdMS_TO_TICKS(OTA_BENCH_PROBE_MS));
+  }
+  xSemaphoreGive(probeDone);
+  vTaskDelete(NULL);
+}
+
+class DiscardSink : public OtaSink {
+public:
+  bool write(const uint8_t *, size_t) override { return true; }
+};
+
+// one GET of the url through OtaPipeline, into nothing or, when full, the
+// sink chain executeOTAFromURL() uses
+static bool downloadRun(BenchRun &run, bool full, BufWriter &err) {
+  if (full && !Update.begin(UPDATE_SIZE_UNKNOWN)) {
+    err.print("Not enough space for OTA");
+    return false;
+  }
+
+  HTTPClient http;
+  http.begin(benchUrl);
+  int64_t start = esp_timer_get_time();
+  int httpCode = http.GET();
+  run.setupMs = (esp_timer_get_time() - start) / 1000;
+  int contentLength = http.getSize();
+
+  bool ok = false;
+  if (httpCode != HTTP_CODE_OK) {
+    err.printf("HTTP GET failed, code %d", httpCode);
+  } else if (contentLength <= 0) {
+    err.print("Content-Length is invalid");
+  } else {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    imageBytes = contentLength;
+    xSemaphoreGive(lock);
+    size_t total = benchBytes < (uint32_t)contentLength ? benchBytes
+                                                        : contentLength;
+    DiscardSink drop;
+    UpdateSink flash;
+    PatchSink patch(flash, esp_ota_get_running_partition(),
+                    getRunningImageSha256());
+    InflateSink image(patch);
+    OtaPipeline pipe({run.bufSize, OTA_BUF_COUNT});
+
+    start = esp_timer_get_time();
+    run.bytes = pipe.run(*http.getStreamPtr(), total,
+                         full ? (OtaSink &)image : (OtaSink &)drop);
+    run.ms = (esp_timer_get_time() - start) / 1000;
+    // a cut off image fails the decoder's finish, that is expected here
+    ok = run.bytes == total && !pipe.sinkFailed();
+    if (!ok) {
+      err.print(pipe.error());
+    }
+  }
+  http.end();
+  if (full) {
+    Update.abort();
+  }
+  return ok;
+}
+
+// random data straight into PartitionSink, a buffer per write the way the
+// ota writer task hands them over
+static bool flashRun(BenchRun &run, BufWriter &err) {
+  const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+  uint8_t *buf = (uint8_t *)malloc(run.bufSize);
+  if (!part || !buf) {
+    free(buf);
+    err.print(part ? "not enough memory for the buffer"
+                   : "no inactive app partition");
+    return false;
+  }
+  esp_fill_random(buf, run.bufSize);
+
+  PartitionSink sink(part);
+  int64_t start = esp_timer_get_time();
+  while (run.bytes < benchBytes) {
+    size_t n = benchBytes - run.bytes;
+    n = n < run.bufSize ? n : run.bufSize;
+    if (!sink.write(buf, n)) {
+      err.print(sink.error());
+      break;
+    }
+    run.bytes += n;
+  }
+  sink.finish();
+  run.ms = (esp_timer_get_time() - start) / 1000;
+  free(buf);
+  return run.bytes == benchBytes;
+}
+
+static void benchTask(void *pvParameters) {
+  vTaskDelay(pdMS_TO_TICKS(OTA_BENCH_IDLE_MS));
+
+  for (int p = PHASE_NET; p < PHASE_COUNT; p++) {
+    if (p != PHASE_FLASH && !hasUrl) {
+      continue;
+    }
+    phase = p;
+    for (size_t i = 0; i < sizeCount; i++) {
+      BenchRun run = {};
+      run.phase = p;
+      run.bufSize = sizes[i];
+      BufWriter err(run.error, sizeof(run.error));
+      bool ok = p == PHASE_FLASH ? flashRun(run, err)
+                                 : downloadRun(run, p == PHASE_FULL, err);
+      if (ok) {
+        logText(LOG_BENCH_RUN, phaseNames[p], run.bufSize, kibPerSec(run));
+      } else {
+        logText(LOG_BENCH_FAILED, run.error);
+      }
+
+      xSemaphoreTake(lock, portMAX_DELAY);
+      runs[runCount++] = run;
+      xSemaphoreGive(lock);
+    }
+  }
+
+  phase = -1;
+  xSemaphoreTake(probeDone, portMAX_DELAY);
+  running = false;
+  otaUnreserve();
+  vTaskDelete(NULL);
+}
+
+bool otaBenchStart(const char *url, uint32_t bytes, const char *sizeList) {
+  if (running || (url && strlen(url) >= sizeof(benchUrl))) {
+    return false;
+  }
+
+  uint32_t parsed[OTA_BENCH_MAX_SIZES];
+  size_t count = 0;
+  for (const char *p = sizeList; p && *p;) {
+    char *end;
+    unsigned long size = strtoul(p, &end, 10);
+    if (end == p || (*end && *end != ',') || size == 0 ||
+        size > OTA_BENCH_MAX_BUF || count == OTA_BENCH_MAX_SIZES) {
+      return false;
+    }
+    parsed[count++] = (size + OTA_SECTOR_SIZE - 1) & ~(OTA_SECTOR_SIZE - 1);
+    p = *end ? end + 1 : end;
+  }
+  if (count == 0) {
+    count = sizeof(defaultSizes) / sizeof(defaultSizes[0]);
+    memcpy(parsed, defaultSizes, sizeof(defaultSizes));
+  }
+
+  const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+  if (!part) {
+    return false;
+  }
+  if (bytes == 0) {
+    bytes = OTA_BENCH_BYTES;
+  }
+  if (bytes > part->size) {
+    bytes = part->size;
+  }
+
+  if (!lock) {
+    lock = xSemaphoreCreateMutex();
+    probeDone = xSemaphoreCreateBinary();
+  }
+  if (!lock || !probeDone || !otaReserve()) {
+    return false;
+  }
+
+  hasUrl = url != NULL;
+  strcpy(benchUrl, hasUrl ? url : "");
+  benchBytes = bytes;
+  memcpy(sizes, parsed, count * sizeof(parsed[0]));
+  sizeCount = count;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  runCount = 0;
+  memset(probes, 0, sizeof(probes));
+  imageBytes = 0;
+  rssi = WiFi.RSSI();
+  started = true;
+  xSemaphoreGive(lock);
+
+  running = true;
+  phase = PHASE_IDLE;
+  if (xTaskCreatePinnedToCore(probeTask, "BenchProbe", OTA_BENCH_PROBE_STACK,
+                              NULL, OTA_BENCH_PROBE_PRIORITY, NULL,
+                              OTA_BENCH_PROBE_CORE) != pdPASS) {
+    phase = -1;
+    running = false;
+    otaUnreserve();
+    return false;
+  }
+  if (xTaskCreatePinnedToCore(benchTask, "BenchTask", OTA_BENCH_TASK_STACK,
+                              NULL, OTA_BENCH_TASK_PRIORITY, NULL,
+                              OTA_BENCH_TASK_CORE) != pdPASS) {
+    phase = -1;
+    xSemaphoreTake(probeDone, portMAX_DELAY);
+    running = false;
+    otaUnreserve();
+    return false;
+  }
+  return true;
+}
+
+bool otaBenchRunning() { return running; }
+
+static uint32_t percentile(const uint32_t *sorted, size_t n, unsigned pct) {
+  return n ? sorted[(n - 1) * pct / 100] : 0;
+}
+
+// {"state":"done","phase":"","rssi":-58,"image":912384,"bytes":262144,
+//  "runs":[{"phase":"net","buf":4096,"bytes":262144,"setup_ms":41,
+//  "ms":380,"kib_s":673,"error":""},...],
+//  "changevar_us":{"idle":{"n":20,"p50":850,"p95":1210,"max":1900,
+//  "timeouts":0},...}}
+esp_err_t otaBenchSend(httpd_req_t *req) {
+  if (!lock) {
+    return httpJson(req, "{\"state\":\"idle\"}");
+  }
+  // only the http server task gets here
+  static char body[3072];
+  BufWriter out(body, sizeof(body));
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int at = phase;
+  out.printf("{\"state\":\"%s\",\"phase\":\"%s\",\"rssi\":%d,\"image\":%u,"
+             "\"bytes\":%u,\"runs\":[",
+             !started ? "idle" : running ? "running" : "done",
+             running && at >= 0 ? phaseNames[at] : "", rssi,
+             (unsigned)imageBytes, (unsigned)benchBytes);
+  for (size_t i = 0; i < runCount; i++) {
+    const BenchRun &r = runs[i];
+    out.printf("%s{\"phase\":\"%s\",\"buf\":%u,\"bytes\":%u,\"setup_ms\":%u,"
+               "\"ms\":%u,\"kib_s\":%u,\"error\":\"",
+               i ? "," : "", phaseNames[r.phase], (unsigned)r.bufSize,
+               (unsigned)r.bytes, (unsigned)r.setupMs, (unsigned)r.ms,
+               (unsigned)kibPerSec(r));
+    out.printJson(r.error).print("\"}");
+  }
+  out.print("],\"changevar_us\":{");
+  for (int p = 0; p < PHASE_COUNT; p++) {
+    const ProbeStats &s = probes[p];
+    uint32_t sorted[OTA_BENCH_PROBE_SAMPLES];
+    size_t n = s.count < OTA_BENCH_PROBE_SAMPLES ? s.count
+                                                 : OTA_BENCH_PROBE_SAMPLES;
+    for (size_t i = 0; i < n; i++) {
+      size_t j = i;
+      for (; j > 0 && sorted[j - 1] > s.samples[i]; j--) {
+        sorted[j] = sorted[j - 1];
+      }
+      sorted[j] = s.samples[i];
+    }
+    out.printf("%s\"%s\":{\"n\":%u,\"p50\":%u,\"p95\":%u,\"max\":%u,"
+               "\"timeouts\":%u}",
+               p ? "," : "", phaseNames[p], (unsigned)s.count,
+               (unsigned)percentile(sorted, n, 50),
+               (unsigned)percentile(sorted, n, 95), (unsigned)s.maxUs,
+               (unsigned)s.timeouts);
+  }
+  out.print("}}");
+  xSemaphoreGive(lock);
+
+  return httpJson(req, body);
+}
@@ -0,0 +1,181 @@
+#include "ota_inflate.h"
+#include <Arduino.h>
+#include <esp32/rom/miniz.h>
+#include <esp_rom_crc.h>
+
+#define GZIP_WINDOW_SIZE (1u << OTA_GZIP_WINDOW_BITS)
+
+#define GZIP_FHCRC 0x02
+#define GZIP_FEXTRA 0x04
+#define GZIP_FNAME 0x08
+#define GZIP_FCOMMENT 0x10
+
+InflateSink::InflateSink(OtaSink &inner)
+    : inner(inner), gzipRequired(false), mode(MODE_SNIFF),
+      stage(ST_HEADER), headerLen(0), extraLeft(0), extraLenBytes(0),
+      hcrcLeft(2), trailerLen(0), decomp(NULL), window(NULL), windowPos(0),
+      crc(0), outTotal(0), lastError("") {}
+
+InflateSink::~InflateSink() {
+  free(decomp);
+  free(window);
+}
+
+bool InflateSink::fail(const char *msg) {
+  lastError = msg;
+  return false;
+}
+
+const char *InflateSink::error() {
+  return lastError[0] ? lastError : inner.error();
+}
+
+// header stage that follows `from` given the gzip flags
+InflateSink::Stage InflateSink::headerStageAfter(Stage from) const {
+  uint8_t flags = header[3];
+  if (from < ST_EXTRA_LEN && (flags & GZIP_FEXTRA))
+    return ST_EXTRA_LEN;
+  if (from < ST_NAME && (flags & GZIP_FNAME))
+    return ST_NAME;
+  if (from < ST_COMMENT && (flags & GZIP_FCOMMENT))
+    return ST_COMMENT;
+  if (from < ST_HCRC && (flags & GZIP_FHCRC))
+    return ST_HCRC;
+  return ST_DEFLATE;
+}
+
+bool InflateSink::write(const uint8_t *data, size_t len) {
+  if (mode == MODE_SNIFF) {
+    if (len >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+      decomp = (tinfl_decompressor_tag *)malloc(sizeof(tinfl_decompressor));
+      window = (uint8_t *)malloc(GZIP_WINDOW_SIZE);
+      if (!decomp || !window) {
+        return fail("not enough memory for gzip window");
+      }
+      tinfl_init(decomp);
+      mode = MODE_GZIP;
+    } else if (gzipRequired) {
+      return fail("expected a gzip image");
+    } else {
+      mode = MODE_RAW;
+    }
+  }
+
+  if (mode == MODE_RAW) {
+    outTotal += len;
+    return inner.write(data, len);
+  }
+
+  while (len > 0) {
+    switch (stage) {
+    case ST_HEADER:
+      header[headerLen++] = *data++;
+      len--;
+      if (headerLen == sizeof(header)) {
+        if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8) {
+          return fail("bad gzip header");
+        }
+        stage = headerStageAfter(ST_HEADER);
+      }
+      break;
+
+    case ST_EXTRA_LEN:
+      // two byte little endian length
+      extraLeft |= (uint16_t)(*data++) << (8 * extraLenBytes++);
+      len--;
+      if (extraLenBytes == 2) {
+        stage = extraLeft ? ST_EXTRA : headerStageAfter(ST_EXTRA);
+      }
+      break;
+
+    case ST_EXTRA: {
+      size_t n = len < extraLeft ? len : extraLeft;
+      data += n;
+      len -= n;
+      extraLeft -= n;
+      if (extraLeft == 0) {
+        stage = headerStageAfter(ST_EXTRA);
+      }
+      break;
+    }
+
+    case ST_NAME:
+    case ST_COMMENT: {
+      uint8_t c = *data++;
+      len--;
+      if (c == 0) {
+        stage = headerStageAfter(stage);
+      }
+      break;
+    }
+
+    case ST_HCRC:
+      data++;
+      len--;
+      if (--hcrcLeft == 0) {
+        stage = ST_DEFLATE;
+      }
+      break;
+
+    case ST_DEFLATE: {
+      // decode into the ring window, forwarding whatever it produced
+      tinfl_status st;
+      do {
+        size_t inBytes = len;
+        size_t outBytes = GZIP_WINDOW_SIZE - windowPos;
+        st = tinfl_decompress(decomp, data, &inBytes, window,
+                              window + windowPos, &outBytes,
+                              TINFL_FLAG_HAS_MORE_INPUT);
+        data += inBytes;
+        len -= inBytes;
+
+        if (outBytes > 0) {
+          crc = esp_rom_crc32_le(crc, window + windowPos, outBytes);
+          if (!inner.write(window + windowPos, outBytes)) {
+            return false;
+          }
+          outTotal += outBytes;
+          windowPos = (windowPos + outBytes) & (GZIP_WINDOW_SIZE - 1);
+        }
+      } while (st == TINFL_STATUS_HAS_MORE_OUTPUT);
+
+      if (st == TINFL_STATUS_DONE) {
+        stage = ST_TRAILER;
+      } else if (st < 0) {
+        return fail("corrupt gzip stream");
+      } else if (len > 0) {
+        return fail("gzip decoder stalled");
+      }
+      break;
+    }
+
+    case ST_TRAILER:
+      trailer[trailerLen++] = *data++;
+      len--;
+      if (trailerLen == sizeof(trailer)) {
+        stage = ST_DONE;
+      }
+      break;
+
+    case ST_DONE:
+      return fail("trailing data after gzip stream");
+    }
+  }
+  return true;
+}
+
+bool InflateSink::finish() {
+  if (mode == MODE_GZIP) {
+    if (stage != ST_DONE) {
+      return fail("gzip stream truncated");
+    }
+    uint32_t wantCrc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) |
+                       ((uint32_t)trailer[3] << 24);
+    uint32_t wantSize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) |
+                        ((uint32_t)trailer[7] << 24);
+    if (wantCrc != crc || wantSize != (uint32_t)outTotal) {
+      return fail("gzip crc/size mismatch");
+    }
+  }
+  return inner.finish();
+}
@@ -0,0 +1,177 @@
+#include "ota_patch.h"
+#include <Arduino.h>
+
+#define PATCH_HEADER_SIZE 40
+
+static uint32_t readLE32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+PatchSink::PatchSink(OtaSink &inner, const esp_partition_t *base,
+                     const uint8_t baseSha256[32])
+    : inner(inner), base(base), baseSha(baseSha256), mode(MODE_SNIFF),
+      stage(ST_HEADER), hdrLen(0), hdrWant(PATCH_HEADER_SIZE), op(0),
+      newSize(0), left(0), oldOffset(0), outTotal(0), lastError("") {}
+
+bool PatchSink::fail(const char *msg) {
+  lastError = msg;
+  return false;
+}
+
+const char *PatchSink::error() {
+  return lastError[0] ? lastError : inner.error();
+}
+
+// arguments for the current op are in hdr
+bool PatchSink::startRecord() {
+  left = readLE32(hdr);
+  if (outTotal + left > newSize) {
+    return fail("patch record overruns image size");
+  }
+
+  if (op == OTA_PATCH_OP_ADD) {
+    oldOffset = readLE32(hdr + 4);
+    if (!base || oldOffset + left > base->size) {
+      return fail("patch reads past base partition");
+    }
+    stage = ST_ADD;
+  } else {
+    stage = ST_INSERT;
+  }
+  if (left == 0) {
+    stage = ST_OP;
+  }
+  return true;
+}
+
+bool PatchSink::write(const uint8_t *data, size_t len) {
+  if (mode == MODE_SNIFF) {
+    // the magic can straddle writes, so collect it first
+    while (len > 0 && hdrLen < 4) {
+      hdr[hdrLen++] = *data++;
+      len--;
+    }
+    if (hdrLen < 4) {
+      return true;
+    }
+    if (memcmp(hdr, OTA_PATCH_MAGIC, 4) != 0) {
+      mode = MODE_RAW;
+      outTotal += hdrLen;
+      if (!inner.write(hdr, hdrLen)) {
+        return false;
+      }
+    } else {
+      mode = MODE_PATCH;
+    }
+  }
+
+  if (mode == MODE_RAW) {
+    outTotal += len;
+    return len == 0 || inner.write(data, len);
+  }
+
+  while (len > 0) {
+    switch (stage) {
+    case ST_HEADER:
+    case ST_ARGS: {
+      size_t n = hdrWant - hdrLen;
+      if (n > len) {
+        n = len;
+      }
+      memcpy(hdr + hdrLen, data, n);
+      hdrLen += n;
+      data += n;
+      len -= n;
+      if (hdrLen < hdrWant) {
+        break;
+      }
+
+      if (stage == ST_HEADER) {
+        newSize = readLE32(hdr + 4);
+        if (!baseSha || memcmp(hdr + 8, baseSha, 32) != 0) {
+          return fail("patch was made for a different base image");
+        }
+        stage = ST_OP;
+      } else if (!startRecord()) {
+        return false;
+      }
+      break;
+    }
+
+    case ST_OP:
+      op = *data++;
+      len--;
+      hdrLen = 0;
+      if (op == OTA_PATCH_OP_END) {
+        stage = ST_DONE;
+      } else if (op == OTA_PATCH_OP_ADD) {
+        hdrWant = 8;
+        stage = ST_ARGS;
+      } else if (op == OTA_PATCH_OP_INSERT) {
+        hdrWant = 4;
+        stage = ST_ARGS;
+      } else {
+        return fail("unknown patch op");
+      }
+      break;
+
+    case ST_ADD: {
+      size_t n = left < len ? left : len;
+      if (n > sizeof(scratch)) {
+        n = sizeof(scratch);
+      }
+      if (esp_partition_read(base, oldOffset, scratch, n) != ESP_OK) {
+        return fail("could not read base partition");
+      }
+      for (size_t i = 0; i < n; i++) {
+        scratch[i] += data[i];
+      }
+      if (!inner.write(scratch, n)) {
+        return false;
+      }
+      data += n;
+      len -= n;
+      left -= n;
+      oldOffset += n;
+      outTotal += n;
+      if (left == 0) {
+        stage = ST_OP;
+      }
+      break;
+    }
+
+    case ST_INSERT: {
+      size_t n = left < len ? left : len;
+      if (!inner.write(data, n)) {
+        return false;
+      }
+      data += n;
+      len -= n;
+      left -= n;
+      outTotal += n;
+      if (left == 0) {
+        stage = ST_OP;
+      }
+      break;
+    }
+
+    case ST_DONE:
+      return fail("trailing data after patch end");
+    }
+  }
+  return true;
+}
+
+bool PatchSink::finish() {
+  if (mode == MODE_SNIFF && hdrLen > 0) {
+    // image shorter than the magic, hand it on as is
+    outTotal += hdrLen;
+    if (!inner.write(hdr, hdrLen)) {
+      return false;
+    }
+  }
+  if (mode == MODE_PATCH && (stage != ST_DONE || outTotal != newSize)) {
+    return fail("patch stream truncated");
+  }
+  return inner.finish();
+}
@@ -0,0 +1,247 @@
+#include "ota_pipe.h"
+#include <Arduino.h>
+#include <Update.h>
+
+UpdateSink::UpdateSink() {
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts_ret(&sha, 0);
+  memset(hash, 0, sizeof(hash));
+}
+
+UpdateSink::~UpdateSink() { mbedtls_sha256_free(&sha); }
+
+bool UpdateSink::write(const uint8_t *data, size_t len) {
+  if (Update.write(const_cast<uint8_t *>(data), len) != len) {
+    return false;
+  }
+  mbedtls_sha256_update_ret(&sha, data, len);
+  return true;
+}
+
+bool UpdateSink::finish() {
+  mbedtls_sha256_finish_ret(&sha, hash);
+  return true;
+}
+
+const char *UpdateSink::error() { return Update.errorString(); }
+
+PartitionSink::PartitionSink(const esp_partition_t *part)
+    : part(part), offset(0), erased(0), lastError("") {
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts_ret(&sha, 0);
+  memset(hash, 0, sizeof(hash));
+}
+
+PartitionSink::~PartitionSink() { mbedtls_sha256_free(&sha); }
+
+bool PartitionSink::write(const uint8_t *data, size_t len) {
+  if (offset + len > part->size) {
+    lastError = "image larger than partition";
+    return false;
+  }
+  while (erased < offset + len) {
+    if (esp_partition_erase_range(part, erased, OTA_SECTOR_SIZE) != ESP_OK) {
+      lastError = "partition erase failed";
+      return false;
+    }
+    erased += OTA_SECTOR_SIZE;
+  }
+  if (esp_partition_write(part, offset, data, len) != ESP_OK) {
+    lastError = "partition write failed";
+    return false;
+  }
+  mbedtls_sha256_update_ret(&sha, data, len);
+  offset += len;
+  return true;
+}
+
+bool PartitionSink::finish() {
+  mbedtls_sha256_finish_ret(&sha, hash);
+  return true;
+}
+
+OtaPipeline::OtaPipeline(OtaPipeConfig config)
+    : cfg(config), bufs(NULL), freeQueue(NULL), fullQueue(NULL),
+      writerDone(NULL), sink(NULL), progress(NULL), total(0), committed(0),
+      writerFailed(false), sinkFinished(false), lastError("") {
+  // whole sectors only, so every commit maps to one erase + write
+  if (cfg.bufSize < OTA_SECTOR_SIZE) {
+    cfg.bufSize = OTA_SECTOR_SIZE;
+  }
+  cfg.bufSize = (cfg.bufSize + OTA_SECTOR_SIZE - 1) & ~(size_t)(OTA_SECTOR_SIZE - 1);
+  if (cfg.bufCount < 2) {
+    cfg.bufCount = 2;
+  }
+  if (cfg.bufCount > 255) {
+    cfg.bufCount = 255;
+  }
+}
+
+OtaPipeline::~OtaPipeline() { release(); }
+
+bool OtaPipeline::allocate() {
+  bufs = (uint8_t **)calloc(cfg.bufCount, sizeof(uint8_t *));
+  freeQueue = xQueueCreate(cfg.bufCount, sizeof(Chunk));
+  fullQueue = xQueueCreate(cfg.bufCount + 1, sizeof(Chunk));
+  writerDone = xSemaphoreCreateBinary();
+  if (!bufs || !freeQueue || !fullQueue || !writerDone) {
+    return false;
+  }
+
+  for (size_t i = 0; i < cfg.bufCount; i++) {
+    bufs[i] = (uint8_t *)malloc(cfg.bufSize);
+    if (!bufs[i]) {
+      return false;
+    }
+    Chunk c = {(uint8_t)i, 0};
+    xQueueSend(freeQueue, &c, 0);
+  }
+  return true;
+}
+
+void OtaPipeline::release() {
+  if (bufs) {
+    for (size_t i = 0; i < cfg.bufCount; i++) {
+      free(bufs[i]);
+    }
+    free(bufs);
+    bufs = NULL;
+  }
+  if (freeQueue) {
+    vQueueDelete(freeQueue);
+    freeQueue = NULL;
+  }
+  if (fullQueue) {
+    vQueueDelete(fullQueue);
+    fullQueue = NULL;
+  }
+  if (writerDone) {
+    vSemaphoreDelete(writerDone);
+    writerDone = NULL;
+  }
+}
+
+// read until the buffer is full, the image ends or the link stalls
+size_t OtaPipeline::fill(Client &src, uint8_t *buf, size_t want) {
+  size_t got = 0;
+  unsigned long lastData = millis();
+
+  while (got < want) {
+    int avail = src.available();
+    if (avail > 0) {
+      size_t n = want - got;
+      if ((size_t)avail < n) {
+        n = avail;
+      }
+      int r = src.read(buf + got, n);
+      if (r > 0) {
+        got += r;
+        lastData = millis();
+        continue;
+      }
+    }
+
+    if (!src.connected() && src.available() <= 0) {
+      break;
+    }
+    if (millis() - lastData > OTA_STREAM_TIMEOUT_MS) {
+      break;
+    }
+    vTaskDelay(1);
+  }
+  return got;
+}
+
+void OtaPipeline::writerTask(void *arg) {
+  OtaPipeline *self = (OtaPipeline *)arg;
+  Chunk c;
+
+  for (;;) {
+    xQueueReceive(self->fullQueue, &c, portMAX_DELAY);
+    if (c.len == 0) {
+      break;
+    }
+
+    // keep draining after a failure so the reader never blocks on us
+    if (!self->writerFailed) {
+      if (self->sink->write(self->bufs[c.index], c.len)) {
+        self->committed += c.len;
+        if (self->progress) {
+          self->progress(self->committed, self->total);
+        }
+      } else {
+        self->writerFailed = true;
+      }
+    }
+    xQueueSend(self->freeQueue, &c, portMAX_DELAY);
+  }
+
+  xSemaphoreGive(self->writerDone);
+  vTaskDelete(NULL);
+}
+
+size_t OtaPipeline::run(Client &src, size_t len, OtaSink &dst,
+                        OtaProgressFn progressFn) {
+  sink = &dst;
+  progress = progressFn;
+  total = len;
+  committed = 0;
+  writerFailed = false;
+  sinkFinished = false;
+  lastError = "";
+
+  if (!allocate()) {
+    release();
+    lastError = "not enough memory for OTA buffers";
+    return 0;
+  }
+
+  if (xTaskCreatePinnedToCore(writerTask, "OTAWriter", OTA_WRITER_STACK, this,
+                              OTA_WRITER_PRIORITY, NULL,
+                              OTA_WRITER_CORE) != pdPASS) {
+    release();
+    lastError = "could not create OTA writer task";
+    return 0;
+  }
+
+  size_t received = 0;
+  Chunk c;
+  while (received < total && !writerFailed) {
+    xQueueReceive(freeQueue, &c, portMAX_DELAY);
+
+    size_t want = total - received;
+    if (want > cfg.bufSize) {
+      want = cfg.bufSize;
+    }
+    c.len = fill(src, bufs[c.index], want);
+    if (c.len == 0) {
+      lastError = "stream ended early";
+      break;
+    }
+    received += c.len;
+    xQueueSend(fullQueue, &c, portMAX_DELAY);
+
+    if (c.len < want) {
+      lastError = "stream ended early";
+      break;
+    }
+  }
+
+  // end marker, then wait for the writer to drain what is queued
+  Chunk end = {0, 0};
+  xQueueSend(fullQueue, &end, portMAX_DELAY);
+  xSemaphoreTake(writerDone, portMAX_DELAY);
+
+  if (writerFailed) {
+    lastError = sink->error();
+  } else if (committed == total) {
+    sinkFinished = sink->finish();
+    if (!sinkFinished) {
+      lastError = sink->error();
+    }
+  }
+
+  size_t done = committed;
+  release();
+  return done;
+}
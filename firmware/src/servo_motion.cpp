@@ -0,0 +1,238 @@
+#include "servo_motion.h"
+#include <Arduino.h>
+#include <esp_timer.h>
+
+struct Motion {
+  Servo *servo;
+  bool active;
+  MotionProfile profile;
+  float fromUs;
+  float toUs;
+  int64_t startUs;
+  int64_t durationUs; // 32 bits would wrap past 71 minutes
+};
+
+// the pulse range each servo was attached with, for motionMove()
+struct Range {
+  Servo *servo;
+  int minUs;
+  int maxUs;
+};
+
+static Motion motions[MOTION_MAX_SERVOS];
+static Range ranges[MOTION_MAX_SERVOS];
+static esp_timer_handle_t motionTimer = NULL;
+// the timer is one-shot and re-armed by its own callback while anything
+// moves; armed is only changed under the lock, so a move started while the
+// callback decides to stop always arms it again
+static bool armed = false;
+static portMUX_TYPE motionMux = portMUX_INITIALIZER_UNLOCKED;
+
+// position along the move, 0..1, for the fraction of time u elapsed
+static float shape(MotionProfile profile, float u) {
+  switch (profile) {
+  case MOTION_TRAPEZOID: {
+    const float a = 0.25f;          // ramp share of the move
+    const float v = 1.0f / (1 - a); // cruise speed
+    if (u < a) {
+      return v * u * u / (2 * a);
+    }
+    if (u > 1 - a) {
+      return 1 - v * (1 - u) * (1 - u) / (2 * a);
+    }
+    return v * (u - a / 2);
+  }
+  case MOTION_SCURVE:
+    return u * u * u * (10 + u * (6 * u - 15));
+  default:
+    return u;
+  }
+}
+
+// callers hold motionMux
+static float positionAt(const Motion &m, int64_t now) {
+  int64_t elapsed = now - m.startUs;
+  if (elapsed >= m.durationUs) {
+    return m.toUs;
+  }
+  float u = (float)elapsed / m.durationUs;
+  return m.fromUs + (m.toUs - m.fromUs) * shape(m.profile, u);
+}
+
+static void motionTick(void *arg) {
+  int64_t now = esp_timer_get_time();
+  Servo *servo[MOTION_MAX_SERVOS];
+  int us[MOTION_MAX_SERVOS];
+  int n = 0;
+  bool any = false;
+
+  portENTER_CRITICAL(&motionMux);
+  for (int i = 0; i < MOTION_MAX_SERVOS; i++) {
+    Motion &m = motions[i];
+    if (!m.active) {
+      continue;
+    }
+    servo[n] = m.servo;
+    us[n] = (int)(positionAt(m, now) + 0.5f);
+    n++;
+    if (now - m.startUs >= m.durationUs) {
+      m.active = false;
+    } else {
+      any = true;
+    }
+  }
+  armed = any;
+  portEXIT_CRITICAL(&motionMux);
+
+  // ledc writes take a lock of their own, keep them out of the spinlock
+  for (int i = 0; i < n; i++) {
+    servo[i]->writeMicroseconds(us[i]);
+  }
+  if (any) {
+    esp_timer_start_once(motionTimer, MOTION_TICK_MS * 1000);
+  }
+}
+
+static void motionInit() {
+  if (!motionTimer) {
+    esp_timer_create_args_t args = {};
+    args.callback = motionTick;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "motion";
+    esp_timer_create(&args, &motionTimer);
+  }
+}
+
+// the slot already driving servo, else a free one; callers hold motionMux
+static Motion *slotFor(Servo &servo) {
+  Motion *free = NULL;
+  for (int i = 0; i < MOTION_MAX_SERVOS; i++) {
+    if (motions[i].servo == &servo) {
+      return &motions[i];
+    }
+    if (!free && !motions[i].active) {
+      free = &motions[i];
+    }
+  }
+  return free;
+}
+
+bool motionMoveMicroseconds(Servo &servo, int targetUs, uint32_t durationMs,
+                            MotionProfile profile) {
+  if (!servo.attached()) {
+    return false;
+  }
+  if (durationMs == 0) {
+    motionStop(servo);
+    servo.writeMicroseconds(targetUs);
+    return true;
+  }
+  // creating the timer allocates, so it cannot happen under the spinlock;
+  // moves are only started from the control task
+  motionInit();
+  int currentUs = servo.readMicroseconds();
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&motionMux);
+  Motion *m = slotFor(servo);
+  if (!m) {
+    portEXIT_CRITICAL(&motionMux);
+    return false;
+  }
+  // a retarget starts from wherever the running move has got to
+  m->fromUs = m->servo == &servo && m->active ? positionAt(*m, now)
+                                              : (float)currentUs;
+  m->servo = &servo;
+  m->toUs = targetUs;
+  m->startUs = now;
+  m->durationUs = (int64_t)durationMs * 1000;
+  m->profile = profile;
+  m->active = true;
+  bool start = !armed;
+  armed = true;
+  portEXIT_CRITICAL(&motionMux);
+
+  if (start) {
+    esp_timer_start_once(motionTimer, MOTION_TICK_MS * 1000);
+  }
+  return true;
+}
+
+int motionAttach(Servo &servo, int pin, int minUs, int maxUs) {
+  motionStop(servo);
+  int channel = servo.attach(pin, minUs, maxUs);
+
+  portENTER_CRITICAL(&motionMux);
+  Range *r = NULL;
+  for (int i = 0; i < MOTION_MAX_SERVOS; i++) {
+    if (ranges[i].servo == &servo) {
+      r = &ranges[i];
+      break;
+    }
+    if (!r && !ranges[i].servo) {
+      r = &ranges[i];
+    }
+  }
+  // with every entry taken the servo falls back to the default mapping
+  if (r) {
+    r->servo = &servo;
+    r->minUs = minUs;
+    r->maxUs = maxUs;
+  }
+  portEXIT_CRITICAL(&motionMux);
+  return channel;
+}
+
+bool motionMove(Servo &servo, int angle, uint32_t durationMs,
+                MotionProfile profile) {
+  int minUs = MOTION_MIN_US;
+  int maxUs = MOTION_MAX_US;
+  portENTER_CRITICAL(&motionMux);
+  for (int i = 0; i < MOTION_MAX_SERVOS; i++) {
+    if (ranges[i].servo == &servo) {
+      minUs = ranges[i].minUs;
+      maxUs = ranges[i].maxUs;
+    }
+  }
+  portEXIT_CRITICAL(&motionMux);
+
+  angle = angle < 0 ? 0 : angle > 180 ? 180 : angle;
+  int us = minUs + (maxUs - minUs) * angle / 180;
+  return motionMoveMicroseconds(servo, us, durationMs, profile);
+}
+
+bool motionBusy(Servo &servo) {
+  bool busy = false;
+  portENTER_CRITICAL(&motionMux);
+  for (int i = 0; i < MOTION_MAX_SERVOS; i++) {
+    if (motions[i].servo == &servo && motions[i].active) {
+      busy = true;
+    }
+  }
+  portEXIT_CRITICAL(&motionMux);
+  return busy;
+}
+
+void motionStop(Servo &servo) {
+  portENTER_CRITICAL(&motionMux);
+  for (int i = 0; i < MOTION_MAX_SERVOS; i++) {
+    if (motions[i].servo == &servo) {
+      motions[i].active = false;
+      motions[i].servo = NULL;
+    }
+  }
+  portEXIT_CRITICAL(&motionMux);
+}
+
+void motionDetachAll() {
+  for (int i = 0; i < MOTION_MAX_SERVOS; i++) {
+    portENTER_CRITICAL(&motionMux);
+    Servo *servo = ranges[i].servo;
+    ranges[i].servo = NULL;
+    portEXIT_CRITICAL(&motionMux);
+    if (servo) {
+      motionStop(*servo);
+      servo->detach();
+    }
+  }
+}
@@ -0,0 +1,387 @@
+#include "user_module.h"
+#include "ai.h"
+#include "adc_stream.h"
+#include "buf_writer.h"
+#include "led_pattern.h"
+#include "log_ring.h"
+#include "servo_motion.h"
+#include <Arduino.h>
+#include <ESP32Servo.h>
+#include <esp_heap_caps.h>
+#include <esp_rom_crc.h>
+#include <freertos/semphr.h>
+
+#ifndef USER_MODULE_MAX_TEXT
+#define USER_MODULE_MAX_TEXT (32 * 1024)
+#endif
+#ifndef USER_MODULE_MAX_DATA
+#define USER_MODULE_MAX_DATA (32 * 1024)
+#endif
+#ifndef USER_MODULE_SERVOS
+#define USER_MODULE_SERVOS 4
+#endif
+
+static Servo moduleServos[USER_MODULE_SERVOS];
+// pulse range each slot was attached with, for angle moves
+static int16_t servoMinUs[USER_MODULE_SERVOS];
+static int16_t servoMaxUs[USER_MODULE_SERVOS];
+
+static uint8_t *moduleText = NULL;
+static uint8_t *moduleData = NULL;
+static const UserModuleExports *moduleExports = NULL;
+static volatile bool setupPending = false;
+static volatile uint16_t generation = 0;
+static SemaphoreHandle_t moduleLock = NULL;
+
+// core api, thin wrappers so the table does not depend on core signatures
+static unsigned long apiMillis() { return millis(); }
+static unsigned long apiMicros() { return micros(); }
+static void apiDelay(unsigned long ms) { delay(ms); }
+static void apiPinMode(uint8_t pin, uint8_t mode) { pinMode(pin, mode); }
+static void apiDigitalWrite(uint8_t pin, uint8_t val) { digitalWrite(pin, val); }
+static int apiDigitalRead(uint8_t pin) { return digitalRead(pin); }
+static uint16_t apiAnalogRead(uint8_t pin) { return analogRead(pin); }
+static void *apiMalloc(size_t size) { return malloc(size); }
+static void apiFree(void *ptr) { free(ptr); }
+static void apiLog(const char *msg) { logText(LOG_MODULE_LOG, msg); }
+
+static int apiServoAttach(int pin, int minUs, int maxUs) {
+  for (int i = 0; i < USER_MODULE_SERVOS; i++) {
+    if (!moduleServos[i].attached()) {
+      moduleServos[i].setPeriodHertz(50);
+      moduleServos[i].attach(pin, minUs, maxUs);
+      servoMinUs[i] = minUs;
+      servoMaxUs[i] = maxUs;
+      return moduleServos[i].attached() ? i : -1;
+    }
+  }
+  return -1;
+}
+
+static bool validSlot(int slot) {
+  return slot >= 0 && slot < USER_MODULE_SERVOS && moduleServos[slot].attached();
+}
+
+static void apiServoWrite(int slot, int angle) {
+  if (validSlot(slot)) {
+    moduleServos[slot].write(angle);
+  }
+}
+
+static void apiServoWriteMicroseconds(int slot, int us) {
+  if (validSlot(slot)) {
+    moduleServos[slot].writeMicroseconds(us);
+  }
+}
+
+static void apiServoDetach(int slot) {
+  if (validSlot(slot)) {
+    motionStop(moduleServos[slot]);
+    moduleServos[slot].detach();
+  }
+}
+
+static bool apiServoMove(int slot, int angle, uint32_t durationMs,
+                         int profile) {
+  if (!validSlot(slot)) {
+    return false;
+  }
+  angle = angle < 0 ? 0 : angle > 180 ? 180 : angle;
+  int us = servoMinUs[slot] + (servoMaxUs[slot] - servoMinUs[slot]) * angle / 180;
+  return motionMoveMicroseconds(moduleServos[slot], us, durationMs,
+                                (MotionProfile)profile);
+}
+
+static bool apiServoMoving(int slot) {
+  return validSlot(slot) && motionBusy(moduleServos[slot]);
+}
+
+static void apiServoStop(int slot) {
+  if (validSlot(slot)) {
+    motionStop(moduleServos[slot]);
+  }
+}
+
+static bool apiAdcStreamStart(uint8_t pin, uint32_t rateHz, uint16_t decimate,
+                              uint8_t reduce) {
+  return adcStreamStart(pin, rateHz, decimate, (AdcReduce)reduce);
+}
+
+static const UserCoreApi coreApi = {
+    USER_MODULE_ABI_VERSION,
+    sizeof(UserCoreApi),
+    apiMillis,
+    apiMicros,
+    apiDelay,
+    apiPinMode,
+    apiDigitalWrite,
+    apiDigitalRead,
+    apiAnalogRead,
+    apiServoAttach,
+    apiServoWrite,
+    apiServoWriteMicroseconds,
+    apiServoDetach,
+    apiMalloc,
+    apiFree,
+    apiLog,
+    &shouldStop,
+    apiServoMove,
+    apiServoMoving,
+    apiServoStop,
+    ledPatternPlay,
+    ledPatternMorse,
+    ledPatternBusy,
+    ledPatternStop,
+    apiAdcStreamStart,
+    adcStreamStop,
+    adcStreamRead,
+    adcStreamAvailable,
+    adcStreamLatest,
+};
+
+const esp_partition_t *userModulePartition() {
+  return esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)USER_MODULE_SUBTYPE,
+      USER_MODULE_PARTITION);
+}
+
+bool userModuleActive() { return moduleExports != NULL; }
+
+uint16_t userModuleGeneration() { return generation; }
+
+// the first load runs from setup(), before anything else can race it
+static void lockInit() {
+  if (!moduleLock) {
+    moduleLock = xSemaphoreCreateRecursiveMutex();
+  }
+}
+
+void userModuleLock() {
+  lockInit();
+  xSemaphoreTakeRecursive(moduleLock, portMAX_DELAY);
+}
+
+void userModuleUnlock() { xSemaphoreGiveRecursive(moduleLock); }
+
+const AiVar *userModuleVars(size_t *count) {
+  if (!moduleExports) {
+    *count = 0;
+    return NULL;
+  }
+  *count = moduleExports->varCount;
+  return moduleExports->vars;
+}
+
+const uint8_t *userModuleSchema(size_t *size) {
+  if (!moduleExports) {
+    *size = 0;
+    return NULL;
+  }
+  *size = moduleExports->schemaSize;
+  return moduleExports->schema;
+}
+
+void userModuleUnload() {
+  userModuleLock();
+  if (moduleExports) {
+    generation++;
+  }
+  moduleExports = NULL;
+  setupPending = false;
+  userModuleReleaseHardware();
+  adcStreamStop();
+  heap_caps_free(moduleText);
+  heap_caps_free(moduleData);
+  moduleText = NULL;
+  moduleData = NULL;
+  userModuleUnlock();
+}
+
+void userModuleErase() {
+  const esp_partition_t *part = userModulePartition();
+  if (part) {
+    esp_partition_erase_range(part, 0, 4096);
+  }
+}
+
+// crc over [from, from + len) of the partition
+static uint32_t partitionCrc(const esp_partition_t *part, size_t from,
+                             size_t len) {
+  uint8_t buf[256];
+  uint32_t crc = 0;
+  while (len > 0) {
+    size_t n = len < sizeof(buf) ? len : sizeof(buf);
+    if (esp_partition_read(part, from, buf, n) != ESP_OK) {
+      return ~crc;
+    }
+    crc = esp_rom_crc32_le(crc, buf, n);
+    from += n;
+    len -= n;
+  }
+  return crc;
+}
+
+// iram only takes 32-bit accesses, so code goes through a word-sized bounce
+static bool copyText(const esp_partition_t *part, size_t from, size_t len) {
+  uint32_t buf[64];
+  uint32_t *dst = (uint32_t *)moduleText;
+  for (size_t done = 0; done < len; done += sizeof(buf)) {
+    size_t n = len - done < sizeof(buf) ? len - done : sizeof(buf);
+    memset(buf, 0, sizeof(buf));
+    if (esp_partition_read(part, from + done, buf, n) != ESP_OK) {
+      return false;
+    }
+    for (size_t w = 0; w < (n + 3) / 4; w++) {
+      *dst++ = buf[w];
+    }
+  }
+  return true;
+}
+
+// point an absolute address from the module link map at the loaded copy
+static bool rebase(uint32_t *word, const UserModuleHeader &hdr) {
+  uint32_t v = *word;
+  if (v < hdr.textSize) {
+    *word = (uint32_t)(uintptr_t)moduleText + v;
+  } else if (v >= USER_MODULE_DATA_VADDR &&
+             v - USER_MODULE_DATA_VADDR < hdr.dataSize + hdr.bssSize) {
+    *word = (uint32_t)(uintptr_t)moduleData + (v - USER_MODULE_DATA_VADDR);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool loadLocked(BufWriter &error) {
+  userModuleUnload();
+
+  const esp_partition_t *part = userModulePartition();
+  if (!part) {
+    error.print("no usermod partition in the partition table");
+    return false;
+  }
+
+  UserModuleHeader hdr;
+  if (esp_partition_read(part, 0, &hdr, sizeof(hdr)) != ESP_OK ||
+      hdr.magic != USER_MODULE_MAGIC) {
+    error.print("no user module stored");
+    return false;
+  }
+  if (hdr.abiVersion != USER_MODULE_ABI_VERSION ||
+      hdr.headerSize != sizeof(hdr)) {
+    error.printf("module was built for ABI %u", (unsigned)hdr.abiVersion);
+    return false;
+  }
+  if (hdr.textSize > USER_MODULE_MAX_TEXT || hdr.textSize % 4 != 0 ||
+      hdr.dataSize + hdr.bssSize > USER_MODULE_MAX_DATA ||
+      hdr.entry >= hdr.textSize || hdr.initArray % 4 != 0 ||
+      hdr.initArray + hdr.initCount * 4 > hdr.dataSize) {
+    error.print("module header out of range");
+    return false;
+  }
+
+  size_t bodyLen = hdr.textSize + hdr.dataSize + hdr.relocCount * 4;
+  if (sizeof(hdr) + bodyLen > part->size ||
+      partitionCrc(part, sizeof(hdr), bodyLen) != hdr.crc32) {
+    error.print("module crc mismatch");
+    return false;
+  }
+
+  moduleText = (uint8_t *)heap_caps_malloc(hdr.textSize,
+                                           MALLOC_CAP_EXEC | MALLOC_CAP_32BIT);
+  moduleData = (uint8_t *)heap_caps_calloc(1, hdr.dataSize + hdr.bssSize + 4,
+                                           MALLOC_CAP_8BIT);
+  if (!moduleText || !moduleData) {
+    userModuleUnload();
+    error.print("not enough executable memory for module");
+    return false;
+  }
+
+  size_t pos = sizeof(hdr);
+  if (!copyText(part, pos, hdr.textSize) ||
+      esp_partition_read(part, pos + hdr.textSize, moduleData, hdr.dataSize) !=
+          ESP_OK) {
+    userModuleUnload();
+    error.print("could not read module");
+    return false;
+  }
+  pos += hdr.textSize + hdr.dataSize;
+
+  for (uint32_t i = 0; i < hdr.relocCount; i++) {
+    uint32_t r;
+    esp_partition_read(part, pos + i * 4, &r, 4);
+    uint32_t off = r & ~USER_MODULE_RELOC_IN_DATA;
+    bool inData = r & USER_MODULE_RELOC_IN_DATA;
+    if (off % 4 != 0 || off + 4 > (inData ? hdr.dataSize : hdr.textSize) ||
+        !rebase((uint32_t *)((inData ? moduleData : moduleText) + off), hdr)) {
+      userModuleUnload();
+      error.printf("bad module relocation %u", (unsigned)i);
+      return false;
+    }
+  }
+
+  // init only records the api table, so it runs before constructors that
+  // may already call into the core
+  UserModuleInitFn init = (UserModuleInitFn)(moduleText + hdr.entry);
+  const UserModuleExports *exports = init(&coreApi);
+
+  // global constructors, entries were rebased with the rest of data
+  typedef void (*CtorFn)();
+  CtorFn *ctors = (CtorFn *)(moduleData + hdr.initArray);
+  for (uint32_t i = 0; exports && i < hdr.initCount; i++) {
+    ctors[i]();
+  }
+
+  if (!exports || exports->abiVersion != USER_MODULE_ABI_VERSION ||
+      !exports->setup || !exports->loop) {
+    userModuleUnload();
+    error.print("module init failed");
+    return false;
+  }
+
+  moduleExports = exports;
+  setupPending = true;
+  generation++;
+  return true;
+}
+
+bool userModuleLoad(BufWriter &error) {
+  userModuleLock();
+  bool ok = loadLocked(error);
+  userModuleUnlock();
+  return ok;
+}
+
+void userModuleRequestSetup() { setupPending = true; }
+
+void userModuleReleaseHardware() {
+  for (int i = 0; i < USER_MODULE_SERVOS; i++) {
+    motionStop(moduleServos[i]);
+    moduleServos[i].detach();
+  }
+  ledPatternStopAll();
+}
+
+void userModuleLoop() {
+  if (!moduleExports) {
+    return;
+  }
+  if (setupPending) {
+    setupPending = false;
+    moduleExports->setup();
+  }
+  moduleExports->loop();
+}
+
+bool userModuleSetVar(const char *name, const char *value) {
+  if (!moduleExports || !moduleExports->setVar) {
+    return false;
+  }
+  return moduleExports->setVar(name, value);
+}
+
+void userModuleApplyVars() {
+  if (moduleExports && moduleExports->applyVars) {
+    moduleExports->applyVars();
+  }
+}
@@ -0,0 +1,365 @@
+#include "var_batch.h"
+#include "ai_vars_gen.h"
+#include "http_util.h"
+#include "user_module.h"
+#include "var_store.h"
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// entries are packed as owner name\0value\0, owner being the index + 1 of
+// the waiter that staged the pair or 0
+struct VarBatch {
+  char data[VAR_BATCH_BYTES];
+  size_t used;
+  uint32_t seq;
+  TaskHandle_t waiters[VAR_BATCH_WAITERS];
+  VarBatchResult results[VAR_BATCH_WAITERS];
+  uint8_t waiterCount;
+};
+
+// results outlive the batch here until the waiter picks them up; only the
+// ai loop writes, seq is 0 while a slot is being rewritten
+struct Outcome {
+  volatile uint32_t seq;
+  TaskHandle_t task;
+  VarBatchResult result;
+};
+
+static VarBatch buffers[2];
+static VarBatch *back = &buffers[0];
+static VarBatch *front = &buffers[1];
+static SemaphoreHandle_t lock = NULL;
+static size_t beginUsed = 0;
+static uint32_t nextSeq = 0;
+static volatile uint32_t appliedSeq = 0;
+static Outcome outcomes[VAR_BATCH_WAITERS];
+
+void varBatchInit() {
+  if (!lock) {
+    lock = xSemaphoreCreateMutex();
+  }
+}
+
+void varBatchBegin() {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  beginUsed = back->used;
+}
+
+bool varBatchStage(const char *name, size_t nameLen, const char *value,
+                   size_t valueLen) {
+  if (nameLen == 0 || back->used + nameLen + valueLen + 3 > VAR_BATCH_BYTES) {
+    return false;
+  }
+  char *p = back->data + back->used;
+  *p++ = 0;
+  memcpy(p, name, nameLen);
+  p[nameLen] = '\0';
+  memcpy(p + nameLen + 1, value, valueLen);
+  p[nameLen + 1 + valueLen] = '\0';
+  back->used += nameLen + valueLen + 3;
+  return true;
+}
+
+void varBatchAbort() {
+  back->used = beginUsed;
+  xSemaphoreGive(lock);
+}
+
+uint32_t varBatchEnd(bool wait) {
+  uint32_t seq = back->seq = ++nextSeq;
+  if (wait) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    uint8_t w = 0;
+    while (w < back->waiterCount && back->waiters[w] != self) {
+      w++;
+    }
+    if (w == back->waiterCount && w < VAR_BATCH_WAITERS) {
+      back->waiters[w] = self;
+      back->results[w].failed = 0;
+      back->results[w].names[0] = '\0';
+      back->waiterCount++;
+    }
+    // tag this writer's pairs so commit can tell it what failed
+    for (size_t pos = beginUsed; w < back->waiterCount && pos < back->used;) {
+      back->data[pos] = w + 1;
+      const char *name = back->data + pos + 1;
+      const char *value = name + strlen(name) + 1;
+      pos = value + strlen(value) + 1 - back->data;
+    }
+  }
+  xSemaphoreGive(lock);
+  return seq;
+}
+
+bool varBatchWait(uint32_t seq, TickType_t timeout, VarBatchResult *result) {
+  TickType_t start = xTaskGetTickCount();
+  // a notification left over from an earlier timed out wait only costs
+  // one extra pass round this loop
+  while ((int32_t)(appliedSeq - seq) < 0) {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout) {
+      return false;
+    }
+    ulTaskNotifyTake(pdTRUE, timeout - waited);
+  }
+  if (result) {
+    result->failed = 0;
+    result->names[0] = '\0';
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (Outcome &o : outcomes) {
+      // a batch carries the seq of the last writer that ended into it
+      uint32_t applied = __atomic_load_n(&o.seq, __ATOMIC_ACQUIRE);
+      if (o.task != self || applied == 0 || (int32_t)(applied - seq) < 0) {
+        continue;
+      }
+      VarBatchResult copy = o.result;
+      // the ai loop did not start on the slot again meanwhile
+      if (__atomic_load_n(&o.seq, __ATOMIC_ACQUIRE) == applied) {
+        *result = copy;
+      }
+    }
+  }
+  return true;
+}
+
+static void addFailure(VarBatchResult &r, const char *name) {
+  size_t len = strlen(r.names);
+  const char *sep = len ? ", " : "";
+  for (const char *p = sep; *p && len < sizeof(r.names) - 1; p++) {
+    r.names[len++] = *p;
+  }
+  for (; *name && len < sizeof(r.names) - 1; name++) {
+    r.names[len++] = *name;
+  }
+  r.names[len] = '\0';
+  r.failed++;
+}
+
+// the slot the task had, else the one longest unread
+static Outcome &outcomeFor(TaskHandle_t task, uint32_t seq) {
+  Outcome *best = &outcomes[0];
+  for (Outcome &o : outcomes) {
+    if (o.task == task) {
+      return o;
+    }
+    if ((int32_t)(o.seq - seq) < (int32_t)(best->seq - seq)) {
+      best = &o;
+    }
+  }
+  return *best;
+}
+
+// the control channel names variables by table index as "#<generation>.<id>";
+// a table swapped out since then makes the entry stale
+static const char *resolveName(const char *name, bool module) {
+  if (name[0] != '#') {
+    return name;
+  }
+  const char *dot = strchr(name, '.');
+  if (!dot || (uint16_t)atol(name + 1) != userModuleGeneration()) {
+    return NULL;
+  }
+  size_t count = AI_VAR_COUNT;
+  const AiVar *vars = module ? userModuleVars(&count) : AI_VARS;
+  long id = atol(dot + 1);
+  return id >= 0 && (size_t)id < count ? vars[id].name : NULL;
+}
+
+void varBatchCommit() {
+  // a writer in the middle of staging just pushes this to the next step
+  if (back->used == 0 || xSemaphoreTake(lock, 0) != pdTRUE) {
+    return;
+  }
+  VarBatch *batch = back;
+  back = front;
+  front = batch;
+  back->used = 0;
+  back->waiterCount = 0;
+  xSemaphoreGive(lock);
+
+  bool module = userModuleActive();
+  for (size_t pos = 0; pos < batch->used;) {
+    uint8_t owner = batch->data[pos];
+    const char *staged = batch->data + pos + 1;
+    const char *value = staged + strlen(staged) + 1;
+    pos = value + strlen(value) + 1 - batch->data;
+    const char *name = resolveName(staged, module);
+    bool ok = name && (module ? userModuleSetVar(name, value)
+                              : updateVariableGeneric(name, value));
+    if (ok) {
+      varStoreRecord(name, value);
+    } else if (owner) {
+      addFailure(batch->results[owner - 1], staged);
+    }
+  }
+  if (module) {
+    userModuleApplyVars();
+  } else {
+    applyVariableHooks();
+  }
+
+  for (uint8_t i = 0; i < batch->waiterCount; i++) {
+    Outcome &o = outcomeFor(batch->waiters[i], batch->seq);
+    __atomic_store_n(&o.seq, 0, __ATOMIC_RELEASE);
+    o.task = batch->waiters[i];
+    o.result = batch->results[i];
+    __atomic_store_n(&o.seq, batch->seq, __ATOMIC_RELEASE);
+  }
+  appliedSeq = batch->seq;
+  for (uint8_t i = 0; i < batch->waiterCount; i++) {
+    xTaskNotifyGive(batch->waiters[i]);
+  }
+}
+
+static const char *skipSpace(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+    p++;
+  }
+  return p;
+}
+
+// [p, end) starts at a quote; sets the contents span, returns past the
+// closing quote. Escapes are not decoded, names and values are plain text.
+static const char *scanString(const char *p, const char *end, const char **s,
+                              size_t *n) {
+  *s = ++p;
+  while (p < end && *p != '"') {
+    if (*p == '\\') {
+      return NULL;
+    }
+    p++;
+  }
+  if (p == end) {
+    return NULL;
+  }
+  *n = p - *s;
+  return p + 1;
+}
+
+int varBatchStageJson(const char *body, size_t len, const char **err) {
+  const char *p = body;
+  const char *end = body + len;
+  int pairs = 0;
+
+  p = skipSpace(p, end);
+  if (p == end || *p++ != '{') {
+    *err = "body must be a json object";
+    return -1;
+  }
+  for (;;) {
+    p = skipSpace(p, end);
+    if (p < end && *p == '}' && pairs == 0) {
+      return 0;
+    }
+
+    const char *name;
+    size_t nameLen;
+    if (p == end || *p != '"' || !(p = scanString(p, end, &name, &nameLen))) {
+      *err = "expected a quoted variable name";
+      return -1;
+    }
+    p = skipSpace(p, end);
+    if (p == end || *p++ != ':') {
+      *err = "expected ':'";
+      return -1;
+    }
+    p = skipSpace(p, end);
+
+    const char *value;
+    size_t valueLen;
+    if (p < end && *p == '"') {
+      if (!(p = scanString(p, end, &value, &valueLen))) {
+        *err = "bad string value";
+        return -1;
+      }
+    } else {
+      value = p;
+      while (p < end && *p != ',' && *p != '}' && *p != ' ' && *p != '\n') {
+        p++;
+      }
+      valueLen = p - value;
+      // booleans land as 1/0 so int variables take them
+      if (valueLen == 4 && memcmp(value, "true", 4) == 0) {
+        value = "1";
+        valueLen = 1;
+      } else if (valueLen == 5 && memcmp(value, "false", 5) == 0) {
+        value = "0";
+        valueLen = 1;
+      } else if (valueLen == 0) {
+        *err = "missing value";
+        return -1;
+      }
+    }
+
+    if (!varBatchStage(name, nameLen, value, valueLen)) {
+      *err = "batch too large";
+      return -1;
+    }
+    pairs++;
+
+    p = skipSpace(p, end);
+    if (p < end && *p == ',') {
+      p++;
+      continue;
+    }
+    if (p < end && *p == '}') {
+      return pairs;
+    }
+    *err = "expected ',' or '}'";
+    return -1;
+  }
+}
+
+static bool stageArg(const char *key, size_t keyLen, const char *value,
+                     size_t valueLen, void *ctx) {
+  int *count = (int *)ctx;
+  if (!varBatchStage(key, keyLen, value, valueLen)) {
+    return false;
+  }
+  (*count)++;
+  return true;
+}
+
+esp_err_t varBatchHandle(httpd_req_t *req) {
+  char buf[VAR_BATCH_BYTES];
+  const char *err = "batch too large";
+  int count = 0;
+
+  // read before taking the batch lock, a slow client must not hold it
+  bool json = req->content_len > 0;
+  int len = json ? httpReadBody(req, buf, sizeof(buf)) : 0;
+  if (len < 0 || (!json && !httpQuery(req, buf, sizeof(buf)))) {
+    return httpText(req, "400 Bad Request", "Error: request too large");
+  }
+
+  varBatchBegin();
+  if (json) {
+    count = varBatchStageJson(buf, len, &err);
+  } else if (!httpForEachArg(buf, stageArg, &count)) {
+    count = -1;
+  }
+  if (count < 0) {
+    varBatchAbort();
+    char body[64];
+    snprintf(body, sizeof(body), "Error: %s", err);
+    return httpText(req, "400 Bad Request", body);
+  }
+
+  uint32_t seq = varBatchEnd(true);
+  char body[VAR_BATCH_FAILED_NAMES + 80];
+  VarBatchResult result;
+  if (varBatchWait(seq, pdMS_TO_TICKS(VAR_BATCH_WAIT_MS), &result)) {
+    if (result.failed) {
+      snprintf(body, sizeof(body),
+               "Error: %u of %d variables not applied (unknown or bad "
+               "value): %s",
+               (unsigned)result.failed, count, result.names);
+      return httpText(req, "400 Bad Request", body);
+    }
+    snprintf(body, sizeof(body), "Applied %d variables", count);
+    return httpText(req, "200 OK", body);
+  }
+  snprintf(body, sizeof(body),
+           "Queued %d variables, they apply when the AI loop resumes", count);
+  return httpText(req, "202 Accepted", body);
+}
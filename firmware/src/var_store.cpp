@@ -0,0 +1,225 @@
+#include "var_store.h"
+#include "ai_vars_gen.h"
+#include "log_ring.h"
+#include "user_module.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <freertos/task.h>
+
+#define VAR_PREFS "vars"
+#define KEY_BUILTIN "builtin"
+#define KEY_MODULE "module"
+
+// saved blob: u32 table signature, then per value u8 index | u8 len | text
+#define BLOB_MAX (4 + VAR_STORE_MAX_VARS * (2 + VAR_STORE_VALUE_MAX))
+
+// last applied text per table index, control task only (or while parked)
+static bool known[VAR_STORE_MAX_VARS];
+static char values[VAR_STORE_MAX_VARS][VAR_STORE_VALUE_MAX];
+static uint32_t signature = 0;
+static bool mirrorModule = false;
+static uint16_t mirrorGeneration = 0;
+static bool mirrorLoaded = false;
+
+static bool dirty = false;
+static uint32_t firstChangeMs = 0;
+static uint32_t lastChangeMs = 0;
+
+// handed to the writer task; only rebuilt while it is idle
+static uint8_t blob[BLOB_MAX];
+static size_t blobLen = 0;
+static const char *blobKey = KEY_BUILTIN;
+static volatile bool writing = false;
+static TaskHandle_t writer = NULL;
+static uint8_t readBuf[BLOB_MAX]; // the writer may still own blob
+
+static size_t liveTable(const AiVar **vars, bool *module) {
+  *module = userModuleActive();
+  if (*module) {
+    size_t count;
+    *vars = userModuleVars(&count);
+    return count;
+  }
+  *vars = AI_VARS;
+  return AI_VAR_COUNT;
+}
+
+static uint32_t tableSignature(const AiVar *vars, size_t count) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < count; i++) {
+    h = aiVarFnv(vars[i].name, h);
+    h = (h ^ vars[i].type) * 16777619u;
+  }
+  return aiVarFold(h ^ count);
+}
+
+static int indexOf(const AiVar *vars, size_t count, bool module,
+                   const char *name) {
+  if (!module) {
+    const AiVar *v =
+        aiVarLookup(AI_VARS, AI_VAR_SLOTS, AI_VAR_MASK, AI_VAR_SEED, name);
+    return v ? v - AI_VARS : -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(vars[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// reads the saved values of whichever table is live into the mirror
+static void loadMirror() {
+  const AiVar *vars;
+  size_t count = liveTable(&vars, &mirrorModule);
+  signature = tableSignature(vars, count);
+  mirrorGeneration = userModuleGeneration();
+  mirrorLoaded = true;
+  memset(known, 0, sizeof(known));
+  dirty = false;
+
+  Preferences prefs;
+  if (!prefs.begin(VAR_PREFS, true)) {
+    return;
+  }
+  size_t len = prefs.getBytes(mirrorModule ? KEY_MODULE : KEY_BUILTIN, readBuf,
+                              sizeof(readBuf));
+  prefs.end();
+  uint32_t saved;
+  if (len < 4 || (memcpy(&saved, readBuf, 4), saved != signature)) {
+    return; // nothing saved, or saved for another sketch
+  }
+  for (size_t pos = 4; pos + 2 <= len;) {
+    uint8_t i = readBuf[pos];
+    uint8_t n = readBuf[pos + 1];
+    if (pos + 2 + n > len || i >= count || i >= VAR_STORE_MAX_VARS ||
+        n >= VAR_STORE_VALUE_MAX) {
+      break;
+    }
+    memcpy(values[i], readBuf + pos + 2, n);
+    values[i][n] = '\0';
+    known[i] = true;
+    pos += 2 + n;
+  }
+}
+
+static void snapshot() {
+  memcpy(blob, &signature, 4);
+  blobLen = 4;
+  for (int i = 0; i < VAR_STORE_MAX_VARS; i++) {
+    if (known[i]) {
+      size_t n = strlen(values[i]);
+      blob[blobLen++] = i;
+      blob[blobLen++] = n;
+      memcpy(blob + blobLen, values[i], n);
+      blobLen += n;
+    }
+  }
+  blobKey = mirrorModule ? KEY_MODULE : KEY_BUILTIN;
+  dirty = false;
+}
+
+static void writeBlob() {
+  Preferences prefs;
+  if (prefs.begin(VAR_PREFS)) {
+    prefs.putBytes(blobKey, blob, blobLen);
+    prefs.end();
+  }
+}
+
+// flash writes stall both cores' caches for a few ms, so they happen here
+// at low priority rather than on the control task
+static void writerTask(void *pvParameters) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    writeBlob();
+    writing = false;
+  }
+}
+
+bool varStoreInit() {
+  return writer ||
+         xTaskCreatePinnedToCore(writerTask, "VarStoreTask", VAR_STORE_TASK_STACK,
+                                 NULL, VAR_STORE_TASK_PRIORITY, &writer,
+                                 VAR_STORE_TASK_CORE) == pdPASS;
+}
+
+void varStoreRestore() {
+  loadMirror();
+  const AiVar *vars;
+  bool module;
+  size_t count = liveTable(&vars, &module);
+  size_t restored = 0;
+  for (size_t i = 0; i < count && i < VAR_STORE_MAX_VARS; i++) {
+    if (!known[i]) {
+      continue;
+    }
+    // a module's text types are its own classes, only it can set them
+    bool ok = module ? userModuleSetVar(vars[i].name, values[i])
+                     : aiVarSet(vars[i], values[i]);
+    restored += ok;
+  }
+  if (restored) {
+    logWrite(LOG_VARS_RESTORED, restored);
+  }
+}
+
+void varStoreRecord(const char *name, const char *value) {
+  if (!mirrorLoaded || mirrorGeneration != userModuleGeneration()) {
+    loadMirror();
+  }
+  const AiVar *vars;
+  bool module;
+  size_t count = liveTable(&vars, &module);
+  int i = indexOf(vars, count, module, name);
+  if (i < 0 || i >= VAR_STORE_MAX_VARS) {
+    return;
+  }
+  size_t len = strlen(value);
+  if (len >= VAR_STORE_VALUE_MAX) {
+    logText(LOG_VAR_NOT_SAVED, name, len, VAR_STORE_VALUE_MAX - 1);
+    // a cut value would come back as one nobody set; drop the older one
+    // too, so a reboot falls back to the sketch default
+    if (!known[i]) {
+      return;
+    }
+    known[i] = false;
+  } else {
+    if (known[i] && strcmp(values[i], value) == 0) {
+      return;
+    }
+    memcpy(values[i], value, len + 1);
+    known[i] = true;
+  }
+
+  uint32_t now = millis();
+  if (!dirty) {
+    firstChangeMs = now;
+  }
+  lastChangeMs = now;
+  dirty = true;
+}
+
+void varStoreTick() {
+  if (!dirty || writing || !writer) {
+    return;
+  }
+  uint32_t now = millis();
+  if (now - lastChangeMs < VAR_STORE_DEBOUNCE_MS &&
+      now - firstChangeMs < VAR_STORE_MAX_DELAY_MS) {
+    return;
+  }
+  snapshot();
+  writing = true;
+  xTaskNotifyGive(writer);
+}
+
+void varStoreFlush() {
+  while (writing) {
+    vTaskDelay(1);
+  }
+  if (dirty) {
+    snapshot();
+    writeBlob();
+  }
+}
@@ -0,0 +1,354 @@
+#include "var_watch.h"
+#include "ai_vars_gen.h"
+#include "control_channel.h"
+#include "user_module.h"
+#include <freertos/task.h>
+#include <lwip/sockets.h>
+
+struct Subscriber {
+  bool active;
+  sockaddr_in to;
+  uint16_t intervalMs;
+  uint16_t deadband;
+  uint8_t pinCount;
+  uint8_t pins[VAR_WATCH_MAX_SENSORS];
+  uint16_t sent[VAR_WATCH_MAX_SENSORS]; // last value pushed per pin
+  uint8_t sentValid;                    // bit per pin
+  bool samples;                         // also gets CTRL_SAMPLES
+  uint32_t expiresMs;
+  uint32_t lastMs;
+  uint64_t dirty; // bit per variable id
+  uint16_t seq;
+};
+
+static_assert(CTRL_MAX_VARS <= 64, "dirty bits are one uint64_t");
+static_assert(VAR_WATCH_MAX_SENSORS <= 8, "sentValid is one byte");
+
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+static Subscriber subs[VAR_WATCH_MAX_SUBSCRIBERS];
+static volatile uint8_t watchers = 0;
+
+// control task only: fingerprint of every value as of the last scan
+static uint32_t shadow[CTRL_MAX_VARS];
+static uint16_t shadowGeneration = 0;
+static bool shadowValid = false;
+
+// handed to the sender task; only rebuilt while it is idle
+static uint8_t out[CTRL_PACKET_MAX];
+static size_t outLen = 0;
+static sockaddr_in outTo;
+static volatile bool sending = false;
+static TaskHandle_t sender = NULL;
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+// caller holds userModuleLock()
+static size_t varTable(const AiVar **vars) {
+  if (userModuleActive()) {
+    size_t count;
+    *vars = userModuleVars(&count);
+    return count;
+  }
+  *vars = AI_VARS;
+  return AI_VAR_COUNT;
+}
+
+static const char *textOf(const AiVar &v, size_t *len) {
+  const char *s;
+  switch (v.type) {
+  case AI_VAR_CHAR:
+    *len = 1;
+    return (const char *)v.addr;
+  case AI_VAR_STRING:
+    s = ((String *)v.addr)->c_str();
+    break;
+  case AI_VAR_CHAR_PTR:
+    s = *(char **)v.addr;
+    break;
+  case AI_VAR_CHAR_ARRAY:
+    s = (const char *)v.addr;
+    *len = strnlen(s, v.size);
+    return s;
+  default:
+    return NULL;
+  }
+  s = s ? s : "";
+  *len = strlen(s);
+  return s;
+}
+
+// the CTRL_SET encoding: int32, float32 bits for floats
+static uint32_t numericBits(const AiVar &v) {
+  switch (v.type) {
+  case AI_VAR_UINT16:
+    return *(uint16_t *)v.addr;
+  case AI_VAR_UINT32:
+    return *(uint32_t *)v.addr;
+  case AI_VAR_FLOAT: {
+    uint32_t bits;
+    memcpy(&bits, v.addr, 4);
+    return bits;
+  }
+  case AI_VAR_BOOL:
+    return *(bool *)v.addr;
+  case AI_VAR_UINT8:
+    return *(uint8_t *)v.addr;
+  default:
+    return (uint32_t)(*(int *)v.addr);
+  }
+}
+
+static uint32_t fingerprint(const AiVar &v) {
+  size_t len;
+  const char *s = textOf(v, &len);
+  if (!s) {
+    return numericBits(v);
+  }
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t)s[i]) * 16777619u;
+  }
+  return h;
+}
+
+static void senderTask(void *pvParameters) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    controlChannelSend(out, outLen, outTo);
+    sending = false;
+  }
+}
+
+bool varWatchInit() {
+  return sender ||
+         xTaskCreatePinnedToCore(senderTask, "VarWatchTask", VAR_WATCH_TASK_STACK,
+                                 NULL, VAR_WATCH_TASK_PRIORITY, &sender,
+                                 VAR_WATCH_TASK_CORE) == pdPASS;
+}
+
+static bool samePeer(const Subscriber &s, const sockaddr_in &to) {
+  return s.to.sin_addr.s_addr == to.sin_addr.s_addr &&
+         s.to.sin_port == to.sin_port;
+}
+
+void varWatchSubscribe(const sockaddr_in &from, const uint8_t *p, size_t len) {
+  if (len < 6 || len < 6 + (size_t)p[5]) {
+    return;
+  }
+  uint16_t interval = get16(p);
+  uint8_t pinCount = p[5] < VAR_WATCH_MAX_SENSORS ? p[5] : VAR_WATCH_MAX_SENSORS;
+  uint32_t now = millis();
+
+  portENTER_CRITICAL(&mux);
+  Subscriber *slot = NULL;
+  for (int i = 0; i < VAR_WATCH_MAX_SUBSCRIBERS && !slot; i++) {
+    if (subs[i].active && samePeer(subs[i], from)) {
+      slot = &subs[i];
+    }
+  }
+  bool fresh = !slot;
+  for (int i = 0; i < VAR_WATCH_MAX_SUBSCRIBERS && !slot && interval; i++) {
+    if (!subs[i].active) {
+      slot = &subs[i];
+    }
+  }
+  if (slot && interval == 0) {
+    slot->active = false;
+    watchers--;
+  } else if (slot) {
+    if (fresh) {
+      slot->active = true;
+      slot->to = from;
+      slot->seq = 0;
+      watchers++;
+    }
+    if (fresh || (p[4] & CTRL_WATCH_SNAPSHOT)) {
+      slot->dirty = ~0ull;
+      slot->sentValid = 0;
+      slot->lastMs = now - 0xffff; // due right away
+    }
+    slot->intervalMs = interval < VAR_WATCH_MIN_INTERVAL_MS
+                           ? VAR_WATCH_MIN_INTERVAL_MS
+                           : interval;
+    slot->deadband = get16(p + 2);
+    slot->samples = p[4] & CTRL_WATCH_SAMPLES;
+    if (pinCount != slot->pinCount || memcmp(slot->pins, p + 6, pinCount)) {
+      slot->sentValid = 0;
+    }
+    slot->pinCount = pinCount;
+    memcpy(slot->pins, p + 6, pinCount);
+    slot->expiresMs = now + CTRL_WATCH_TTL_MS;
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+size_t varWatchSampleTargets(sockaddr_in *out, size_t max) {
+  size_t n = 0;
+  uint32_t now = millis();
+  portENTER_CRITICAL(&mux);
+  for (int i = 0; i < VAR_WATCH_MAX_SUBSCRIBERS && n < max; i++) {
+    if (subs[i].active && subs[i].samples &&
+        (int32_t)(now - subs[i].expiresMs) < 0) {
+      out[n++] = subs[i].to;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+  return n;
+}
+
+// sets the dirty bit of every value that moved, for every subscriber
+static void scan() {
+  uint64_t changed = 0;
+  userModuleLock();
+  const AiVar *vars;
+  size_t count = varTable(&vars);
+  uint16_t generation = userModuleGeneration();
+  // a new table: ids mean something else now, everything is news
+  bool fresh = !shadowValid || generation != shadowGeneration;
+  for (size_t i = 0; i < count && i < CTRL_MAX_VARS; i++) {
+    uint32_t f = fingerprint(vars[i]);
+    if (fresh || f != shadow[i]) {
+      shadow[i] = f;
+      changed |= 1ull << i;
+    }
+  }
+  userModuleUnlock();
+  shadowValid = true;
+  shadowGeneration = generation;
+  if (!changed) {
+    return;
+  }
+  portENTER_CRITICAL(&mux);
+  for (int i = 0; i < VAR_WATCH_MAX_SUBSCRIBERS; i++) {
+    subs[i].dirty |= changed;
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+// builds the push for one subscriber into out; false if there is nothing
+static bool build(int index, uint32_t now) {
+  portENTER_CRITICAL(&mux);
+  Subscriber s = subs[index];
+  portEXIT_CRITICAL(&mux);
+
+  size_t sensorRoom = 1 + s.pinCount * 3;
+  size_t len = CTRL_HEADER_SIZE + 1;
+  uint8_t count = 0;
+  uint64_t sent = 0;
+
+  userModuleLock();
+  const AiVar *vars;
+  size_t varCount = varTable(&vars);
+  uint16_t generation = userModuleGeneration();
+  for (size_t id = 0; id < varCount && id < CTRL_MAX_VARS; id++) {
+    if (!(s.dirty & (1ull << id))) {
+      continue;
+    }
+    size_t n;
+    const char *text = textOf(vars[id], &n);
+    n = text ? (n < CTRL_VALUE_MAX ? n : CTRL_VALUE_MAX - 1) : 4;
+    // what does not fit stays dirty for the next push
+    if (len + 2 + n + sensorRoom > sizeof(out)) {
+      break;
+    }
+    out[len++] = id;
+    out[len++] = n;
+    if (text) {
+      memcpy(out + len, text, n);
+    } else {
+      uint32_t bits = numericBits(vars[id]);
+      put16(out + len, bits & 0xffff);
+      put16(out + len + 2, bits >> 16);
+    }
+    len += n;
+    count++;
+    sent |= 1ull << id;
+  }
+  userModuleUnlock();
+  // bits past the end of the table belong to no variable
+  if (varCount < CTRL_MAX_VARS) {
+    sent |= ~0ull << varCount;
+  }
+
+  size_t sensorsAt = len++;
+  uint8_t moved = 0;
+  for (uint8_t i = 0; i < s.pinCount; i++) {
+    uint16_t v = analogRead(s.pins[i]);
+    int delta = (int)v - (int)s.sent[i];
+    if ((s.sentValid & (1 << i)) && abs(delta) <= s.deadband) {
+      continue;
+    }
+    s.sent[i] = v;
+    s.sentValid |= 1 << i;
+    out[len++] = s.pins[i];
+    put16(out + len, v);
+    len += 2;
+    moved++;
+  }
+  out[sensorsAt] = moved;
+
+  portENTER_CRITICAL(&mux);
+  Subscriber &live = subs[index];
+  bool same = live.active && samePeer(live, s.to);
+  if (same) {
+    live.dirty &= ~sent;
+    live.lastMs = now;
+    if (live.pinCount == s.pinCount &&
+        memcmp(live.pins, s.pins, s.pinCount) == 0) {
+      memcpy(live.sent, s.sent, sizeof(s.sent));
+      live.sentValid = s.sentValid;
+    }
+    if (count || moved) {
+      live.seq++;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+  if (!same || (!count && !moved)) {
+    return false;
+  }
+
+  out[0] = CTRL_VALUES;
+  out[1] = CTRL_VERSION;
+  put16(out + 2, s.seq + 1);
+  put16(out + 4, generation);
+  out[CTRL_HEADER_SIZE] = count;
+  outLen = len;
+  outTo = s.to;
+  return true;
+}
+
+void varWatchTick() {
+  if (!watchers || sending || !sender) {
+    return;
+  }
+  uint32_t now = millis();
+  int due = -1;
+  portENTER_CRITICAL(&mux);
+  for (int i = 0; i < VAR_WATCH_MAX_SUBSCRIBERS; i++) {
+    Subscriber &s = subs[i];
+    if (!s.active) {
+      continue;
+    }
+    if ((int32_t)(now - s.expiresMs) >= 0) {
+      s.active = false;
+      watchers--;
+    } else if (due < 0 && now - s.lastMs >= s.intervalMs) {
+      due = i;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+  if (due < 0) {
+    return;
+  }
+
+  scan();
+  if (build(due, now)) {
+    sending = true;
+    xTaskNotifyGive(sender);
+  }
+}
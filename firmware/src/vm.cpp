@@ -0,0 +1,497 @@
+#include "vm.h"
+#include "ai_vars_gen.h"
+#include "buf_writer.h"
+#include "control_task.h"
+#include "led_pattern.h"
+#include "log_ring.h"
+#include "servo_motion.h"
+#include "user_module.h"
+#include <Arduino.h>
+#include <ESP32Servo.h>
+#include <Preferences.h>
+#include <esp_rom_crc.h>
+
+#define VM_PREFS "vm"
+#define VM_PREFS_KEY "image"
+
+// two image slots: the running one and the one a load writes into
+static uint8_t images[2][VM_MAX_IMAGE + 1] __attribute__((aligned(4)));
+static size_t imageLen[2];
+static uint8_t running = 0;
+static bool pending = false;
+// guards running/pending and the status error text
+static portMUX_TYPE vmMux = portMUX_INITIALIZER_UNLOCKED;
+
+// the program being run, control task only
+static const uint32_t *code = NULL;
+static uint16_t codeWords = 0;
+static const char *varNames[VM_MAX_VARS];
+static uint16_t varCount = 0;
+static const AiVar *vars[VM_MAX_VARS];
+static uint16_t boundGeneration = 0;
+static int32_t regs[VM_REGS];
+static uint16_t pc = 0;
+static bool halted = false;
+static unsigned long wakeAt = 0;
+static uint32_t ticks = 0;
+static char lastError[sizeof(VmStatus::error)] = "";
+
+static Servo vmServos[VM_SERVOS];
+static uint64_t ledPins = 0; // pins the program started patterns on
+
+static void setError(const char *msg) {
+  portENTER_CRITICAL(&vmMux);
+  strncpy(lastError, msg, sizeof(lastError) - 1);
+  lastError[sizeof(lastError) - 1] = '\0';
+  portEXIT_CRITICAL(&vmMux);
+}
+
+// checks everything the interpreter relies on, so it only has to guard
+// against division by zero at run time
+static bool validate(const uint8_t *image, size_t len, BufWriter &error) {
+  VmHeader hdr;
+  if (len < sizeof(hdr)) {
+    error.print("image too short");
+    return false;
+  }
+  memcpy(&hdr, image, sizeof(hdr));
+  if (hdr.magic != VM_MAGIC || hdr.version != VM_VERSION) {
+    error.print("not a vm image for this firmware");
+    return false;
+  }
+  if (hdr.namesSize % 4 != 0 || hdr.varCount > VM_MAX_VARS ||
+      sizeof(hdr) + hdr.namesSize + hdr.codeWords * 4u != len) {
+    error.print("image size mismatch");
+    return false;
+  }
+  if (esp_rom_crc32_le(0, image + sizeof(hdr), len - sizeof(hdr)) !=
+      hdr.crc32) {
+    error.print("image crc mismatch");
+    return false;
+  }
+
+  const char *names = (const char *)image + sizeof(hdr);
+  size_t pos = 0;
+  for (uint16_t i = 0; i < hdr.varCount; i++) {
+    const char *end = (const char *)memchr(names + pos, '\0', hdr.namesSize - pos);
+    if (!end || end == names + pos) {
+      error.print("bad variable names");
+      return false;
+    }
+    pos = end - names + 1;
+  }
+
+  const uint32_t *words = (const uint32_t *)(image + sizeof(hdr) + hdr.namesSize);
+  for (uint16_t i = 0; i < hdr.codeWords; i++) {
+    uint8_t op = words[i] & 0xff;
+    uint16_t imm = words[i] >> 16;
+    bool ok = op < VM_OP_COUNT;
+    if (op == VM_JMP || op == VM_JZ || op == VM_JNZ) {
+      ok = imm < hdr.codeWords;
+    } else if (op == VM_LDV || op == VM_STV) {
+      ok = imm < hdr.varCount;
+    } else if (op == VM_SYS) {
+      ok = imm < VM_SYS_COUNT;
+    }
+    if (!ok) {
+      error.printf("bad instruction at %u", (unsigned)i);
+      return false;
+    }
+  }
+  return true;
+}
+
+// the numeric variables of whichever table is live; others stay unbound
+// and read as 0. The vm is integer only, floats are truncated on load.
+static void bindVars() {
+  size_t count = AI_VAR_COUNT;
+  const AiVar *table = userModuleActive() ? userModuleVars(&count) : NULL;
+  for (uint16_t i = 0; i < varCount; i++) {
+    const AiVar *v = NULL;
+    if (table) {
+      for (size_t j = 0; j < count && !v; j++) {
+        if (strcmp(table[j].name, varNames[i]) == 0) {
+          v = &table[j];
+        }
+      }
+    } else {
+      v = aiVarLookup(AI_VARS, AI_VAR_SLOTS, AI_VAR_MASK, AI_VAR_SEED,
+                      varNames[i]);
+    }
+    bool numeric = v && (v->type == AI_VAR_INT || v->type == AI_VAR_UINT16 ||
+                         v->type == AI_VAR_UINT32 || v->type == AI_VAR_FLOAT ||
+                         v->type == AI_VAR_BOOL || v->type == AI_VAR_UINT8);
+    vars[i] = numeric ? v : NULL;
+  }
+  boundGeneration = userModuleGeneration();
+}
+
+static int32_t loadVar(uint16_t i) {
+  const AiVar *v = vars[i];
+  if (!v) {
+    return 0;
+  }
+  switch (v->type) {
+  case AI_VAR_UINT16:
+    return *(uint16_t *)v->addr;
+  case AI_VAR_UINT32:
+    return (int32_t)*(uint32_t *)v->addr;
+  case AI_VAR_FLOAT:
+    return (int32_t)*(float *)v->addr;
+  case AI_VAR_BOOL:
+    return *(bool *)v->addr;
+  case AI_VAR_UINT8:
+    return *(uint8_t *)v->addr;
+  default:
+    return *(int *)v->addr;
+  }
+}
+
+static void storeVar(uint16_t i, int32_t value) {
+  const AiVar *v = vars[i];
+  if (!v) {
+    return;
+  }
+  switch (v->type) {
+  case AI_VAR_UINT16:
+    *(uint16_t *)v->addr = (uint16_t)value;
+    break;
+  case AI_VAR_UINT32:
+    *(uint32_t *)v->addr = (uint32_t)value;
+    break;
+  case AI_VAR_FLOAT:
+    *(float *)v->addr = (float)value;
+    break;
+  case AI_VAR_BOOL:
+    *(bool *)v->addr = value != 0;
+    break;
+  case AI_VAR_UINT8:
+    *(uint8_t *)v->addr = (uint8_t)value;
+    break;
+  default:
+    *(int *)v->addr = value;
+    break;
+  }
+  if (v->apply) {
+    v->apply();
+  }
+}
+
+// servos and led patterns belong to the program that started them
+static void releaseHardware() {
+  for (int i = 0; i < VM_SERVOS; i++) {
+    motionStop(vmServos[i]);
+    vmServos[i].detach();
+  }
+  for (uint8_t pin = 0; ledPins; pin++) {
+    if (ledPins & (1ull << pin)) {
+      ledPatternStop(pin);
+      ledPins &= ~(1ull << pin);
+    }
+  }
+}
+
+static void startProgram(const uint8_t *image, size_t len) {
+  releaseHardware();
+  bool wasRunning = code != NULL;
+  code = NULL;
+  codeWords = 0;
+  varCount = 0;
+  // the sketch or module keeps its servos and patterns otherwise, and both
+  // would drive the same pins; it sets up again once the program is gone
+  if (len == 0) {
+    return;
+  }
+  if (!wasRunning) {
+    controlTaskPark();
+  }
+
+  VmHeader hdr;
+  memcpy(&hdr, image, sizeof(hdr));
+  const char *name = (const char *)image + sizeof(hdr);
+  for (uint16_t i = 0; i < hdr.varCount; i++) {
+    varNames[i] = name;
+    name += strlen(name) + 1;
+  }
+  varCount = hdr.varCount;
+  codeWords = hdr.codeWords;
+  code = (const uint32_t *)(image + sizeof(hdr) + hdr.namesSize);
+
+  memset(regs, 0, sizeof(regs));
+  pc = 0;
+  halted = false;
+  wakeAt = 0;
+  ticks = 0;
+  setError("");
+  bindVars();
+}
+
+static bool validServo(int32_t i) { return i >= 0 && i < VM_SERVOS; }
+
+static int32_t callBuiltin(uint16_t id) {
+  int32_t a = regs[0], b = regs[1], c = regs[2], d = regs[3];
+  switch (id) {
+  case VM_SYS_MILLIS:
+    return (int32_t)millis();
+  case VM_SYS_PIN_MODE:
+    pinMode(a, b);
+    return 0;
+  case VM_SYS_DWRITE:
+    digitalWrite(a, b);
+    return 0;
+  case VM_SYS_DREAD:
+    return digitalRead(a);
+  case VM_SYS_AREAD:
+    return analogRead(a);
+  case VM_SYS_SERVO_ATTACH:
+    if (!validServo(a)) {
+      return 0;
+    }
+    vmServos[a].detach();
+    vmServos[a].setPeriodHertz(50);
+    motionAttach(vmServos[a], b);
+    return vmServos[a].attached();
+  case VM_SYS_SERVO_WRITE:
+    if (validServo(a)) {
+      vmServos[a].write(b);
+    }
+    return 0;
+  case VM_SYS_SERVO_MOVE:
+    return validServo(a) &&
+           motionMove(vmServos[a], b, c < 0 ? 0 : c, (MotionProfile)d);
+  case VM_SYS_SERVO_BUSY:
+    return validServo(a) && motionBusy(vmServos[a]);
+  case VM_SYS_LED_BLINK: {
+    uint32_t spans[2] = {(uint32_t)b * 1000, (uint32_t)c * 1000};
+    if (a < 0 || a >= 64 || !ledPatternPlay(a, spans, 2, true)) {
+      return 0;
+    }
+    ledPins |= 1ull << a;
+    return 1;
+  }
+  case VM_SYS_LED_STOP:
+    if (a >= 0 && a < 64) {
+      ledPatternStop(a);
+      ledPins &= ~(1ull << a);
+    }
+    return 0;
+  case VM_SYS_LOG:
+    logWrite(LOG_VM_LOG, a);
+    return 0;
+  }
+  return 0;
+}
+
+static void stop(const char *why) {
+  halted = true;
+  setError(why);
+}
+
+static void run() {
+  for (uint32_t steps = 0; steps < VM_MAX_STEPS; steps++) {
+    if (pc >= codeWords) {
+      halted = true;
+      return;
+    }
+    uint32_t w = code[pc++];
+    uint8_t op = w & 0xff;
+    uint8_t a = (w >> 8) & 0xf;
+    uint8_t b = (w >> 12) & 0xf;
+    uint16_t imm = w >> 16;
+    int32_t simm = (int16_t)imm;
+    int32_t &ra = regs[a];
+    int32_t rb = regs[b];
+    int32_t rc = regs[imm & 0xf];
+
+    switch ((VmOp)op) {
+    case VM_HALT:
+      halted = true;
+      return;
+    case VM_LDI:
+      ra = simm;
+      break;
+    case VM_LUI:
+      ra = (int32_t)((uint32_t)imm << 16 | ((uint32_t)ra & 0xffff));
+      break;
+    case VM_MOV:
+      ra = rb;
+      break;
+    case VM_ADD:
+      ra = (int32_t)((uint32_t)rb + (uint32_t)rc);
+      break;
+    case VM_SUB:
+      ra = (int32_t)((uint32_t)rb - (uint32_t)rc);
+      break;
+    case VM_MUL:
+      ra = (int32_t)((uint32_t)rb * (uint32_t)rc);
+      break;
+    case VM_DIV:
+    case VM_MOD:
+      if (rc == 0 || (rb == INT32_MIN && rc == -1)) {
+        stop("division by zero");
+        return;
+      }
+      ra = op == VM_DIV ? rb / rc : rb % rc;
+      break;
+    case VM_AND:
+      ra = rb & rc;
+      break;
+    case VM_OR:
+      ra = rb | rc;
+      break;
+    case VM_XOR:
+      ra = rb ^ rc;
+      break;
+    case VM_SHL:
+      ra = (int32_t)((uint32_t)rb << (rc & 31));
+      break;
+    case VM_SHR:
+      ra = rb >> (rc & 31);
+      break;
+    case VM_ADDI:
+      ra = (int32_t)((uint32_t)rb + (uint32_t)simm);
+      break;
+    case VM_SLT:
+      ra = rb < rc;
+      break;
+    case VM_SLE:
+      ra = rb <= rc;
+      break;
+    case VM_SEQ:
+      ra = rb == rc;
+      break;
+    case VM_SNE:
+      ra = rb != rc;
+      break;
+    case VM_JMP:
+      pc = imm;
+      break;
+    case VM_JZ:
+      if (ra == 0) {
+        pc = imm;
+      }
+      break;
+    case VM_JNZ:
+      if (ra != 0) {
+        pc = imm;
+      }
+      break;
+    case VM_SYS:
+      regs[0] = callBuiltin(imm);
+      break;
+    case VM_YIELD:
+      return;
+    case VM_SLEEP:
+      wakeAt = millis() + (uint32_t)ra;
+      return;
+    case VM_LDV:
+      ra = loadVar(imm);
+      break;
+    case VM_STV:
+      storeVar(imm, ra);
+      break;
+    default:
+      stop("bad opcode");
+      return;
+    }
+  }
+}
+
+bool vmStep() {
+  portENTER_CRITICAL(&vmMux);
+  bool swap = pending;
+  if (swap) {
+    running ^= 1;
+    pending = false;
+  }
+  portEXIT_CRITICAL(&vmMux);
+  if (swap) {
+    startProgram(images[running], imageLen[running]);
+  }
+
+  if (!code) {
+    return false;
+  }
+  // a halted program keeps the loop so its hardware patterns stay alone
+  if (halted || (long)(millis() - wakeAt) < 0) {
+    return true;
+  }
+  if (boundGeneration != userModuleGeneration()) {
+    bindVars();
+  }
+  ticks++;
+  run();
+  return true;
+}
+
+// the idle slot is neither running nor queued once pending is cleared,
+// and running only moves while something is pending
+uint8_t *vmLoadBuffer() {
+  portENTER_CRITICAL(&vmMux);
+  pending = false;
+  uint8_t idle = running ^ 1;
+  portEXIT_CRITICAL(&vmMux);
+  return images[idle];
+}
+
+bool vmLoadCommit(size_t len, bool persist, BufWriter &error) {
+  uint8_t idle = running ^ 1;
+  if (len > VM_MAX_IMAGE) {
+    error.print("image too large");
+    return false;
+  }
+  if (len > 0 && !validate(images[idle], len, error)) {
+    return false;
+  }
+  imageLen[idle] = len;
+
+  if (persist) {
+    Preferences prefs;
+    prefs.begin(VM_PREFS);
+    if (len > 0) {
+      prefs.putBytes(VM_PREFS_KEY, images[idle], len);
+    } else {
+      prefs.remove(VM_PREFS_KEY);
+    }
+    prefs.end();
+  }
+
+  portENTER_CRITICAL(&vmMux);
+  pending = true;
+  portEXIT_CRITICAL(&vmMux);
+  return true;
+}
+
+void vmLoadStored() {
+  Preferences prefs;
+  if (!prefs.begin(VM_PREFS, true)) {
+    return;
+  }
+  size_t len = prefs.getBytesLength(VM_PREFS_KEY);
+  if (len == 0 || len > VM_MAX_IMAGE) {
+    prefs.end();
+    return;
+  }
+  uint8_t *buf = vmLoadBuffer();
+  prefs.getBytes(VM_PREFS_KEY, buf, len);
+  prefs.end();
+
+  StackWriter<48> error;
+  if (vmLoadCommit(len, false, error)) {
+    logWrite(LOG_VM_STORED);
+  } else {
+    logText(LOG_VM_REJECTED, error.c_str());
+  }
+}
+
+void vmGetStatus(VmStatus &out) {
+  out.loaded = code != NULL;
+  out.halted = halted;
+  out.codeWords = codeWords;
+  out.varCount = varCount;
+  out.pc = pc;
+  out.ticks = ticks;
+  portENTER_CRITICAL(&vmMux);
+  memcpy(out.error, lastError, sizeof(out.error));
+  portEXIT_CRITICAL(&vmMux);
+}
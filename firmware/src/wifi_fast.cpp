@@ -0,0 +1,178 @@
+#include "wifi_fast.h"
+#include "log_ring.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#define WIFI_PREFS "wifi"
+#define WIFI_PREFS_KEY "ap"
+
+// the last good connection; addresses are the raw IPAddress values
+struct WifiCache {
+  uint32_t ssidCrc; // a cache for another network is ignored
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+static const char *wifiSsid;
+static const char *wifiPassword;
+static WifiCache cache;
+static bool haveCache = false;
+static volatile bool fastAttempt = false; // still on the cached AP try
+static WifiBootInfo info;
+static bool leaseActive = false; // a reused lease that DHCP has not replaced
+static uint32_t leaseSince = 0;
+static uint32_t beginAt = 0;
+
+static uint32_t ssidCrc(const char *ssid) {
+  return esp_rom_crc32_le(0, (const uint8_t *)ssid, strlen(ssid));
+}
+
+// power stayed on, so the lease from before the reset is seconds old
+static bool softReset() {
+  switch (esp_reset_reason()) {
+  case ESP_RST_SW:
+  case ESP_RST_PANIC:
+  case ESP_RST_INT_WDT:
+  case ESP_RST_TASK_WDT:
+  case ESP_RST_WDT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void loadCache() {
+  Preferences prefs;
+  if (!prefs.begin(WIFI_PREFS, true)) {
+    return;
+  }
+  haveCache = prefs.getBytesLength(WIFI_PREFS_KEY) == sizeof(cache) &&
+              prefs.getBytes(WIFI_PREFS_KEY, &cache, sizeof(cache)) ==
+                  sizeof(cache) &&
+              cache.ssidCrc == ssidCrc(wifiSsid) && cache.channel != 0;
+  prefs.end();
+}
+
+// runs on the wifi event task; only writes flash when something changed
+static void onGotIp(WiFiEvent_t event, WiFiEventInfo_t eventInfo) {
+  if (info.connectUs == 0) {
+    info.connectUs = esp_timer_get_time();
+    info.cachedAp = fastAttempt;
+  }
+
+  WifiCache now = {};
+  now.ssidCrc = ssidCrc(wifiSsid);
+  memcpy(now.bssid, WiFi.BSSID(), sizeof(now.bssid));
+  now.channel = WiFi.channel();
+  now.ip = WiFi.localIP();
+  now.gateway = WiFi.gatewayIP();
+  now.subnet = WiFi.subnetMask();
+  now.dns = WiFi.dnsIP(0);
+  if (haveCache && memcmp(&now, &cache, sizeof(now)) == 0) {
+    return;
+  }
+  Preferences prefs;
+  if (prefs.begin(WIFI_PREFS)) {
+    prefs.putBytes(WIFI_PREFS_KEY, &now, sizeof(now));
+    prefs.end();
+  }
+  cache = now;
+  haveCache = true;
+}
+
+static bool configureStaticIp() {
+#ifdef WIFI_STATIC_IP
+  IPAddress ip;
+  if (!ip.fromString(WIFI_STATIC_IP)) {
+    logWrite(LOG_WIFI_BAD_STATIC);
+    return false;
+  }
+#ifdef WIFI_GATEWAY
+  IPAddress gateway;
+  gateway.fromString(WIFI_GATEWAY);
+#else
+  IPAddress gateway(ip[0], ip[1], ip[2], 1);
+#endif
+#ifdef WIFI_SUBNET
+  IPAddress subnet;
+  subnet.fromString(WIFI_SUBNET);
+#else
+  IPAddress subnet(255, 255, 255, 0);
+#endif
+#ifdef WIFI_DNS
+  IPAddress dns;
+  dns.fromString(WIFI_DNS);
+#else
+  IPAddress dns = gateway;
+#endif
+  return WiFi.config(ip, gateway, subnet, dns);
+#else
+  return false;
+#endif
+}
+
+void wifiFastBegin(const char *ssid, const char *password) {
+  wifiSsid = ssid;
+  wifiPassword = password;
+  WiFi.onEvent(onGotIp, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  // the cache below replaces the idf's own copy, which costs a flash write
+  // on every begin()
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+
+  loadCache();
+  info.staticIp = configureStaticIp();
+  if (!info.staticIp && haveCache && WIFI_REUSE_LEASE && softReset() &&
+      cache.ip != 0) {
+    info.leaseReused = WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway),
+                                   IPAddress(cache.subnet), IPAddress(cache.dns));
+    leaseActive = info.leaseReused;
+  }
+
+  beginAt = millis();
+  if (haveCache) {
+    fastAttempt = true;
+    WiFi.begin(ssid, password, cache.channel, cache.bssid, true);
+  } else {
+    WiFi.begin(ssid, password);
+  }
+}
+
+void wifiFastWait() {
+  while (WiFi.status() != WL_CONNECTED) {
+    if (fastAttempt && millis() - beginAt > WIFI_FAST_TIMEOUT_MS) {
+      // the AP moved channel or was replaced, do it the slow way
+      logWrite(LOG_WIFI_SCAN);
+      fastAttempt = false;
+      WiFi.disconnect();
+      if (leaseActive) {
+        WiFi.config(IPAddress(), IPAddress(), IPAddress());
+        info.leaseReused = leaseActive = false;
+      }
+      WiFi.begin(wifiSsid, wifiPassword);
+    }
+    delay(10);
+  }
+  fastAttempt = false;
+  leaseSince = millis();
+}
+
+void wifiFastPoll() {
+  if (leaseActive && millis() - leaseSince > WIFI_LEASE_REUSE_MS) {
+    // a short gap while DHCP binds, the router hands back the same address
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());
+    leaseActive = false;
+  }
+}
+
+const WifiBootInfo &wifiBootInfo() { return info; }
@@ -0,0 +1,51 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+#include <chrono>
+#include <freertos/FreeRTOS.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+// the slice of the esp32 arduino core that the host-built firmware files
+// use, see firmware/test/README
+
+#define IRAM_ATTR
+#define HIGH 1
+#define LOW 0
+
+inline unsigned long millis() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return duration_cast<milliseconds>(steady_clock::now() - start).count();
+}
+
+inline unsigned long micros() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+inline void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+class String {
+public:
+  String() {}
+  String(const char *s) : s(s ? s : "") {}
+  String &operator=(const char *v) {
+    s = v ? v : "";
+    return *this;
+  }
+  const char *c_str() const { return s.c_str(); }
+  size_t length() const { return s.size(); }
+  bool operator==(const char *o) const { return s == o; }
+
+private:
+  std::string s;
+};
+
+#endif
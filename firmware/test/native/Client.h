@@ -0,0 +1,14 @@
+#ifndef NATIVE_CLIENT_H
+#define NATIVE_CLIENT_H
+#include <Arduino.h>
+
+// what OtaPipeline reads through; tests derive their mock streams from it
+class Client {
+public:
+  virtual ~Client() {}
+  virtual int available() = 0;
+  virtual int read(uint8_t *buf, size_t size) = 0;
+  virtual uint8_t connected() = 0;
+};
+
+#endif
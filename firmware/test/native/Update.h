@@ -0,0 +1,24 @@
+#ifndef NATIVE_UPDATE_H
+#define NATIVE_UPDATE_H
+#include <Arduino.h>
+#include <vector>
+
+// records what UpdateSink hands the core's Update; fail makes writes short
+class UpdateClass {
+public:
+  size_t write(uint8_t *data, size_t len) {
+    if (fail) {
+      return 0;
+    }
+    image.insert(image.end(), data, data + len);
+    return len;
+  }
+  const char *errorString() { return fail ? "Flash Write Failed" : "No Error"; }
+
+  std::vector<uint8_t> image;
+  bool fail = false;
+};
+
+inline UpdateClass Update;
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef NATIVE_BENCH_H
+#define NATIVE_BENCH_H
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+
+// benchmarks for the native test suites: benchRun() times a loop body and
+// counts the heap allocations it makes, printing one line per benchmark
+//
+//   bench dispatch/500/hit                    21.4 ns/op     0.00 allocs/op
+//
+// Allocations are counted by bench_alloc.h, which one file per test
+// program has to include.
+
+#ifndef BENCH_MIN_MS
+#define BENCH_MIN_MS 200
+#endif
+
+inline std::atomic<uint64_t> benchAllocCount{0};
+
+struct BenchResult {
+  uint64_t ops;
+  uint64_t allocs;
+  double nsPerOp;
+  double allocsPerOp;
+};
+
+// calls fn(i) in batches growing 4x until one takes BENCH_MIN_MS (or
+// reaches maxOps) and reports that batch, the smaller ones are warm up
+template <typename Fn>
+BenchResult benchRun(const char *name, Fn fn, uint64_t maxOps = UINT64_MAX) {
+  using clock = std::chrono::steady_clock;
+  BenchResult r = {};
+  for (uint64_t n = 1;; n *= 4) {
+    if (n > maxOps) {
+      n = maxOps;
+    }
+    uint64_t allocs = benchAllocCount.load();
+    clock::time_point start = clock::now();
+    for (uint64_t i = 0; i < n; i++) {
+      fn(i);
+    }
+    double ns = std::chrono::duration<double, std::nano>(clock::now() - start)
+                    .count();
+    r.ops = n;
+    r.allocs = benchAllocCount.load() - allocs;
+    r.nsPerOp = ns / n;
+    r.allocsPerOp = (double)r.allocs / n;
+    if (ns >= BENCH_MIN_MS * 1e6 || n == maxOps) {
+      break;
+    }
+  }
+  printf("bench %-34s %12.1f ns/op %8.2f allocs/op\n", name, r.nsPerOp,
+         r.allocsPerOp);
+  return r;
+}
+
+// allocations made by fn() alone, for code that is not worth timing
+template <typename Fn> uint64_t benchAllocs(Fn fn) {
+  uint64_t before = benchAllocCount.load();
+  fn();
+  return benchAllocCount.load() - before;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef NATIVE_BENCH_ALLOC_H
+#define NATIVE_BENCH_ALLOC_H
+#include "bench.h"
+#include <new>
+#include <stdlib.h>
+
+// counts heap allocations for bench.h. Defines the allocator entry points,
+// so include it from exactly one file of a test program.
+//
+// With glibc the malloc family itself is replaced, which also catches
+// strdup() and operator new; elsewhere only operator new is seen.
+
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) noexcept {
+  benchAllocCount++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+  benchAllocCount++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+  benchAllocCount++;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) noexcept { __libc_free(ptr); }
+}
+#else
+void *operator new(size_t size) {
+  benchAllocCount++;
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+#endif
+
+#endif
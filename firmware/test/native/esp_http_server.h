@@ -0,0 +1,114 @@
+#ifndef NATIVE_ESP_HTTP_SERVER_H
+#define NATIVE_ESP_HTTP_SERVER_H
+#include <esp_err.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+// a request is a query string and/or body the test sets up; the response
+// lands in fixed buffers on the request so building it costs no heap
+
+#define HTTPD_RESP_USE_STRLEN -1
+#define HTTPD_SOCK_ERR_FAIL -1
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+
+struct httpd_req_t {
+  size_t content_len;
+  const char *query; // NULL when the uri has none
+  const char *body;  // content_len bytes
+  size_t bodyRead;
+
+  char status[32];
+  char type[32];
+  char response[512];
+  size_t responseLen;
+};
+
+inline void httpdMockRequest(httpd_req_t *req, const char *query,
+                             const char *body) {
+  memset(req, 0, sizeof(*req));
+  req->query = query;
+  req->body = body;
+  req->content_len = body ? strlen(body) : 0;
+  strcpy(req->status, "200 OK");
+}
+
+inline esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status) {
+  snprintf(req->status, sizeof(req->status), "%s", status);
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type) {
+  snprintf(req->type, sizeof(req->type), "%s", type);
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field,
+                                    const char *value) {
+  (void)req, (void)field, (void)value;
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf,
+                                       ssize_t len) {
+  if (len == HTTPD_RESP_USE_STRLEN) {
+    len = buf ? strlen(buf) : 0;
+  }
+  if (req->responseLen + len >= sizeof(req->response)) {
+    return ESP_FAIL;
+  }
+  memcpy(req->response + req->responseLen, buf, len);
+  req->responseLen += len;
+  req->response[req->responseLen] = '\0';
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf,
+                                 ssize_t len) {
+  req->responseLen = 0;
+  req->response[0] = '\0';
+  return httpd_resp_send_chunk(req, buf, len);
+}
+
+inline size_t httpd_req_get_url_query_len(httpd_req_t *req) {
+  return req->query ? strlen(req->query) : 0;
+}
+
+inline esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf,
+                                             size_t size) {
+  if (!req->query) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  snprintf(buf, size, "%s", req->query);
+  return strlen(req->query) < size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+inline esp_err_t httpd_query_key_value(const char *query, const char *key,
+                                       char *val, size_t size) {
+  size_t keyLen = strlen(key);
+  for (const char *p = query; p && *p;) {
+    const char *end = strchr(p, '&');
+    size_t pairLen = end ? (size_t)(end - p) : strlen(p);
+    if (pairLen > keyLen && strncmp(p, key, keyLen) == 0 && p[keyLen] == '=') {
+      size_t n = pairLen - keyLen - 1;
+      if (n >= size) {
+        return ESP_ERR_INVALID_SIZE;
+      }
+      memcpy(val, p + keyLen + 1, n);
+      val[n] = '\0';
+      return ESP_OK;
+    }
+    p = end ? end + 1 : NULL;
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+inline int httpd_req_recv(httpd_req_t *req, char *buf, size_t size) {
+  size_t left = req->content_len - req->bodyRead;
+  size_t n = size < left ? size : left;
+  memcpy(buf, req->body + req->bodyRead, n);
+  req->bodyRead += n;
+  return n ? (int)n : HTTPD_SOCK_ERR_FAIL;
+}
+
+#endif
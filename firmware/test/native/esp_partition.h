@@ -0,0 +1,73 @@
+#ifndef NATIVE_ESP_PARTITION_H
+#define NATIVE_ESP_PARTITION_H
+#include <esp_err.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// a partition is backed by host memory the test hands in. Writes behave
+// like nor flash and can only clear bits, except that programming a bit
+// back to 1 fails instead of being ignored, so a missed erase shows up.
+struct esp_partition_t {
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+  uint8_t *mock; // host only, size bytes
+};
+
+struct MockFlashStats {
+  uint32_t sectorsErased;
+  uint32_t writes;
+  uint64_t bytesWritten;
+  uint32_t faults; // writes over unerased bytes, misaligned erases
+};
+
+inline MockFlashStats &mockFlashStats() {
+  static MockFlashStats stats;
+  return stats;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t *part,
+                                           size_t offset, size_t size) {
+  if (offset % 4096 || size % 4096) {
+    mockFlashStats().faults++;
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (offset + size > part->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  memset(part->mock + offset, 0xff, size);
+  mockFlashStats().sectorsErased += size / 4096;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t *part,
+                                     size_t offset, const void *src,
+                                     size_t size) {
+  if (offset + size > part->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  const uint8_t *in = (const uint8_t *)src;
+  uint8_t *out = part->mock + offset;
+  for (size_t i = 0; i < size; i++) {
+    if (in[i] & ~out[i]) {
+      mockFlashStats().faults++;
+      return ESP_FAIL;
+    }
+    out[i] &= in[i];
+  }
+  mockFlashStats().writes++;
+  mockFlashStats().bytesWritten += size;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset,
+                                    void *dst, size_t size) {
+  if (offset + size > part->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  memcpy(dst, part->mock + offset, size);
+  return ESP_OK;
+}
+
+#endif
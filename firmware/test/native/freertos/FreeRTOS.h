@@ -0,0 +1,201 @@
+#ifndef NATIVE_FREERTOS_H
+#define NATIVE_FREERTOS_H
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+// tasks, queues, semaphores and task notifications on std::thread, enough
+// for the firmware files the native tests build. Ticks are milliseconds;
+// priorities and core affinity are ignored. One behaviour differs: a task
+// ends when its function returns, vTaskDelete(NULL) only marks the spot.
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+struct NativeTask {
+  std::mutex lock;
+  std::condition_variable cv;
+  uint32_t notify = 0;
+};
+
+struct NativeQueue {
+  std::mutex lock;
+  std::condition_variable cv;
+  std::vector<uint8_t> items;
+  size_t itemSize = 0;
+  size_t length = 0;
+  size_t head = 0;
+  size_t count = 0;
+};
+
+typedef NativeTask *TaskHandle_t;
+typedef NativeQueue *QueueHandle_t;
+typedef NativeQueue *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+template <typename Ready>
+inline bool nativeWait(std::unique_lock<std::mutex> &lock,
+                       std::condition_variable &cv, TickType_t ticks,
+                       Ready ready) {
+  if (ticks == portMAX_DELAY) {
+    cv.wait(lock, ready);
+    return true;
+  }
+  return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+// the main thread gets a task the first time it asks for one
+inline NativeTask *&nativeCurrentTask() {
+  thread_local NativeTask *task = nullptr;
+  return task;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+  NativeTask *&task = nativeCurrentTask();
+  if (!task) {
+    task = new NativeTask;
+  }
+  return task;
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                          uint32_t stack, void *arg,
+                                          UBaseType_t priority,
+                                          TaskHandle_t *created, BaseType_t core) {
+  (void)name, (void)stack, (void)priority, (void)core;
+  NativeTask *task = new NativeTask;
+  if (created) {
+    *created = task;
+  }
+  std::thread([fn, arg, task] {
+    nativeCurrentTask() = task;
+    fn(arg);
+  }).detach();
+  return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name,
+                              uint32_t stack, void *arg, UBaseType_t priority,
+                              TaskHandle_t *created) {
+  return xTaskCreatePinnedToCore(fn, name, stack, arg, priority, created, 0);
+}
+
+inline void vTaskDelete(TaskHandle_t task) { (void)task; }
+
+inline TickType_t xTaskGetTickCount() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return duration_cast<milliseconds>(steady_clock::now() - start).count();
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+  if (ticks == 0) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+  }
+}
+
+#define taskYIELD() std::this_thread::yield()
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+  NativeTask *task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->lock);
+  nativeWait(lock, task->cv, ticks, [task] { return task->notify > 0; });
+  uint32_t value = task->notify;
+  if (value) {
+    task->notify = clear ? 0 : value - 1;
+  }
+  return value;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  std::lock_guard<std::mutex> lock(task->lock);
+  task->notify++;
+  task->cv.notify_all();
+  return pdPASS;
+}
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  NativeQueue *q = new NativeQueue;
+  q->items.resize(length * itemSize);
+  q->itemSize = itemSize;
+  q->length = length;
+  return q;
+}
+
+inline void vQueueDelete(QueueHandle_t q) { delete q; }
+
+inline BaseType_t xQueueSend(QueueHandle_t q, const void *item,
+                             TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(q->lock);
+  if (!nativeWait(lock, q->cv, ticks, [q] { return q->count < q->length; })) {
+    return pdFALSE;
+  }
+  if (item && q->itemSize) {
+    size_t slot = (q->head + q->count) % q->length;
+    memcpy(q->items.data() + slot * q->itemSize, item, q->itemSize);
+  }
+  q->count++;
+  q->cv.notify_all();
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(q->lock);
+  if (!nativeWait(lock, q->cv, ticks, [q] { return q->count > 0; })) {
+    return pdFALSE;
+  }
+  if (item && q->itemSize) {
+    memcpy(item, q->items.data() + q->head * q->itemSize, q->itemSize);
+  }
+  q->head = (q->head + 1) % q->length;
+  q->count--;
+  q->cv.notify_all();
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  std::lock_guard<std::mutex> lock(q->lock);
+  return q->count;
+}
+
+// semaphores are zero-size queues, as in FreeRTOS; a mutex starts given
+// and does not inherit priority
+inline SemaphoreHandle_t xSemaphoreCreateBinary() { return xQueueCreate(1, 0); }
+
+inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max,
+                                                  UBaseType_t initial) {
+  SemaphoreHandle_t s = xQueueCreate(max, 0);
+  s->count = initial;
+  return s;
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+  return xQueueReceive(s, nullptr, ticks);
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+  return xQueueSend(s, nullptr, 0);
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t s) { vQueueDelete(s); }
+
+#endif
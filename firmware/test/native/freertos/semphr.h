@@ -0,0 +1,4 @@
+#ifndef NATIVE_FREERTOS_SEMPHR_H
+#define NATIVE_FREERTOS_SEMPHR_H
+#include <freertos/FreeRTOS.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef NATIVE_FREERTOS_TASK_H
+#define NATIVE_FREERTOS_TASK_H
+#include <freertos/FreeRTOS.h>
+#endif
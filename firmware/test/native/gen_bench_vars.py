@@ -0,0 +1,73 @@
+"""Variable tables for the dispatch benchmarks (test/test_var_dispatch).
+
+Writes a synthetic sketch per table size and runs the real generator over
+it, so the benchmarks measure exactly what a sketch with that many tunable
+globals would get. Used as a PlatformIO pre: script by [env:native], which
+puts the output on the include path; also runs standalone:
+
+    python3 test/native/gen_bench_vars.py <out dir>
+"""
+
+import contextlib
+import io
+import os
+import sys
+
+SIZES = (5, 50, 500)
+
+# the types aiVarSet() handles in place; char * is left out since every
+# set of one is a strdup by design
+DECLS = (
+    "int {} = 0;",
+    "float {} = 0;",
+    "bool {} = false;",
+    "uint8_t {} = 0;",
+    "uint16_t {} = 0;",
+    "uint32_t {} = 0;",
+    "char {}[16] = \"\";",
+    "String {};",
+)
+
+
+def sketch(count):
+    lines = ["// generated by gen_bench_vars.py"]
+    for i in range(count):
+        lines.append(DECLS[i % len(DECLS)].format(f"var{i}"))
+    # state the sketch keeps for itself, none of it may end up in the table
+    lines.append("int loops = 0; // novar")
+    # typed functions share the declaration syntax of the globals
+    lines.append("float scaled() { return 0; }")
+    lines.append("bool ready (int pin) { return pin > 0; }")
+    lines += ["", "void ai_test_setup() {}", "", "void ai_test_loop() {}", ""]
+    return "\n".join(lines)
+
+
+def generate(out_dir, backend_dir):
+    sys.path.insert(0, backend_dir)
+    from generate_variable_glue import generate_glue
+
+    for count in SIZES:
+        table_dir = os.path.join(out_dir, str(count))
+        src = os.path.join(table_dir, "sketch.inc")
+        header = os.path.join(table_dir, "ai_vars_gen.h")
+        text = sketch(count)
+        if os.path.exists(header) and os.path.exists(src):
+            with open(src) as f:
+                if f.read() == text:
+                    continue
+        os.makedirs(table_dir, exist_ok=True)
+        with open(src, "w") as f:
+            f.write(text)
+        with contextlib.redirect_stdout(io.StringIO()):
+            generate_glue(src, header)
+
+
+try:
+    Import("env")  # noqa: F821, defined when PlatformIO runs this
+except NameError:
+    here = os.path.dirname(os.path.abspath(__file__))
+    generate(sys.argv[1], os.path.join(here, "..", "..", "..", "backend"))
+else:
+    out = os.path.join(env.subst("$BUILD_DIR"), "bench_vars")  # noqa: F821
+    generate(out, os.path.join(env.subst("$PROJECT_DIR"), "..", "backend"))  # noqa: F821
+    env.Append(CPPPATH=[out])  # noqa: F821
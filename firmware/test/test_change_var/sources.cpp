@@ -0,0 +1,3 @@
+// the firmware files under test, built for the host
+#include "../../src/http_util.cpp"
+#include "../../src/var_batch.cpp"
@@ -0,0 +1,164 @@
+#include "ai_vars_gen.h"
+#include "bench_alloc.h"
+#include "user_module.h"
+#include "var_batch.h"
+#include "var_store.h"
+#include <atomic>
+#include <thread>
+#include <unity.h>
+
+// varBatchHandle(), the /changeVar handler, from request to response text
+// against the sketch's real variable table, with a thread standing in for
+// the ai loop
+
+int servoPin = 13;
+int ledPin = 2;
+int sweepMs = 2700;
+
+static int servoApplied = 0;
+static int ledApplied = 0;
+static int recorded = 0;
+
+void ai_apply_servoPin() { servoApplied++; }
+void ai_apply_ledPin() { ledApplied++; }
+
+bool userModuleActive() { return false; }
+uint16_t userModuleGeneration() { return 0; }
+const AiVar *userModuleVars(size_t *count) {
+  *count = 0;
+  return NULL;
+}
+bool userModuleSetVar(const char *, const char *) { return false; }
+void userModuleApplyVars() {}
+void varStoreRecord(const char *, const char *) { recorded++; }
+
+static std::atomic<bool> loopRunning{false};
+static std::thread loopThread;
+
+static void startAiLoop() {
+  loopRunning = true;
+  loopThread = std::thread([] {
+    while (loopRunning) {
+      varBatchCommit();
+      std::this_thread::yield();
+    }
+  });
+}
+
+static void stopAiLoop() {
+  if (!loopThread.joinable()) {
+    return;
+  }
+  loopRunning = false;
+  loopThread.join();
+}
+
+static httpd_req_t req;
+
+static void changeVar(const char *query, const char *body = NULL) {
+  httpdMockRequest(&req, query, body);
+  TEST_ASSERT_EQUAL(ESP_OK, varBatchHandle(&req));
+}
+
+void setUp() {
+  servoApplied = ledApplied = recorded = 0;
+  startAiLoop();
+}
+
+void tearDown() { stopAiLoop(); }
+
+void test_query_applies_batch() {
+  changeVar("servoPin=14&ledPin=4&sweepMs=900");
+  TEST_ASSERT_EQUAL_STRING("200 OK", req.status);
+  TEST_ASSERT_EQUAL_STRING("Applied 3 variables", req.response);
+  TEST_ASSERT_EQUAL(14, servoPin);
+  TEST_ASSERT_EQUAL(4, ledPin);
+  TEST_ASSERT_EQUAL(900, sweepMs);
+  TEST_ASSERT_EQUAL(1, servoApplied);
+  TEST_ASSERT_EQUAL(1, ledApplied);
+  TEST_ASSERT_EQUAL(3, recorded);
+}
+
+void test_json_applies_batch() {
+  changeVar(NULL, "{\"servoPin\": 5, \"sweepMs\": \"1200\"}");
+  TEST_ASSERT_EQUAL_STRING("200 OK", req.status);
+  TEST_ASSERT_EQUAL_STRING("Applied 2 variables", req.response);
+  TEST_ASSERT_EQUAL(5, servoPin);
+  TEST_ASSERT_EQUAL(1200, sweepMs);
+}
+
+void test_errors() {
+  changeVar(NULL, "{\"servoPin\" 5}");
+  TEST_ASSERT_EQUAL_STRING("400 Bad Request", req.status);
+  TEST_ASSERT_EQUAL_STRING("Error: expected ':'", req.response);
+
+  static char big[VAR_BATCH_BYTES + 16];
+  memset(big, 'a', sizeof(big) - 1);
+  big[1] = '=';
+  changeVar(big);
+  TEST_ASSERT_EQUAL_STRING("400 Bad Request", req.status);
+  TEST_ASSERT_EQUAL_STRING("Error: request too large", req.response);
+  TEST_ASSERT_EQUAL(0, recorded);
+}
+
+// the pairs that do apply still do, the reply names the others
+void test_unknown_name_and_bad_value() {
+  int before = sweepMs;
+  changeVar("servoPin=7&nosuchvar=1&sweepMs=fast");
+  TEST_ASSERT_EQUAL_STRING("400 Bad Request", req.status);
+  TEST_ASSERT_EQUAL_STRING("Error: 2 of 3 variables not applied (unknown or "
+                           "bad value): nosuchvar, sweepMs",
+                           req.response);
+  TEST_ASSERT_EQUAL(7, servoPin);
+  TEST_ASSERT_EQUAL(before, sweepMs);
+  TEST_ASSERT_EQUAL(1, recorded);
+
+  changeVar(NULL, "{\"ledPin\": 99999999999}");
+  TEST_ASSERT_EQUAL_STRING("400 Bad Request", req.status);
+  TEST_ASSERT_EQUAL_STRING("Error: 1 of 1 variables not applied (unknown or "
+                           "bad value): ledPin",
+                           req.response);
+}
+
+void test_queued_while_loop_parked() {
+  stopAiLoop();
+  int before = sweepMs;
+  changeVar("sweepMs=1500");
+  TEST_ASSERT_EQUAL_STRING("202 Accepted", req.status);
+  TEST_ASSERT_EQUAL_STRING(
+      "Queued 1 variables, they apply when the AI loop resumes", req.response);
+  TEST_ASSERT_EQUAL(before, sweepMs);
+  varBatchCommit(); // first step after the loop resumes
+  TEST_ASSERT_EQUAL(1500, sweepMs);
+  startAiLoop();
+}
+
+// the round trip includes the hand over to the loop thread and back
+void bench_change_var() {
+  BenchResult query = benchRun("changeVar/query/3", [](uint64_t) {
+    changeVar("servoPin=13&ledPin=2&sweepMs=2700");
+  });
+  TEST_ASSERT_EQUAL_UINT32(0, query.allocs);
+
+  BenchResult json = benchRun("changeVar/json/3", [](uint64_t) {
+    changeVar(NULL, "{\"servoPin\": 13, \"ledPin\": 2, \"sweepMs\": 2700}");
+  });
+  TEST_ASSERT_EQUAL_UINT32(0, json.allocs);
+
+  BenchResult error = benchRun("changeVar/error", [](uint64_t) {
+    changeVar(NULL, "{\"servoPin\": 13, \"ledPin\"}");
+  });
+  TEST_ASSERT_EQUAL_UINT32(0, error.allocs);
+}
+
+int main() {
+  varBatchInit();
+  UNITY_BEGIN();
+  RUN_TEST(test_query_applies_batch);
+  RUN_TEST(test_json_applies_batch);
+  RUN_TEST(test_errors);
+  RUN_TEST(test_unknown_name_and_bad_value);
+  RUN_TEST(test_queued_while_loop_parked);
+  RUN_TEST(bench_change_var);
+  return UNITY_END();
+}
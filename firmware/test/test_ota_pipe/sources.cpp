@@ -0,0 +1,2 @@
+// the firmware file under test, built for the host
+#include "../../src/ota_pipe.cpp"
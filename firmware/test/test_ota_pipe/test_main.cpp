@@ -0,0 +1,174 @@
+#include "bench_alloc.h"
+#include "ota_pipe.h"
+#include <Update.h>
+#include <unity.h>
+#include <vector>
+
+// OtaPipeline end to end: a mock socket feeding a mock flash partition,
+// for the ring of buffers, the writer task and PartitionSink's erase and
+// hash work between them
+
+#define IMAGE_SIZE (1024 * 1024)
+#define SEGMENT 1436 // payload of one tcp segment over wifi
+
+// hands the image out a segment at a time like a socket would
+class MemoryClient : public Client {
+public:
+  MemoryClient(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+  int available() override {
+    size_t left = size - pos;
+    return left < SEGMENT ? left : SEGMENT;
+  }
+  int read(uint8_t *buf, size_t len) override {
+    size_t n = available() < (int)len ? available() : len;
+    memcpy(buf, data + pos, n);
+    pos += n;
+    return n;
+  }
+  uint8_t connected() override { return pos < size; }
+
+private:
+  const uint8_t *data;
+  size_t size;
+  size_t pos = 0;
+};
+
+static std::vector<uint8_t> image(IMAGE_SIZE);
+static std::vector<uint8_t> flash(2 * IMAGE_SIZE);
+static esp_partition_t part = {0x110000, 2 * IMAGE_SIZE, "ota_1", NULL};
+static uint8_t imageSha[32];
+
+static void sha256(const uint8_t *data, size_t len, uint8_t out[32]) {
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  mbedtls_sha256_update_ret(&ctx, data, len);
+  mbedtls_sha256_finish_ret(&ctx, out);
+}
+
+// a fresh partition as the device leaves it after the last update
+static void resetFlash() {
+  memset(flash.data(), 0x5a, flash.size());
+  mockFlashStats() = MockFlashStats();
+}
+
+static uint8_t lastDigest[32];
+
+static size_t pump(OtaPipeline &pipe, size_t len, size_t claimed) {
+  MemoryClient client(image.data(), len);
+  PartitionSink sink(&part);
+  size_t done = pipe.run(client, claimed, sink);
+  memcpy(lastDigest, sink.digest(), 32);
+  return done;
+}
+
+void setUp() { resetFlash(); }
+void tearDown() {}
+
+void test_sha256_vector() {
+  static const uint8_t abc[32] = {
+      0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40,
+      0xde, 0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17,
+      0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+  uint8_t out[32];
+  sha256((const uint8_t *)"abc", 3, out);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(abc, out, 32);
+}
+
+void test_image_lands_in_flash() {
+  OtaPipeline pipe;
+  TEST_ASSERT_EQUAL(IMAGE_SIZE, pump(pipe, IMAGE_SIZE, IMAGE_SIZE));
+  TEST_ASSERT_TRUE(pipe.finished());
+  TEST_ASSERT_EQUAL_MEMORY(imageSha, lastDigest, 32);
+  TEST_ASSERT_EQUAL_MEMORY(image.data(), flash.data(), IMAGE_SIZE);
+  TEST_ASSERT_EQUAL(0, mockFlashStats().faults);
+  TEST_ASSERT_EQUAL(IMAGE_SIZE / OTA_SECTOR_SIZE,
+                    mockFlashStats().sectorsErased);
+}
+
+void test_odd_sizes() {
+  // a tail shorter than a sector, and a buffer size that is not a multiple
+  OtaPipeline pipe({6000, 3});
+  size_t len = IMAGE_SIZE / 2 + 77;
+  TEST_ASSERT_EQUAL(len, pump(pipe, len, len));
+  TEST_ASSERT_TRUE(pipe.finished());
+  TEST_ASSERT_EQUAL_MEMORY(image.data(), flash.data(), len);
+  TEST_ASSERT_EQUAL(0, mockFlashStats().faults);
+}
+
+void test_stream_ends_early() {
+  OtaPipeline pipe;
+  TEST_ASSERT_EQUAL(IMAGE_SIZE / 2, pump(pipe, IMAGE_SIZE / 2, IMAGE_SIZE));
+  TEST_ASSERT_FALSE(pipe.finished());
+  TEST_ASSERT_FALSE(pipe.sinkFailed());
+  TEST_ASSERT_EQUAL_STRING("stream ended early", pipe.error());
+}
+
+void test_image_larger_than_partition() {
+  OtaPipeline pipe;
+  part.size = IMAGE_SIZE / 4;
+  size_t done = pump(pipe, IMAGE_SIZE, IMAGE_SIZE);
+  part.size = flash.size();
+  TEST_ASSERT_EQUAL(IMAGE_SIZE / 4, done);
+  TEST_ASSERT_TRUE(pipe.sinkFailed());
+  TEST_ASSERT_EQUAL_STRING("image larger than partition", pipe.error());
+}
+
+void test_update_sink() {
+  MemoryClient client(image.data(), IMAGE_SIZE / 4);
+  OtaPipeline pipe;
+  UpdateSink sink;
+  Update.image.clear();
+  TEST_ASSERT_EQUAL(IMAGE_SIZE / 4, pipe.run(client, IMAGE_SIZE / 4, sink));
+  TEST_ASSERT_TRUE(pipe.finished());
+  TEST_ASSERT_EQUAL(IMAGE_SIZE / 4, Update.image.size());
+  TEST_ASSERT_EQUAL_MEMORY(image.data(), Update.image.data(), IMAGE_SIZE / 4);
+}
+
+// a run allocates its buffers, queues and writer task up front, then
+// nothing per byte
+void test_allocations_do_not_scale() {
+  OtaPipeline pipe;
+  pump(pipe, IMAGE_SIZE / 8, IMAGE_SIZE / 8); // first-use allocations
+  uint64_t small =
+      benchAllocs([&] { pump(pipe, IMAGE_SIZE / 8, IMAGE_SIZE / 8); });
+  uint64_t large = benchAllocs([&] { pump(pipe, IMAGE_SIZE, IMAGE_SIZE); });
+  TEST_ASSERT_TRUE(small > OTA_BUF_COUNT);
+  TEST_ASSERT_EQUAL_UINT32(small, large);
+}
+
+void bench_pipeline() {
+  static const OtaPipeConfig configs[] = {
+      {4096, 2}, {4096, 4}, {8192, 4}, {16384, 4}, {32768, 2}};
+  for (const OtaPipeConfig &cfg : configs) {
+    char name[48];
+    snprintf(name, sizeof(name), "otaPipe/1MiB/%ux%u", (unsigned)cfg.bufSize,
+             (unsigned)cfg.bufCount);
+    OtaPipeline pipe(cfg);
+    BenchResult r = benchRun(
+        name, [&](uint64_t) { pump(pipe, IMAGE_SIZE, IMAGE_SIZE); }, 64);
+    printf("bench %-34s %12.1f MB/s\n", name, IMAGE_SIZE / r.nsPerOp * 1e3);
+  }
+}
+
+int main() {
+  uint32_t x = 2463534242u;
+  for (uint8_t &b : image) {
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+    b = x;
+  }
+  sha256(image.data(), IMAGE_SIZE, imageSha);
+  part.mock = flash.data();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_sha256_vector);
+  RUN_TEST(test_image_lands_in_flash);
+  RUN_TEST(test_odd_sizes);
+  RUN_TEST(test_stream_ends_early);
+  RUN_TEST(test_image_larger_than_partition);
+  RUN_TEST(test_update_sink);
+  RUN_TEST(test_allocations_do_not_scale);
+  RUN_TEST(bench_pipeline);
+  return UNITY_END();
+}
@@ -0,0 +1,72 @@
+#ifndef DISPATCH_BENCH_H
+#define DISPATCH_BENCH_H
+#include "ai_vars.h"
+#include "bench.h"
+#include <unity.h>
+
+// shared by the vars_<n>.cpp files, each of which wraps one generated
+// table (test/native/gen_bench_vars.py) in a namespace of its own and
+// instantiates these for its updateVariableGeneric()
+
+typedef bool (*UpdateFn)(const char *name, const char *value);
+
+inline long dispatchRead(const AiVar &var) {
+  switch (var.type) {
+  case AI_VAR_INT:
+    return *(int *)var.addr;
+  case AI_VAR_UINT16:
+    return *(uint16_t *)var.addr;
+  case AI_VAR_UINT32:
+    return *(uint32_t *)var.addr;
+  case AI_VAR_FLOAT:
+    return (long)*(float *)var.addr;
+  case AI_VAR_BOOL:
+    return *(bool *)var.addr;
+  case AI_VAR_UINT8:
+    return *(uint8_t *)var.addr;
+  case AI_VAR_CHAR_ARRAY:
+    return atol((const char *)var.addr);
+  case AI_VAR_STRING:
+    return atol(((String *)var.addr)->c_str());
+  default:
+    return -1;
+  }
+}
+
+// every generated name reaches its own variable, nothing else does
+template <UpdateFn update>
+void checkDispatch(const AiVar *vars, size_t count, bool *pending) {
+  for (size_t i = 0; i < count; i++) {
+    TEST_ASSERT_TRUE(update(vars[i].name, "7"));
+    TEST_ASSERT_EQUAL(vars[i].type == AI_VAR_BOOL ? 1 : 7,
+                      dispatchRead(vars[i]));
+    TEST_ASSERT_TRUE(pending[i]);
+    pending[i] = false;
+  }
+  TEST_ASSERT_FALSE(update("loops", "1")); // declared // novar
+  TEST_ASSERT_FALSE(update("var", "1"));
+  TEST_ASSERT_FALSE(update("nosuchvariable", "1"));
+  TEST_ASSERT_FALSE(update("", "1"));
+}
+
+// hits cycle through the whole table the way a gui sweep would, misses
+// are names that hash somewhere and fail the compare or land on nothing
+template <UpdateFn update>
+void benchDispatch(const char *label, const AiVar *vars, size_t count) {
+  char name[48];
+  snprintf(name, sizeof(name), "dispatch/%s/hit", label);
+  BenchResult hit = benchRun(name, [&](uint64_t i) {
+    update(vars[i % count].name, "42");
+  });
+  TEST_ASSERT_EQUAL_UINT32(0, hit.allocs);
+
+  static const char *const misses[] = {"servoAngle", "var", "VAR0",
+                                       "var99999"};
+  snprintf(name, sizeof(name), "dispatch/%s/miss", label);
+  BenchResult miss = benchRun(name, [&](uint64_t i) {
+    update(misses[i % 4], "42");
+  });
+  TEST_ASSERT_EQUAL_UINT32(0, miss.allocs);
+}
+
+#endif
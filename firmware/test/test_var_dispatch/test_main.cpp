@@ -0,0 +1,19 @@
+#include "bench_alloc.h"
+#include <unity.h>
+
+// updateVariableGeneric() over generated tables of 5, 50 and 500 variables
+
+void test_dispatch_5();
+void test_dispatch_50();
+void test_dispatch_500();
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_dispatch_5);
+  RUN_TEST(test_dispatch_50);
+  RUN_TEST(test_dispatch_500);
+  return UNITY_END();
+}
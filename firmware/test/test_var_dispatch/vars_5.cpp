@@ -0,0 +1,14 @@
+#include "dispatch_bench.h"
+
+namespace vars5 {
+#include "5/ai_vars_gen.h"
+#include "5/sketch.inc"
+} // namespace vars5
+
+void test_dispatch_5() {
+  checkDispatch<vars5::updateVariableGeneric>(vars5::AI_VARS, AI_VAR_COUNT,
+                                              vars5::aiVarPending());
+  benchDispatch<vars5::updateVariableGeneric>("5", vars5::AI_VARS,
+                                              AI_VAR_COUNT);
+  TEST_ASSERT_EQUAL(5, AI_VAR_COUNT);
+}
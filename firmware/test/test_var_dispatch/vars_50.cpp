@@ -0,0 +1,14 @@
+#include "dispatch_bench.h"
+
+namespace vars50 {
+#include "50/ai_vars_gen.h"
+#include "50/sketch.inc"
+} // namespace vars50
+
+void test_dispatch_50() {
+  checkDispatch<vars50::updateVariableGeneric>(vars50::AI_VARS, AI_VAR_COUNT,
+                                              vars50::aiVarPending());
+  benchDispatch<vars50::updateVariableGeneric>("50", vars50::AI_VARS,
+                                              AI_VAR_COUNT);
+  TEST_ASSERT_EQUAL(50, AI_VAR_COUNT);
+}
@@ -0,0 +1,14 @@
+#include "dispatch_bench.h"
+
+namespace vars500 {
+#include "500/ai_vars_gen.h"
+#include "500/sketch.inc"
+} // namespace vars500
+
+void test_dispatch_500() {
+  checkDispatch<vars500::updateVariableGeneric>(vars500::AI_VARS, AI_VAR_COUNT,
+                                              vars500::aiVarPending());
+  benchDispatch<vars500::updateVariableGeneric>("500", vars500::AI_VARS,
+                                              AI_VAR_COUNT);
+  TEST_ASSERT_EQUAL(500, AI_VAR_COUNT);
+}